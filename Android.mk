@@ -9,14 +9,27 @@ commands_recovery_local_path := $(LOCAL_PATH)
 
 LOCAL_SRC_FILES := \
 	extendedcommands.c \
+	dirstats.c \
 	nandroid.c \
+	nandroid_blobs.c \
+	nandroid_compress.c \
+	nandroid_diff.c \
+	nandroid_index.c \
+	nandroid_io.c \
+	nandroid_jobs.c \
+	nandroid_plan.c \
+	nandroid_verify.c \
+	md5.c \
 	legacy.c \
 	commands.c \
 	recovery.c \
 	install.c \
+	keystore.c \
 	roots.c \
+	sha1.c \
 	ui.c \
-	verifier.c
+	verifier.c \
+	verify_cache.c
 
 LOCAL_SRC_FILES += \
     reboot.c \
@@ -38,6 +51,11 @@ ifdef BOARD_HIJACK_RECOVERY_PATH
     LOCAL_CFLAGS += -DBOARD_HIJACK_RECOVERY_PATH=\"$(BOARD_HIJACK_RECOVERY_PATH)\"
 endif
 
+# Hash packages with the ARMv8 SHA-1 instructions.
+ifeq ($(BOARD_HAS_ARMV8_CRYPTO),true)
+    LOCAL_CFLAGS += -mfpu=crypto-neon-fp-armv8
+endif
+
 LOCAL_SRC_FILES += test_roots.c
 
 LOCAL_MODULE := recovery
@@ -141,6 +159,8 @@ endif
 
 LOCAL_MODULE_TAGS := eng
 
+LOCAL_C_INCLUDES += external/zlib
+
 LOCAL_STATIC_LIBRARIES :=
 ifeq ($(BOARD_CUSTOM_RECOVERY_KEYMAPPING),)
   LOCAL_SRC_FILES += default_recovery_ui.c
@@ -149,7 +169,7 @@ else
 endif
 LOCAL_STATIC_LIBRARIES += libclearsilverregex libmkyaffs2image libunyaffs liberase_image libdump_image libflash_image libmtdutils
 LOCAL_STATIC_LIBRARIES += libamend
-LOCAL_STATIC_LIBRARIES += libminzip libunz libmtdutils libmmcutils libmincrypt
+LOCAL_STATIC_LIBRARIES += libminzip libz libmtdutils libmmcutils libmincrypt
 LOCAL_STATIC_LIBRARIES += libminui libpixelflinger_static libpng libcutils
 LOCAL_STATIC_LIBRARIES += libstdc++ libc
 
@@ -180,14 +200,6 @@ ALL_DEFAULT_INSTALLED_MODULES += $(SYMLINKS)
 
 #ALL_DEFAULT_INSTALLED_MODULES += $(SYMLINKS)
 
-include $(CLEAR_VARS)
-LOCAL_MODULE := nandroid-md5.sh
-LOCAL_MODULE_TAGS := eng
-LOCAL_MODULE_CLASS := RECOVERY_EXECUTABLES
-LOCAL_MODULE_PATH := $(TARGET_RECOVERY_ROOT_OUT)/sbin
-LOCAL_SRC_FILES := nandroid-md5.sh
-include $(BUILD_PREBUILT)
-
 include $(CLEAR_VARS)
 LOCAL_MODULE := killrecovery.sh
 LOCAL_MODULE_TAGS := eng
@@ -198,10 +210,14 @@ include $(BUILD_PREBUILT)
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := verifier_test.c verifier.c
+LOCAL_SRC_FILES := verifier_test.c verifier.c sha1.c keystore.c
 
 LOCAL_MODULE := verifier_test
 
+ifeq ($(BOARD_HAS_ARMV8_CRYPTO),true)
+    LOCAL_CFLAGS += -mfpu=crypto-neon-fp-armv8
+endif
+
 LOCAL_FORCE_STATIC_EXECUTABLE := true
 
 LOCAL_MODULE_TAGS := tests
@@ -210,6 +226,13 @@ LOCAL_STATIC_LIBRARIES := libmincrypt libcutils libstdc++ libc
 
 include $(BUILD_EXECUTABLE)
 
+# Converts /res/keys into /res/keys.bin.
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := keystore_tool.c keystore.c sha1.c
+LOCAL_MODULE := keystore_tool
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
 
 include $(commands_recovery_local_path)/amend/Android.mk
 include $(commands_recovery_local_path)/bmlutils/Android.mk
@@ -0,0 +1,175 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "dirstats.h"
+#include "minzip/Hash.h"
+
+#define DIRENT_BUFFER_SIZE (32 * 1024)
+
+// The kernel's layout; libc's struct dirent doesn't always match it.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} InodeKey;
+
+typedef struct {
+    DirStats* stats;
+    HashTable* links;               // inodes with more than one link
+    char* buf;
+} Walk;
+
+static int compare_inodes(const void* a, const void* b)
+{
+    const InodeKey* ka = (const InodeKey*)a;
+    const InodeKey* kb = (const InodeKey*)b;
+    return !(ka->dev == kb->dev && ka->ino == kb->ino);
+}
+
+// Returns nonzero the first time a given hard linked inode is seen.
+static int first_link(Walk* w, const struct stat* st)
+{
+    if (st->st_nlink < 2 || S_ISDIR(st->st_mode))
+        return 1;
+    if (w->links == NULL) {
+        w->links = mzHashTableCreate(64, free);
+        if (w->links == NULL)
+            return 1;
+    }
+    InodeKey* key = malloc(sizeof(InodeKey));
+    if (key == NULL)
+        return 1;
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    unsigned int hash = (unsigned int)st->st_ino * 31 + (unsigned int)st->st_dev;
+    if (mzHashTableLookup(w->links, hash, key, compare_inodes, true) != key) {
+        free(key);
+        return 0;
+    }
+    return 1;
+}
+
+// Walks the directory open on "fd", and closes it.  Directories are read
+// completely before descending, so only one buffer is needed however
+// deep the tree is.
+static int walk_directory(Walk* w, int fd)
+{
+    char* names = NULL;
+    size_t names_len = 0, names_size = 0;
+    int ret = 0;
+
+    for (;;) {
+        int len = syscall(__NR_getdents64, fd, w->buf, DIRENT_BUFFER_SIZE);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            ret = -1;
+        if (len <= 0)
+            break;
+
+        int pos;
+        for (pos = 0; pos < len; ) {
+            struct linux_dirent64* de = (struct linux_dirent64*)(w->buf + pos);
+            pos += de->d_reclen;
+            const char* name = de->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            // Only regular files need an lstat, for their size and links;
+            // everything else is classified from d_type where it is set.
+            struct stat st;
+            if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    ret = -1;
+                    continue;
+                }
+            } else {
+                memset(&st, 0, sizeof(st));
+                st.st_mode = DTTOIF(de->d_type);
+            }
+            int first = first_link(w, &st);
+            if (first)
+                w->stats->inodes++;
+            if (S_ISREG(st.st_mode)) {
+                w->stats->files++;
+                if (first) {
+                    w->stats->bytes += st.st_size;
+                    w->stats->blocks_bytes += (uint64_t)st.st_blocks * 512;
+                }
+            } else if (S_ISLNK(st.st_mode)) {
+                w->stats->symlinks++;
+            } else if (S_ISDIR(st.st_mode)) {
+                w->stats->directories++;
+                // Remember it for later; the buffer is about to be reused.
+                size_t name_len = strlen(name) + 1;
+                if (names_len + name_len > names_size) {
+                    size_t new_size = names_size ? names_size * 2 : 256;
+                    while (new_size < names_len + name_len)
+                        new_size *= 2;
+                    char* new_names = realloc(names, new_size);
+                    if (new_names == NULL) {
+                        ret = -1;
+                        continue;
+                    }
+                    names = new_names;
+                    names_size = new_size;
+                }
+                memcpy(names + names_len, name, name_len);
+                names_len += name_len;
+            } else {
+                w->stats->others++;
+            }
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < names_len; i += strlen(names + i) + 1) {
+        int child = openat(fd, names + i, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (child < 0 || walk_directory(w, child) != 0)
+            ret = -1;
+    }
+    free(names);
+    close(fd);
+    return ret;
+}
+
+int dir_stats_compute(const char* directory, DirStats* stats)
+{
+    Walk w;
+    memset(stats, 0, sizeof(*stats));
+    memset(&w, 0, sizeof(w));
+    w.stats = stats;
+
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    w.buf = malloc(DIRENT_BUFFER_SIZE);
+    if (w.buf == NULL) {
+        close(fd);
+        return -1;
+    }
+    int ret = walk_directory(&w, fd);
+    free(w.buf);
+    mzHashTableFree(w.links);
+    return ret;
+}
+
+uint64_t dir_stats_objects(const DirStats* stats)
+{
+    return 1 + stats->files + stats->directories + stats->symlinks + stats->others;
+}
@@ -0,0 +1,26 @@
+#ifndef DIRSTATS_H
+#define DIRSTATS_H
+
+#include <stdint.h>
+
+// What is under a directory, gathered in a single pass that reads each
+// directory with getdents64 and lstats only the regular files, relative
+// to their parent (no path building, no fork of find).
+typedef struct {
+    uint64_t files;
+    uint64_t directories;           // not counting the top one
+    uint64_t symlinks;
+    uint64_t others;                // devices, fifos and sockets
+    uint64_t bytes;                 // apparent size of regular files
+    uint64_t blocks_bytes;          // space allocated to regular files
+    uint64_t inodes;                // hard links counted once
+} DirStats;
+
+// Everything below "directory".  Returns 0 on success; on failure
+// "stats" holds what was seen so far.
+int dir_stats_compute(const char* directory, DirStats* stats);
+
+// Number of entries "find <directory>" would print.
+uint64_t dir_stats_objects(const DirStats* stats);
+
+#endif
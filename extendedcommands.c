@@ -41,6 +41,7 @@
 
 #include "extendedcommands.h"
 #include "nandroid.h"
+#include "nandroid_index.h"
 
 static const char *SDCARD_PATH = "SDCARD:";
 #define SDCARD_PATH_LENGTH 7
@@ -508,7 +509,7 @@ __system(const char *command)
     return (pid == -1 ? -1 : pstat);
 }
 
-void show_nandroid_restore_menu()
+static void show_nandroid_restore_menu_extended(int differential)
 {
     if (ensure_root_path_mounted("SDCARD:") != 0) {
         LOGE ("Can't mount /sdcard\n");
@@ -524,10 +525,125 @@ void show_nandroid_restore_menu()
     if (file == NULL)
         return;
 
-    if (confirm_selection("Confirm restore?", "Yes - Restore"))
+    if (!confirm_selection("Confirm restore?", "Yes - Restore"))
+        return;
+    if (differential)
+        nandroid_restore_differential(file, 1, 1, 1, 1, 1);
+    else
         nandroid_restore(file, 1, 1, 1, 1, 1);
 }
 
+void show_nandroid_restore_menu()
+{
+    show_nandroid_restore_menu_extended(0);
+}
+
+void show_nandroid_file_restore_menu()
+{
+    if (ensure_root_path_mounted("SDCARD:") != 0) {
+        LOGE ("Can't mount /sdcard\n");
+        return;
+    }
+
+    static char* backup_headers[] = {  "Choose a backup to restore",
+                                       "files from",
+                                       "",
+                                       NULL
+    };
+
+    char* file = choose_file_menu("/sdcard/clockworkmod/backup/", NULL, backup_headers);
+    if (file == NULL)
+        return;
+    char backup_path[PATH_MAX];
+    strcpy(backup_path, file);
+
+    static char* partition_headers[] = {  "Restore files from",
+                                          "",
+                                          NULL
+    };
+    static char* partitions[] = { "system", "data", "cache", "sd-ext", NULL };
+    static char* roots[] = { "SYSTEM:", "DATA:", "CACHE:", "SDEXT:" };
+
+    int partition = get_menu_selection(partition_headers, partitions, 0);
+    if (partition == GO_BACK)
+        return;
+    char index[PATH_MAX];
+    sprintf(index, "%s/%s.img.idx", backup_path, partitions[partition]);
+
+    // Browse the index one directory at a time.
+    char prefix[PATH_MAX] = "";
+    for (;;)
+    {
+        char** children = nandroid_index_list(index, prefix);
+        if (children == NULL)
+        {
+            ui_print("This backup has no index for %s.\n", partitions[partition]);
+            return;
+        }
+        int count = 0;
+        while (children[count] != NULL)
+            count++;
+
+        char** list = (char**) malloc((count + 2) * sizeof(char*));
+        list[0] = strdup(prefix[0] == '\0' ? "Restore everything" : "Restore this directory");
+        int i;
+        for (i = 0; i < count; i++)
+            list[i + 1] = children[i];
+        list[count + 1] = NULL;
+        free(children);
+
+        char* headers[] = { "Choose what to restore", prefix, "", NULL };
+        int chosen_item = get_menu_selection(headers, list, 0);
+
+        char target[PATH_MAX];
+        target[0] = '\0';
+        if (chosen_item == GO_BACK)
+        {
+            if (prefix[0] == '\0')
+            {
+                free_string_array(list);
+                return;
+            }
+            char* slash = strrchr(prefix, '/');
+            if (slash != NULL)
+                *slash = '\0';
+            else
+                prefix[0] = '\0';
+        }
+        else if (chosen_item == 0)
+        {
+            strcpy(target, prefix);
+        }
+        else
+        {
+            char* name = list[chosen_item];
+            int len = strlen(name);
+            if (prefix[0] != '\0')
+                sprintf(target, "%s/%s", prefix, name);
+            else
+                strcpy(target, name);
+            if (len > 0 && name[len - 1] == '/')
+            {
+                // Go into the directory rather than restoring it.
+                target[strlen(target) - 1] = '\0';
+                strcpy(prefix, target);
+                target[0] = '\0';
+            }
+        }
+        free_string_array(list);
+
+        if (target[0] != '\0' || chosen_item == 0)
+        {
+            if (confirm_selection("Confirm restore?", "Yes - Restore files"))
+            {
+                const char* paths[] = { target };
+                nandroid_restore_files(backup_path, roots[partition], paths, 1);
+            }
+            return;
+        }
+    }
+}
+
 void show_mount_usb_storage_menu()
 {
     char command[PATH_MAX];
@@ -1888,6 +2004,9 @@ void show_nandroid_menu()
     static char* list[] = { "Backup", 
                             "Restore",
                             "Advanced Restore",
+                            "Incremental Backup",
+                            "Restore Single Files",
+                            "Differential Restore",
                             NULL
     };
 
@@ -1895,6 +2014,7 @@ void show_nandroid_menu()
     switch (chosen_item)
     {
         case 0:
+        case 3:
             {
                 char backup_path[PATH_MAX];
                 time_t t = time(NULL);
@@ -1909,7 +2029,10 @@ void show_nandroid_menu()
                 {
                     strftime(backup_path, sizeof(backup_path), "/sdcard/clockworkmod/backup/%F.%H.%M.%S", tmp);
                 }
-                nandroid_backup(backup_path);
+                if (chosen_item == 3)
+                    nandroid_backup_incremental(backup_path);
+                else
+                    nandroid_backup(backup_path);
             }
             break;
         case 1:
@@ -1918,6 +2041,12 @@ void show_nandroid_menu()
         case 2:
             show_nandroid_advanced_restore_menu();
             break;
+        case 4:
+            show_nandroid_file_restore_menu();
+            break;
+        case 5:
+            show_nandroid_restore_menu_extended(1);
+            break;
     }
 }
 
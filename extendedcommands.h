@@ -19,6 +19,9 @@ do_nandroid_restore();
 void
 show_nandroid_restore_menu();
 
+void
+show_nandroid_file_restore_menu();
+
 void
 show_nandroid_menu();
 
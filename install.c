@@ -24,6 +24,7 @@
 
 #include "common.h"
 #include "install.h"
+#include "keystore.h"
 #include "mincrypt/rsa.h"
 #include "minui/minui.h"
 #include "minzip/SysUtil.h"
@@ -31,7 +32,9 @@
 #include "mtdutils/mounts.h"
 #include "mtdutils/mtdutils.h"
 #include "roots.h"
+#include "sha1.h"
 #include "verifier.h"
+#include "verify_cache.h"
 
 #include "firmware.h"
 #include "legacy.h"
@@ -40,7 +43,9 @@
 
 
 #define ASSUMED_UPDATE_BINARY_NAME  "META-INF/com/google/android/update-binary"
+#define UPDATE_BINARY_PREFIX "/tmp/update_binary"
 #define PUBLIC_KEYS_FILE "/res/keys"
+#define PUBLIC_KEYS_STORE "/res/keys.bin"
 
 // The update binary ask us to install a firmware file on reboot.  Set
 // that up.  Takes ownership of type and filename.
@@ -55,7 +60,7 @@ handle_firmware_update(char* type, char* filename, ZipArchive* zip) {
             LOGE("Failed to find \"%s\" in package", filename+8);
             return INSTALL_ERROR;
         }
-        data_size = entry->uncompLen;
+        data_size = mzGetZipEntryUncompLen(entry);
     } else {
         struct stat st_data;
         if (stat(filename, &st_data) < 0) {
@@ -105,6 +110,86 @@ handle_firmware_update(char* type, char* filename, ZipArchive* zip) {
 }
 
 // If the package contains an update binary, extract it and run it.
+typedef struct {
+    SHA1_CTX sha;
+    int fd;                         // -1 to only hash
+} BinaryCopy;
+
+static bool
+copy_binary_data(const unsigned char* data, int len, void* cookie) {
+    BinaryCopy* copy = (BinaryCopy*)cookie;
+    SHA1_update(&copy->sha, data, len);
+    while (copy->fd >= 0 && len > 0) {
+        ssize_t written = write(copy->fd, data, len);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+// Inflates the update binary, writing it to "fd" unless that's -1, and
+// puts the name it's kept under in /tmp (after the SHA-1 of what was
+// inflated) in "binary".
+static bool
+copy_update_binary(const ZipArchive* zip, const ZipEntry* entry, int fd,
+                   char* binary, size_t binary_size) {
+    BinaryCopy copy;
+    SHA1_init(&copy.sha);
+    copy.fd = fd;
+    if (!mzProcessZipEntryContents(zip, entry, copy_binary_data, &copy)) {
+        return false;
+    }
+    const uint8_t* digest = SHA1_final(&copy.sha);
+    int n = snprintf(binary, binary_size, "%s-", UPDATE_BINARY_PREFIX);
+    int i;
+    for (i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+        n += snprintf(binary + n, binary_size - n, "%02x", digest[i]);
+    }
+    return true;
+}
+
+// Extracts the update binary to /tmp, named after the SHA-1 of its
+// contents, and puts that name in "binary".  Packages that share an
+// update binary (a ROM and the add-ons flashed after it, or the same
+// package flashed again) only inflate it to hash it; it's written once.
+static int
+extract_update_binary(const ZipArchive* zip, const ZipEntry* entry,
+                      char* binary, size_t binary_size) {
+    if (!copy_update_binary(zip, entry, -1, binary, binary_size)) {
+        LOGE("Can't read %s\n", ASSUMED_UPDATE_BINARY_NAME);
+        return -1;
+    }
+    if (access(binary, X_OK) == 0) {
+        LOGI("Using %s extracted before\n", binary);
+        return 0;
+    }
+
+    // Written under another name first, so that an extraction that
+    // fails halfway is never taken for a good one; and named after what
+    // was written, in case the package changed since it was hashed.
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", UPDATE_BINARY_PREFIX);
+    unlink(temp);
+    int fd = creat(temp, 0755);
+    if (fd < 0) {
+        LOGE("Can't make %s\n", temp);
+        return -1;
+    }
+    bool ok = copy_update_binary(zip, entry, fd, binary, binary_size);
+    if (close(fd) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(temp, binary) != 0) {
+        LOGE("Can't copy %s\n", ASSUMED_UPDATE_BINARY_NAME);
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
 static int
 try_update_binary(const char *path, ZipArchive *zip) {
     const ZipEntry* binary_entry =
@@ -113,18 +198,8 @@ try_update_binary(const char *path, ZipArchive *zip) {
         return INSTALL_UPDATE_BINARY_MISSING;
     }
 
-    char* binary = "/tmp/update_binary";
-    unlink(binary);
-    int fd = creat(binary, 0755);
-    if (fd < 0) {
-        LOGE("Can't make %s\n", binary);
-        return 1;
-    }
-    bool ok = mzExtractZipEntryToFile(zip, binary_entry, fd);
-    close(fd);
-
-    if (!ok) {
-        LOGE("Can't copy %s\n", ASSUMED_UPDATE_BINARY_NAME);
+    char binary[PATH_MAX];
+    if (extract_update_binary(zip, binary_entry, binary, sizeof(binary)) != 0) {
         return 1;
     }
 
@@ -252,78 +327,20 @@ handle_update_package(const char *path, ZipArchive *zip)
     return result;
 }
 
-// Reads a file containing one or more public keys as produced by
-// DumpPublicKey:  this is an RSAPublicKey struct as it would appear
-// as a C source literal, eg:
-//
-//  "{64,0xc926ad21,{1795090719,...,-695002876},{-857949815,...,1175080310}}"
-//
-// (Note that the braces and commas in this example are actual
-// characters the parser expects to find in the file; the ellipses
-// indicate more numbers omitted from this example.)
-//
-// The file may contain multiple keys in this format, separated by
-// commas.  The last key must not be followed by a comma.
-//
-// Returns NULL if the file failed to parse, or if it contain zero keys.
+// Loads the binary key store if the ramdisk has one that was written
+// from the current keys, and the keys as DumpPublicKey wrote them
+// otherwise.
 static RSAPublicKey*
-load_keys(const char* filename, int* numKeys) {
-    RSAPublicKey* out = NULL;
-    *numKeys = 0;
-
-    FILE* f = fopen(filename, "r");
-    if (f == NULL) {
-        LOGE("opening %s: %s\n", filename, strerror(errno));
-        goto exit;
-    }
-
-    int i;
-    bool done = false;
-    while (!done) {
-        ++*numKeys;
-        out = realloc(out, *numKeys * sizeof(RSAPublicKey));
-        RSAPublicKey* key = out + (*numKeys - 1);
-        if (fscanf(f, " { %i , 0x%x , { %u",
-                   &(key->len), &(key->n0inv), &(key->n[0])) != 3) {
-            goto exit;
-        }
-        if (key->len != RSANUMWORDS) {
-            LOGE("key length (%d) does not match expected size\n", key->len);
-            goto exit;
-        }
-        for (i = 1; i < key->len; ++i) {
-            if (fscanf(f, " , %u", &(key->n[i])) != 1) goto exit;
-        }
-        if (fscanf(f, " } , { %u", &(key->rr[0])) != 1) goto exit;
-        for (i = 1; i < key->len; ++i) {
-            if (fscanf(f, " , %u", &(key->rr[i])) != 1) goto exit;
-        }
-        fscanf(f, " } } ");
-
-        // if the line ends in a comma, this file has more keys.
-        switch (fgetc(f)) {
-            case ',':
-                // more keys to come.
-                break;
-
-            case EOF:
-                done = true;
-                break;
-
-            default:
-                LOGE("unexpected character between keys\n");
-                goto exit;
+load_keys(int* numKeys, const char** filename) {
+    if (access(PUBLIC_KEYS_STORE, R_OK) == 0) {
+        RSAPublicKey* keys = keystore_load(PUBLIC_KEYS_STORE, PUBLIC_KEYS_FILE, numKeys);
+        if (keys != NULL) {
+            *filename = PUBLIC_KEYS_STORE;
+            return keys;
         }
     }
-
-    fclose(f);
-    return out;
-
-exit:
-    if (f) fclose(f);
-    free(out);
-    *numKeys = 0;
-    return NULL;
+    *filename = PUBLIC_KEYS_FILE;
+    return keystore_load_text(PUBLIC_KEYS_FILE, numKeys);
 }
 
 int
@@ -349,15 +366,18 @@ install_package(const char *root_path)
     LOGI("Update file path: %s\n", path);
 
     int err;
+    RSAPublicKey* loadedKeys = NULL;
+    VerifyJob verify_job;
 
     if (signature_check_enabled) {
         int numKeys;
-        RSAPublicKey* loadedKeys = load_keys(PUBLIC_KEYS_FILE, &numKeys);
+        const char* keysFile;
+        loadedKeys = load_keys(&numKeys, &keysFile);
         if (loadedKeys == NULL) {
             LOGE("Failed to load keys\n");
             return INSTALL_CORRUPT;
         }
-        LOGI("%d key(s) loaded from %s\n", numKeys, PUBLIC_KEYS_FILE);
+        LOGI("%d key(s) loaded from %s\n", numKeys, keysFile);
 
         // Give verification half the progress bar...
         ui_print("Verifying update package...\n");
@@ -365,12 +385,21 @@ install_package(const char *root_path)
                 VERIFICATION_PROGRESS_FRACTION,
                 VERIFICATION_PROGRESS_TIME);
 
-        err = verify_file(path, loadedKeys, numKeys);
-        free(loadedKeys);
-        LOGI("verify_file returned %d\n", err);
-        if (err != VERIFY_SUCCESS) {
-            LOGE("signature verification failed\n");
-            return INSTALL_CORRUPT;
+        // A package that verified before, and hasn't changed since,
+        // isn't hashed again.
+        int cached_key = verify_cache_lookup(path, loadedKeys, numKeys);
+        if (cached_key >= 0) {
+            LOGI("%s verified before with key %d\n", path, cached_key);
+            ui_set_progress(1.0);
+            free(loadedKeys);
+            loadedKeys = NULL;
+        } else {
+            // The package is hashed on another thread while its central
+            // directory is parsed below.  Both read through the page cache,
+            // so the package comes off the card once, and stays cached for
+            // the update binary.  Nothing in it is used until the
+            // signature has checked out.
+            verify_file_start(&verify_job, path, loadedKeys, numKeys);
         }
     }
 
@@ -378,6 +407,22 @@ install_package(const char *root_path)
      */
     ZipArchive zip;
     err = mzOpenZipArchive(path, &zip);
+
+    if (loadedKeys != NULL) {
+        int verified = verify_file_finish(&verify_job);
+        LOGI("verify_file returned %d\n", verified);
+        if (verified == VERIFY_SUCCESS)
+            verify_cache_store(path, &loadedKeys[verify_job.key]);
+        free(loadedKeys);
+        if (verified != VERIFY_SUCCESS) {
+            LOGE("signature verification failed\n");
+            if (err == 0) {
+                mzCloseZipArchive(&zip);
+            }
+            return INSTALL_CORRUPT;
+        }
+    }
+
     if (err != 0) {
         LOGE("Can't open %s\n(%s)\n", path, err != -1 ? strerror(err) : "bad");
         return INSTALL_CORRUPT;
@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "keystore.h"
+#include "sha1.h"
+
+uint64_t keystore_key_id(const RSAPublicKey* key)
+{
+    return ((uint64_t)key->n[1] << 32) | key->n[0];
+}
+
+static int hash_source(const char* source, uint8_t* digest)
+{
+    FILE* f = fopen(source, "rb");
+    if (f == NULL)
+        return -1;
+    SHA1_CTX ctx;
+    SHA1_init(&ctx);
+    unsigned char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        SHA1_update(&ctx, buf, n);
+    int ret = ferror(f) ? -1 : 0;
+    fclose(f);
+    memcpy(digest, SHA1_final(&ctx), SHA1_DIGEST_SIZE);
+    return ret;
+}
+
+// Reads a file containing one or more public keys as produced by
+// DumpPublicKey:  this is an RSAPublicKey struct as it would appear
+// as a C source literal, eg:
+//
+//  "{64,0xc926ad21,{1795090719,...,-695002876},{-857949815,...,1175080310}}"
+//
+// (Note that the braces and commas in this example are actual
+// characters the parser expects to find in the file; the ellipses
+// indicate more numbers omitted from this example.)
+//
+// The file may contain multiple keys in this format, separated by
+// commas.  The last key must not be followed by a comma.
+RSAPublicKey* keystore_load_text(const char* filename, int* numKeys)
+{
+    RSAPublicKey* out = NULL;
+    *numKeys = 0;
+
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        LOGE("opening %s: %s\n", filename, strerror(errno));
+        goto exit;
+    }
+
+    int i;
+    bool done = false;
+    while (!done) {
+        ++*numKeys;
+        out = realloc(out, *numKeys * sizeof(RSAPublicKey));
+        RSAPublicKey* key = out + (*numKeys - 1);
+        if (fscanf(f, " { %i , 0x%x , { %u",
+                   &(key->len), &(key->n0inv), &(key->n[0])) != 3) {
+            goto exit;
+        }
+        if (key->len != RSANUMWORDS) {
+            LOGE("key length (%d) does not match expected size\n", key->len);
+            goto exit;
+        }
+        for (i = 1; i < key->len; ++i) {
+            if (fscanf(f, " , %u", &(key->n[i])) != 1) goto exit;
+        }
+        if (fscanf(f, " } , { %u", &(key->rr[0])) != 1) goto exit;
+        for (i = 1; i < key->len; ++i) {
+            if (fscanf(f, " , %u", &(key->rr[i])) != 1) goto exit;
+        }
+        fscanf(f, " } } ");
+
+        // if the line ends in a comma, this file has more keys.
+        switch (fgetc(f)) {
+            case ',':
+                // more keys to come.
+                break;
+
+            case EOF:
+                done = true;
+                break;
+
+            default:
+                LOGE("unexpected character between keys\n");
+                goto exit;
+        }
+    }
+
+    fclose(f);
+    return out;
+
+exit:
+    if (f) fclose(f);
+    free(out);
+    *numKeys = 0;
+    return NULL;
+}
+
+RSAPublicKey* keystore_load(const char* filename, const char* source, int* numKeys)
+{
+    RSAPublicKey* out = NULL;
+    *numKeys = 0;
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        LOGE("opening %s: %s\n", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    if (st.st_size < KEYSTORE_HEADER_SIZE) {
+        LOGE("%s is too short\n", filename);
+        close(fd);
+        return NULL;
+    }
+    unsigned char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOGE("mapping %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    uint32_t count, key_size;
+    memcpy(&count, map + 4, 4);
+    memcpy(&key_size, map + 8, 4);
+    if (memcmp(map, KEYSTORE_MAGIC, 4) != 0 || key_size != sizeof(RSAPublicKey) ||
+        count == 0 || count > (st.st_size - KEYSTORE_HEADER_SIZE) / key_size ||
+        st.st_size != KEYSTORE_HEADER_SIZE + (off_t)count * key_size) {
+        LOGE("%s is not a key store\n", filename);
+        goto exit;
+    }
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    if (hash_source(source, digest) != 0 ||
+        memcmp(digest, map + 12, SHA1_DIGEST_SIZE) != 0) {
+        LOGW("%s wasn't written from %s\n", filename, source);
+        goto exit;
+    }
+    out = malloc(count * key_size);
+    if (out == NULL) {
+        LOGE("can't allocate %u keys\n", count);
+        goto exit;
+    }
+    memcpy(out, map + KEYSTORE_HEADER_SIZE, count * key_size);
+
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        if (out[i].len != RSANUMWORDS) {
+            LOGE("key length (%d) does not match expected size\n", out[i].len);
+            free(out);
+            out = NULL;
+            goto exit;
+        }
+    }
+    *numKeys = count;
+
+exit:
+    munmap(map, st.st_size);
+    return out;
+}
+
+int keystore_write(const char* filename, const RSAPublicKey* keys, int numKeys,
+                   const char* source)
+{
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    if (hash_source(source, digest) != 0)
+        return -1;
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL)
+        return -1;
+    uint32_t header[2] = { numKeys, sizeof(RSAPublicKey) };
+    fwrite(KEYSTORE_MAGIC, 1, 4, f);
+    fwrite(header, sizeof(header), 1, f);
+    fwrite(digest, sizeof(digest), 1, f);
+    fwrite(keys, sizeof(RSAPublicKey), numKeys, f);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err) {
+        unlink(filename);
+        return -1;
+    }
+    return 0;
+}
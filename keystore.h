@@ -0,0 +1,38 @@
+#ifndef RECOVERY_KEYSTORE_H
+#define RECOVERY_KEYSTORE_H
+
+#include <stdint.h>
+
+#include "mincrypt/rsa.h"
+
+// The keys packages may be signed with.  /res/keys holds them as
+// DumpPublicKey writes them, as C literals; /res/keys.bin, written from
+// that by keystore_tool, holds the same keys in binary:
+//
+//    "RKS1" (4 bytes), key count (4 bytes), sizeof(RSAPublicKey) (4 bytes)
+//    SHA-1 of the /res/keys it was written from (20 bytes)
+//    the RSAPublicKey structs, as they are in memory
+//
+// so that loading them is a single copy.  The build writes /res/keys
+// from the current certificates; a keys.bin that wasn't written from
+// that /res/keys is stale, and isn't used.
+
+#define KEYSTORE_MAGIC "RKS1"
+#define KEYSTORE_HEADER_SIZE 32
+
+// Identifies a key: the low 64 bits of its modulus.  A package may name
+// the key it's signed with by putting "key=<16 hex digits>" in its
+// archive comment, so that that key is tried first.
+uint64_t keystore_key_id(const RSAPublicKey* key);
+
+// Both return NULL if the file failed to parse, or if it contains no
+// keys; the keys are to be free()d.  keystore_load() also returns NULL
+// if "filename" wasn't written from the text keys in "source".
+RSAPublicKey* keystore_load_text(const char* filename, int* numKeys);
+RSAPublicKey* keystore_load(const char* filename, const char* source, int* numKeys);
+
+// Writes "keys", which were loaded from "source", to "filename".
+int keystore_write(const char* filename, const RSAPublicKey* keys, int numKeys,
+                   const char* source);
+
+#endif
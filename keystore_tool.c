@@ -0,0 +1,42 @@
+// Converts the /res/keys that DumpPublicKey writes into the binary
+// /res/keys.bin that recovery loads without parsing, and lists the key
+// IDs that packages can name in their comment.
+//
+//     keystore_tool <keys> <keys.bin>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "keystore.h"
+
+void ui_print(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <keys> <keys.bin>\n", argv[0]);
+        return 2;
+    }
+    int numKeys;
+    RSAPublicKey* keys = keystore_load_text(argv[1], &numKeys);
+    if (keys == NULL) {
+        fprintf(stderr, "can't load keys from %s\n", argv[1]);
+        return 1;
+    }
+    int i;
+    for (i = 0; i < numKeys; i++) {
+        printf("key=%016llx\n", (unsigned long long)keystore_key_id(keys + i));
+    }
+    if (keystore_write(argv[2], keys, numKeys, argv[1]) != 0) {
+        fprintf(stderr, "can't write %s\n", argv[2]);
+        free(keys);
+        return 1;
+    }
+    free(keys);
+    return 0;
+}
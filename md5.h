@@ -0,0 +1,23 @@
+#ifndef RECOVERY_MD5_H
+#define RECOVERY_MD5_H
+
+#include <stdint.h>
+
+#define MD5_DIGEST_SIZE 16
+
+// Same shape as mincrypt's SHA_CTX, so the two can be used side by side.
+typedef struct MD5_CTX {
+    uint64_t count;
+    uint32_t state[4];
+    uint8_t buf[64];
+    uint8_t digest[MD5_DIGEST_SIZE];
+} MD5_CTX;
+
+void MD5_init(MD5_CTX* ctx);
+void MD5_update(MD5_CTX* ctx, const void* data, int len);
+const uint8_t* MD5_final(MD5_CTX* ctx);
+
+// Formats a digest as 32 lowercase hex characters plus a NUL.
+void MD5_hex(const uint8_t* digest, char* out);
+
+#endif
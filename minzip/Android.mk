@@ -16,4 +16,37 @@ LOCAL_MODULE := libminzip
 
 LOCAL_CFLAGS += -Wall
 
+# Inflate with zlib's faster inflateBack() interface.
+ifeq ($(BOARD_MINZIP_INFLATE_BACK),true)
+LOCAL_CFLAGS += -DMINZIP_INFLATE_BACK
+endif
+
 include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := ZipBench.c
+
+LOCAL_MODULE := minzip_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+
+LOCAL_STATIC_LIBRARIES := libminzip libz libc
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := ZipTest.c
+
+LOCAL_MODULE := minzip_test
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+
+LOCAL_STATIC_LIBRARIES := libminzip libz libc
+
+include $(BUILD_EXECUTABLE)
@@ -192,6 +192,37 @@ int sysMapFileSegmentInShmem(int fd, off_t start, long length,
     return 0;
 }
 
+/*
+ * Read part of a file into a new shared memory segment.
+ *
+ * On success, returns 0 and fills out "pMap".  On failure, returns a nonzero
+ * value and does not disturb "pMap".
+ */
+int sysLoadFileSegmentInShmem(int fd, off64_t start, size_t length,
+    MemMapping* pMap)
+{
+    ssize_t actual;
+    void* memPtr;
+
+    assert(pMap != NULL);
+
+    memPtr = sysCreateAnonShmem(length);
+    if (memPtr == NULL)
+        return -1;
+
+    actual = pread64(fd, memPtr, length, start);
+    if (actual < 0 || (size_t) actual != length) {
+        LOGE("only read %d of %d bytes\n", (int) actual, (int) length);
+        munmap(memPtr, length);
+        return -1;
+    }
+
+    pMap->baseAddr = pMap->addr = memPtr;
+    pMap->baseLength = pMap->length = length;
+
+    return 0;
+}
+
 /*
  * Release a memory mapping.
  */
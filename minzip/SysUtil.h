@@ -51,6 +51,13 @@ int sysMapFileInShmem(int fd, MemMapping* pMap);
 int sysMapFileSegmentInShmem(int fd, off_t start, long length,
     MemMapping* pMap);
 
+/*
+ * Like sysLoadFileInShmem, but on only part of a file, read with
+ * pread64() so that it may be beyond what mmap() can reach.
+ */
+int sysLoadFileSegmentInShmem(int fd, off64_t start, size_t length,
+    MemMapping* pMap);
+
 /*
  * Release the pages associated with a shared memory segment.
  *
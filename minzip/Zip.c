@@ -3,14 +3,15 @@
  *
  * Simple Zip file support.
  */
-#include "safe_iop.h"
 #include "zlib.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>     // for uintptr_t
 #include <stdlib.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>   // for S_ISLNK()
 #include <unistd.h>
 
@@ -18,12 +19,34 @@
 #include "Zip.h"
 #include "Bits.h"
 #include "Log.h"
-#include "DirUtil.h"
 
 #undef NDEBUG   // do this after including Log.h
 #include <assert.h>
 
-#define SORT_ENTRIES 1
+/*
+ * How much of a STORED entry is handed to a process function at once.
+ */
+#define STORED_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Larger archives only have their central directory mapped, so that
+ * multi-gigabyte packages don't exhaust a 32-bit address space.
+ */
+#define MAX_MAPPED_ARCHIVE (256 * 1024 * 1024)
+
+/*
+ * How much of a zip stream is read at once.
+ */
+#define SEQUENTIAL_BUF_SIZE (256 * 1024)
+
+/*
+ * Inflate buffers are sized to the entry, within these limits: small
+ * entries don't pay for big buffers, and big ones are read and passed
+ * to the process function (often a write()) in few large pieces.
+ */
+#define INFLATE_BUF_MIN (4 * 1024)
+#define INFLATE_READ_BUF_MAX (256 * 1024)
+#define INFLATE_PROC_BUF_MAX (1024 * 1024)
 
 /*
  * Offset and length constants (java.util.zip naming convention).
@@ -64,9 +87,30 @@ enum {
     EXTSIZ =  8,
     EXTLEN = 12,
 
+    ZIP64_ENDSIG = 0x06064b50,
+    ZIP64_ENDHDR = 56,
+
+    ZIP64_ENDTOT = 32,
+    ZIP64_ENDSIZ = 40,
+    ZIP64_ENDOFF = 48,
+
+    ZIP64_LOCSIG = 0x07064b50,
+    ZIP64_LOCHDR = 20,
+
+    ZIP64_LOCOFF =  8,
+
+    ZIP64_EXTHDR = 24,      // data descriptor of a ZIP64 entry
+    ZIP64_EXTID = 0x0001,   // ZIP64 extended information extra field
+
+    ZIP64_MAGICCOUNT = 0xffff,      // 16- and 32-bit fields with these
+    ZIP64_MAGICVAL = 0xffffffff,    // values overflowed into ZIP64 fields
+
     LOCSIG = 0x04034b50,      // PK34
     LOCHDR = 30,
 
+    LOCFLG_ENCRYPTED = 0x0001,
+    LOCFLG_DESCRIPTOR = 0x0008,   // sizes and CRC follow the data
+
     LOCVER =  4,
     LOCFLG =  6,
     LOCHOW =  8,
@@ -91,70 +135,116 @@ enum {
 static void dumpEntry(const ZipEntry* pEntry)
 {
     LOGI(" %p '%.*s'\n", pEntry->fileName,pEntry->fileNameLen,pEntry->fileName);
-    LOGI("   off=%ld comp=%ld uncomp=%ld how=%d\n", pEntry->offset,
-        pEntry->compLen, pEntry->uncompLen, pEntry->compression);
+    LOGI("   off=%lld comp=%llu uncomp=%llu how=%d\n",
+        (long long)pEntry->offset, (unsigned long long)pEntry->compLen,
+        (unsigned long long)pEntry->uncompLen, pEntry->compression);
 }
 #endif
 
 /*
- * (This is a mzHashTableLookup callback.)
- *
- * Compare two ZipEntry structs, by name.
+ * The name index is a flat open-addressing table built once when the
+ * archive is opened and never changed, so unlike the general HashTable
+ * it needs no tombstones or resizing.  Each slot keeps the full hash so
+ * that most mismatches are rejected without touching the entry.
  */
-static int hashcmpZipEntry(const void* ventry1, const void* ventry2)
-{
-    const ZipEntry* entry1 = (const ZipEntry*) ventry1;
-    const ZipEntry* entry2 = (const ZipEntry*) ventry2;
-
-    if (entry1->fileNameLen != entry2->fileNameLen)
-        return entry1->fileNameLen - entry2->fileNameLen;
-    return memcmp(entry1->fileName, entry2->fileName, entry1->fileNameLen);
-}
+struct ZipNameSlot {
+    uint32_t hash;
+    uint32_t index;             /* 1 + entry index; 0 for an empty slot */
+};
 
 /*
- * (This is a mzHashTableLookup callback.)
- *
- * find a ZipEntry struct by name.
+ * Compute the hash code for a ZipEntry filename, four bytes at a time
+ * (after MurmurHash3).
  */
-static int hashcmpZipName(const void* ventry, const void* vname)
+static uint32_t computeHash(const char* name, unsigned int nameLen)
 {
-    const ZipEntry* entry = (const ZipEntry*) ventry;
-    const char* name = (const char*) vname;
-    unsigned int nameLen = strlen(name);
+    uint32_t hash = nameLen;
+    uint32_t k;
+
+    while (nameLen >= 4) {
+        memcpy(&k, name, 4);
+        k *= 0xcc9e2d51;
+        k = (k << 15) | (k >> 17);
+        hash ^= k * 0x1b873593;
+        hash = (hash << 13) | (hash >> 19);
+        hash = hash * 5 + 0xe6546b64;
+        name += 4;
+        nameLen -= 4;
+    }
+    k = 0;
+    memcpy(&k, name, nameLen);
+    k *= 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    hash ^= k * 0x1b873593;
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
 
-    if (entry->fileNameLen != nameLen)
-        return entry->fileNameLen - nameLen;
-    return memcmp(entry->fileName, name, nameLen);
+static bool entryHasName(const ZipEntry* pEntry, const char* name,
+    unsigned int nameLen)
+{
+    return pEntry->fileNameLen == nameLen &&
+            memcmp(pEntry->fileName, name, nameLen) == 0;
 }
 
 /*
- * Compute the hash code for a ZipEntry filename.
- *
- * Not expected to be compatible with any other hash function, so we init
- * to 2 to ensure it doesn't happen to match.
+ * Find the slot holding "name", or the empty slot where it would go.
+ * Optionally count how many slots were looked at.
  */
-static unsigned int computeHash(const char* name, int nameLen)
+static const ZipNameSlot* findNameSlot(const ZipArchive* pArchive,
+    uint32_t hash, const char* name, unsigned int nameLen, int* pProbes)
 {
-    unsigned int hash = 2;
-
-    while (nameLen--)
-        hash = hash * 31 + *name++;
-
-    return hash;
+    uint32_t i = hash & pArchive->nameIndexMask;
+    int probes = 1;
+    while (true) {
+        const ZipNameSlot* pSlot = &pArchive->pNameIndex[i];
+        if (pSlot->index == 0 || (pSlot->hash == hash &&
+                entryHasName(&pArchive->pEntries[pSlot->index - 1],
+                        name, nameLen))) {
+            if (pProbes != NULL)
+                *pProbes = probes;
+            return pSlot;
+        }
+        i = (i + 1) & pArchive->nameIndexMask;
+        probes++;
+    }
 }
 
-static void addEntryToHashTable(HashTable* pHash, ZipEntry* pEntry)
+/*
+ * Index every entry by name; the table is kept at most half full.
+ */
+static bool buildNameIndex(ZipArchive* pArchive)
 {
-    unsigned int itemHash = computeHash(pEntry->fileName, pEntry->fileNameLen);
-    const ZipEntry* found;
+    unsigned int size = 2;
+    unsigned int i;
+
+    while (size < pArchive->numEntries * 2)
+        size <<= 1;
+    pArchive->pNameIndex = (ZipNameSlot*) calloc(size, sizeof(ZipNameSlot));
+    if (pArchive->pNameIndex == NULL)
+        return false;
+    pArchive->nameIndexMask = size - 1;
 
-    found = (const ZipEntry*)mzHashTableLookup(pHash,
-                itemHash, pEntry, hashcmpZipEntry, true);
-    if (found != pEntry) {
-        LOGW("WARNING: duplicate entry '%.*s' in Zip\n",
-            found->fileNameLen, found->fileName);
-        /* keep going */
+    for (i = 0; i < pArchive->numEntries; i++) {
+        const ZipEntry* pEntry = &pArchive->pEntries[i];
+        uint32_t hash = computeHash(pEntry->fileName, pEntry->fileNameLen);
+        ZipNameSlot* pSlot = (ZipNameSlot*) findNameSlot(pArchive, hash,
+                pEntry->fileName, pEntry->fileNameLen, NULL);
+        if (pSlot->index != 0) {
+            LOGW("WARNING: duplicate entry '%.*s' in Zip\n",
+                pEntry->fileNameLen, pEntry->fileName);
+            /* keep going */
+            continue;
+        }
+        pSlot->hash = hash;
+        pSlot->index = i + 1;
     }
+    return true;
 }
 
 static int validFilename(const char *fileName, unsigned int fileNameLen)
@@ -177,26 +267,209 @@ static int validFilename(const char *fileName, unsigned int fileNameLen)
     return 1;
 }
 
+/*
+ * Compare "len" bytes of an entry's name against "name".  If "prefixOnly"
+ * is set, names that begin with "name" compare equal to it.
+ */
+static int compareEntryName(const ZipEntry *pEntry, const char *name,
+    unsigned int len, bool prefixOnly)
+{
+    unsigned int entryLen = pEntry->fileNameLen;
+    int diff;
+
+    if (prefixOnly && entryLen > len)
+        entryLen = len;
+    diff = memcmp(pEntry->fileName, name, entryLen < len ? entryLen : len);
+    if (diff == 0)
+        diff = (int)entryLen - (int)len;
+    return diff;
+}
+
+/*
+ * Order entries by name.  Entries with the same name keep the order of
+ * the central directory, which their names lie in, so that the index
+ * finds the first of them whatever qsort() does with ties.
+ */
+static int compareEntryNames(const void *a, const void *b)
+{
+    const ZipEntry *pEntryA = (const ZipEntry *)a;
+    const ZipEntry *pEntryB = (const ZipEntry *)b;
+    int diff = compareEntryName(pEntryA, pEntryB->fileName,
+            pEntryB->fileNameLen, false);
+    if (diff == 0 && pEntryA->fileName != pEntryB->fileName)
+        diff = pEntryA->fileName < pEntryB->fileName ? -1 : 1;
+    return diff;
+}
+
+/*
+ * Return a pointer to "len" bytes of the archive at "offset", if they're
+ * mapped; NULL if they have to be read.
+ */
+static const unsigned char* mappedData(const ZipArchive* pArchive,
+    off64_t offset, uint64_t len)
+{
+    if (offset < pArchive->mapOffset ||
+            (uint64_t)(offset - pArchive->mapOffset) > pArchive->map.length ||
+            len > pArchive->map.length - (offset - pArchive->mapOffset))
+        return NULL;
+    return (const unsigned char*)pArchive->map.addr +
+            (offset - pArchive->mapOffset);
+}
+
+/*
+ * Read "len" bytes of the archive at "offset", from the mapping if it
+ * covers them.
+ */
+static bool readArchive(const ZipArchive* pArchive, off64_t offset,
+    unsigned char* buf, size_t len)
+{
+    const unsigned char* data = mappedData(pArchive, offset, len);
+    if (data != NULL) {
+        memcpy(buf, data, len);
+        return true;
+    }
+    return pread64(pArchive->fd, buf, len, offset) == (ssize_t)len;
+}
+
+/*
+ * Find the EOCD in the last "len" bytes of an archive.  We'll find it
+ * immediately unless they have a file comment.
+ */
+static const unsigned char* findEndOfCentralDir(const unsigned char* buf,
+    size_t len)
+{
+    const unsigned char* ptr;
+
+    if (len < ENDHDR)
+        return NULL;
+    for (ptr = buf + len - ENDHDR; ptr >= buf; ptr--) {
+        if (*ptr == (ENDSIG & 0xff) && get4LE(ptr) == ENDSIG)
+            return ptr;
+    }
+    return NULL;
+}
+
+/*
+ * Get the number of entries and the offset of the central directory from
+ * the EOCD "eocd", which is at "eocdOffset" in the archive.  Archives
+ * that outgrow the EOCD's fields set them to ZIP64_MAGICCOUNT or
+ * ZIP64_MAGICVAL, and put a locator right before it that points to a
+ * ZIP64 EOCD record with the real values.
+ */
+static bool getCentralDirInfo(const ZipArchive* pArchive,
+    const unsigned char* eocd, off64_t eocdOffset,
+    uint64_t* pNumEntries, uint64_t* pCdOffset)
+{
+    unsigned char buf[ZIP64_ENDHDR];
+    off64_t locatorOffset = eocdOffset - ZIP64_LOCHDR;
+    off64_t recordOffset;
+
+    *pNumEntries = get2LE(eocd + ENDSUB);
+    *pCdOffset = get4LE(eocd + ENDOFF);
+    if (*pNumEntries != ZIP64_MAGICCOUNT && *pCdOffset != ZIP64_MAGICVAL)
+        return true;
+
+    /* The fields may just hold values that happen to look like the
+     * markers; that's only the case if there's no locator.
+     */
+    if (locatorOffset < 0 ||
+            !readArchive(pArchive, locatorOffset, buf, ZIP64_LOCHDR) ||
+            get4LE(buf) != ZIP64_LOCSIG)
+        return true;
+
+    recordOffset = get8LE(buf + ZIP64_LOCOFF);
+    if (recordOffset < 0 || recordOffset > locatorOffset - ZIP64_ENDHDR ||
+            !readArchive(pArchive, recordOffset, buf, ZIP64_ENDHDR) ||
+            get4LE(buf) != ZIP64_ENDSIG) {
+        LOGW("Bad ZIP64 end-of-central-directory record at %lld\n",
+            (long long)recordOffset);
+        return false;
+    }
+    *pNumEntries = get8LE(buf + ZIP64_ENDTOT);
+    *pCdOffset = get8LE(buf + ZIP64_ENDOFF);
+    return true;
+}
+
+/*
+ * Find the extra field with ID "id" in the "extraLen" bytes of extra
+ * fields at "extra".  Returns its data and sets *pSize, or returns NULL.
+ */
+static const unsigned char* findExtraField(const unsigned char* extra,
+    unsigned int extraLen, unsigned int id, unsigned int* pSize)
+{
+    while (extraLen >= 4) {
+        unsigned int fieldId = get2LE(extra);
+        unsigned int size = get2LE(extra + 2);
+        if (size > extraLen - 4)
+            break;
+        if (fieldId == id) {
+            *pSize = size;
+            return extra + 4;
+        }
+        extra += 4 + size;
+        extraLen -= 4 + size;
+    }
+    return NULL;
+}
+
+/*
+ * Entries too big for the 32-bit size and offset fields have them set to
+ * ZIP64_MAGICVAL, and the real values in a ZIP64 extra field, in this
+ * order; only the fields that overflowed are there.  Local headers have
+ * no offset, so "pLocalHdrOffset" is NULL for them.
+ *
+ * Returns false if the extra field is too short.
+ */
+static bool readZip64Fields(const unsigned char* extra,
+    unsigned int extraLen, uint64_t* pUncompLen, uint64_t* pCompLen,
+    uint64_t* pLocalHdrOffset)
+{
+    uint64_t* fields[3] = { pUncompLen, pCompLen, pLocalHdrOffset };
+    const unsigned char* data;
+    unsigned int size;
+    int i;
+
+    data = findExtraField(extra, extraLen, ZIP64_EXTID, &size);
+    if (data == NULL)
+        return true;
+    for (i = 0; i < 3; i++) {
+        if (fields[i] == NULL || *fields[i] != ZIP64_MAGICVAL)
+            continue;
+        if (size < 8)
+            return false;
+        *fields[i] = get8LE(data);
+        data += 8;
+        size -= 8;
+    }
+    return true;
+}
+
 /*
  * Parse the contents of a Zip archive.  After confirming that the file
  * is in fact a Zip, we scan out the contents of the central directory and
- * store it in a hash table.
+ * index it by name.  "pArchive->map" must cover the central directory
+ * and everything after it.
  *
  * Returns "true" on success.
  */
-static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
+static bool parseZipArchive(ZipArchive* pArchive)
 {
+    const MemMapping* pMap = &pArchive->map;
     bool result = false;
     const unsigned char* ptr;
-    unsigned int i, numEntries, cdOffset;
-    unsigned int val;
+    const unsigned char* mapEnd;
+    unsigned char header[LOCHDR];
+    uint64_t numEntries, cdOffset;
+    unsigned int i, val;
 
     /*
      * The first 4 bytes of the file will either be the local header
      * signature for the first file (LOCSIG) or, if the archive doesn't
      * have any files in it, the end-of-central-directory signature (ENDSIG).
      */
-    val = get4LE(pMap->addr);
+    if (!readArchive(pArchive, 0, header, 4))
+        goto bail;
+    val = get4LE(header);
     if (val == ENDSIG) {
         LOGI("Found Zip archive, but it looks empty\n");
         goto bail;
@@ -205,18 +478,9 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         goto bail;
     }
 
-    /*
-     * Find the EOCD.  We'll find it immediately unless they have a file
-     * comment.
-     */
-    ptr = pMap->addr + pMap->length - ENDHDR;
-
-    while (ptr >= (const unsigned char*) pMap->addr) {
-        if (*ptr == (ENDSIG & 0xff) && get4LE(ptr) == ENDSIG)
-            break;
-        ptr--;
-    }
-    if (ptr < (const unsigned char*) pMap->addr) {
+    mapEnd = (const unsigned char*)pMap->addr + pMap->length;
+    ptr = findEndOfCentralDir(pMap->addr, pMap->length);
+    if (ptr == NULL) {
         LOGI("Could not find end-of-central-directory in Zip\n");
         goto bail;
     }
@@ -226,13 +490,19 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
      * entries in the file, and the file offset of the start of the
      * central directory.
      */
-    numEntries = get2LE(ptr + ENDSUB);
-    cdOffset = get4LE(ptr + ENDOFF);
+    if (!getCentralDirInfo(pArchive, ptr,
+            pArchive->mapOffset + (ptr - (const unsigned char*)pMap->addr),
+            &numEntries, &cdOffset))
+        goto bail;
 
-    LOGVV("numEntries=%d cdOffset=%d\n", numEntries, cdOffset);
-    if (numEntries == 0 || cdOffset >= pMap->length) {
-        LOGW("Invalid entries=%d offset=%d (len=%zd)\n",
-            numEntries, cdOffset, pMap->length);
+    LOGVV("numEntries=%llu cdOffset=%llu\n", (unsigned long long)numEntries,
+        (unsigned long long)cdOffset);
+    if (numEntries == 0 || cdOffset >= (uint64_t)pArchive->fileLength ||
+            numEntries > (pArchive->fileLength - cdOffset) / CENHDR ||
+            mappedData(pArchive, cdOffset, 0) == NULL) {
+        LOGW("Invalid entries=%llu offset=%llu (len=%lld)\n",
+            (unsigned long long)numEntries, (unsigned long long)cdOffset,
+            (long long)pArchive->fileLength);
         goto bail;
     }
 
@@ -241,18 +511,18 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
      */
     pArchive->numEntries = numEntries;
     pArchive->pEntries = (ZipEntry*) calloc(numEntries, sizeof(ZipEntry));
-    pArchive->pHash = mzHashTableCreate(mzHashSize(numEntries), NULL);
-    if (pArchive->pEntries == NULL || pArchive->pHash == NULL)
+    if (pArchive->pEntries == NULL)
         goto bail;
 
-    ptr = pMap->addr + cdOffset;
+    ptr = mappedData(pArchive, cdOffset, 0);
     for (i = 0; i < numEntries; i++) {
         ZipEntry* pEntry;
-        unsigned int fileNameLen, extraLen, commentLen, localHdrOffset;
-        const unsigned char* localHdr;
+        unsigned int fileNameLen, extraLen, commentLen;
+        unsigned int versionMadeBy;
+        uint64_t localHdrOffset;
         const char *fileName;
 
-        if (ptr + CENHDR > (const unsigned char*)pMap->addr + pMap->length) {
+        if (ptr + CENHDR > mapEnd) {
             LOGW("Ran off the end (at %d)\n", i);
             goto bail;
         }
@@ -266,7 +536,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         extraLen = get2LE(ptr + CENEXT);
         commentLen = get2LE(ptr + CENCOM);
         fileName = (const char*)ptr + CENHDR;
-        if (fileName + fileNameLen > (const char*)pMap->addr + pMap->length) {
+        if (fileName + fileNameLen + extraLen > (const char*)mapEnd) {
             LOGW("Filename ran off the end (at %d)\n", i);
             goto bail;
         }
@@ -275,58 +545,7 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
             goto bail;
         }
 
-#if SORT_ENTRIES
-        /* Figure out where this entry should go (binary search).
-         */
-        if (i > 0) {
-            int low, high;
-
-            low = 0;
-            high = i - 1;
-            while (low <= high) {
-                int mid;
-                int diff;
-                int diffLen;
-
-                mid = low + ((high - low) / 2); // avoid overflow
-
-                if (pArchive->pEntries[mid].fileNameLen < fileNameLen) {
-                    diffLen = pArchive->pEntries[mid].fileNameLen;
-                } else {
-                    diffLen = fileNameLen;
-                }
-                diff = strncmp(pArchive->pEntries[mid].fileName, fileName,
-                        diffLen);
-                if (diff == 0) {
-                    diff = pArchive->pEntries[mid].fileNameLen - fileNameLen;
-                }
-                if (diff < 0) {
-                    low = mid + 1;
-                } else if (diff > 0) {
-                    high = mid - 1;
-                } else {
-                    high = mid;
-                    break;
-                }
-            }
-
-            unsigned int target = high + 1;
-            assert(target <= i);
-            if (target != i) {
-                /* It belongs somewhere other than at the end of
-                 * the list.  Make some room at [target].
-                 */
-                memmove(pArchive->pEntries + target + 1,
-                        pArchive->pEntries + target,
-                        (i - target) * sizeof(ZipEntry));
-            }
-            pEntry = &pArchive->pEntries[target];
-        } else {
-            pEntry = &pArchive->pEntries[0];
-        }
-#else
         pEntry = &pArchive->pEntries[i];
-#endif
 
         //LOGI("%d: localHdr=%d fnl=%d el=%d cl=%d\n",
         //    i, localHdrOffset, fileNameLen, extraLen, commentLen);
@@ -337,89 +556,119 @@ static bool parseZipArchive(ZipArchive* pArchive, const MemMapping* pMap)
         pEntry->compLen = get4LE(ptr + CENSIZ);
         pEntry->uncompLen = get4LE(ptr + CENLEN);
         pEntry->compression = get2LE(ptr + CENHOW);
-        pEntry->modTime = get4LE(ptr + CENTIM);
-        pEntry->crc32 = get4LE(ptr + CENCRC);
+        if (!readZip64Fields((const unsigned char*)fileName + fileNameLen,
+                extraLen, &pEntry->uncompLen, &pEntry->compLen,
+                &localHdrOffset)) {
+            LOGW("Bad ZIP64 extra field (at %d)\n", i);
+            goto bail;
+        }
 
-        /* These two are necessary for finding the mode of the file.
+        /* This is necessary for finding the mode of the file.
          */
-        pEntry->versionMadeBy = get2LE(ptr + CENVEM);
-        if ((pEntry->versionMadeBy & 0xff00) != 0 &&
-                (pEntry->versionMadeBy & 0xff00) != CENVEM_UNIX)
+        versionMadeBy = get2LE(ptr + CENVEM);
+        if ((versionMadeBy & 0xff00) != 0 &&
+                (versionMadeBy & 0xff00) != CENVEM_UNIX)
         {
             LOGW("Incompatible \"version made by\": 0x%02x (at %d)\n",
-                    pEntry->versionMadeBy >> 8, i);
+                    versionMadeBy >> 8, i);
             goto bail;
         }
-        pEntry->externalFileAttributes = get4LE(ptr + CENATX);
 
-        // Perform pMap->addr + localHdrOffset, ensuring that it won't
-        // overflow. This is needed because localHdrOffset is untrusted.
-        if (!safe_add((uintptr_t *)&localHdr, (uintptr_t)pMap->addr,
-            (uintptr_t)localHdrOffset)) {
-            LOGW("Integer overflow adding in parseZipArchive\n");
-            goto bail;
-        }
-        if ((uintptr_t)localHdr + LOCHDR >
-            (uintptr_t)pMap->addr + pMap->length) {
-            LOGW("Bad offset to local header: %d (at %d)\n", localHdrOffset, i);
+        // localHdrOffset is untrusted.
+        if (localHdrOffset >= (uint64_t)pArchive->fileLength ||
+                pArchive->fileLength - localHdrOffset < LOCHDR ||
+                !readArchive(pArchive, localHdrOffset, header, LOCHDR)) {
+            LOGW("Bad offset to local header: %llu (at %d)\n",
+                (unsigned long long)localHdrOffset, i);
             goto bail;
         }
-        if (get4LE(localHdr) != LOCSIG) {
+        if (get4LE(header) != LOCSIG) {
             LOGW("Missed a local header sig (at %d)\n", i);
             goto bail;
         }
         pEntry->offset = localHdrOffset + LOCHDR
-            + get2LE(localHdr + LOCNAM) + get2LE(localHdr + LOCEXT);
-        if (!safe_add(NULL, pEntry->offset, pEntry->compLen)) {
-            LOGW("Integer overflow adding in parseZipArchive\n");
-            goto bail;
-        }
-        if ((size_t)pEntry->offset + pEntry->compLen > pMap->length) {
+            + get2LE(header + LOCNAM) + get2LE(header + LOCEXT);
+        if (pEntry->offset > (uint64_t)pArchive->fileLength ||
+                pEntry->compLen > pArchive->fileLength - pEntry->offset) {
             LOGW("Data ran off the end (at %d)\n", i);
             goto bail;
         }
 
-#if !SORT_ENTRIES
-        /* Add to hash table; no need to lock here.
-         * Can't do this now if we're sorting, because entries
-         * will move around.
-         */
-        addEntryToHashTable(pArchive->pHash, pEntry);
-#endif
-
         //dumpEntry(pEntry);
         ptr += CENHDR + fileNameLen + extraLen + commentLen;
     }
 
-#if SORT_ENTRIES
-    /* If we're sorting, we have to wait until all entries
-     * are in their final places, otherwise the pointers will
-     * probably point to the wrong things.
+    /* Sort the entries by name, so that everything under a directory
+     * can be found with a binary search, then index them by name.
      */
-    for (i = 0; i < numEntries; i++) {
-        /* Add to hash table; no need to lock here.
-         */
-        addEntryToHashTable(pArchive->pHash, &pArchive->pEntries[i]);
-    }
-#endif
+    qsort(pArchive->pEntries, numEntries, sizeof(ZipEntry),
+            compareEntryNames);
+    if (!buildNameIndex(pArchive))
+        goto bail;
 
     result = true;
 
 bail:
-    if (!result) {
-        mzHashTableFree(pArchive->pHash);
-        pArchive->pHash = NULL;
-    }
     return result;
 }
 
+/*
+ * Map the central directory and everything after it, for archives too
+ * big to map whole.  The EOCD is found by reading the end of the file.
+ * Where the central directory is beyond what mmap() can reach (2GB with
+ * a 32-bit off_t), it's read into memory instead.
+ */
+static int mapCentralDir(ZipArchive* pArchive, MemMapping* pMap)
+{
+    size_t tailLen = ENDHDR + 0xffff;   /* longest possible comment */
+    off64_t tailOffset;
+    unsigned char* tail;
+    const unsigned char* ptr;
+    uint64_t numEntries, cdOffset, length;
+    bool found;
+
+    if ((off64_t)tailLen > pArchive->fileLength)
+        tailLen = pArchive->fileLength;
+    tailOffset = pArchive->fileLength - tailLen;
+    tail = (unsigned char*) malloc(tailLen);
+    if (tail == NULL)
+        return -1;
+    if (pread64(pArchive->fd, tail, tailLen, tailOffset) != (ssize_t)tailLen) {
+        LOGW("Can't read the end of the archive: %s\n", strerror(errno));
+        free(tail);
+        return -1;
+    }
+    ptr = findEndOfCentralDir(tail, tailLen);
+    found = ptr != NULL && getCentralDirInfo(pArchive, ptr,
+            tailOffset + (ptr - tail), &numEntries, &cdOffset);
+    free(tail);
+    if (!found || cdOffset >= (uint64_t)pArchive->fileLength) {
+        LOGI("Could not find end-of-central-directory in Zip\n");
+        return -1;
+    }
+
+    length = pArchive->fileLength - cdOffset;
+    if (length > LONG_MAX) {
+        LOGW("Central directory is too big (%llu bytes)\n",
+            (unsigned long long)length);
+        return -1;
+    }
+    pArchive->mapOffset = cdOffset;
+    if ((off_t)pArchive->fileLength == pArchive->fileLength &&
+            sysMapFileSegmentInShmem(pArchive->fd, cdOffset, length, pMap) == 0)
+        return 0;
+    return sysLoadFileSegmentInShmem(pArchive->fd, cdOffset, length, pMap);
+}
+
 /*
  * Open a Zip archive and scan out the contents.
  *
  * The easiest way to do this is to mmap() the whole thing and do the
  * traditional backward scan for central directory.  Since the EOCD is
  * a relatively small bit at the end, we should end up only touching a
- * small set of pages.
+ * small set of pages.  Archives bigger than MAX_MAPPED_ARCHIVE (or that
+ * can't be mapped whole) only have their central directory mapped, and
+ * entry data is read as it's needed.
  *
  * This will be called on non-Zip files, especially during startup, so
  * we don't want to be too noisy about failures.  (Do we want a "quiet"
@@ -430,6 +679,7 @@ bail:
 int mzOpenZipArchive(const char* fileName, ZipArchive* pArchive)
 {
     MemMapping map;
+    struct stat st;
     int err;
 
     LOGV("Opening archive '%s' %p\n", fileName, pArchive);
@@ -444,27 +694,37 @@ int mzOpenZipArchive(const char* fileName, ZipArchive* pArchive)
         goto bail;
     }
 
-    if (sysMapFileInShmem(pArchive->fd, &map) != 0) {
+    if (fstat(pArchive->fd, &st) != 0) {
+        err = errno ? errno : -1;
+        LOGV("Unable to stat '%s': %s\n", fileName, strerror(err));
+        goto bail;
+    }
+    if (st.st_size < ENDHDR) {
         err = -1;
-        LOGW("Map of '%s' failed\n", fileName);
+        LOGV("File '%s' too small to be zip (%lld)\n", fileName,
+            (long long)st.st_size);
         goto bail;
     }
+    pArchive->fileLength = st.st_size;
 
-    if (map.length < ENDHDR) {
+    if ((st.st_size > MAX_MAPPED_ARCHIVE ||
+            sysMapFileInShmem(pArchive->fd, &map) != 0) &&
+            mapCentralDir(pArchive, &map) != 0) {
         err = -1;
-        LOGV("File '%s' too small to be zip (%zd)\n", fileName, map.length);
+        LOGW("Map of '%s' failed\n", fileName);
         goto bail;
     }
 
-    if (!parseZipArchive(pArchive, &map)) {
+    sysCopyMap(&pArchive->map, &map);
+    map.addr = NULL;
+
+    if (!parseZipArchive(pArchive)) {
         err = -1;
         LOGV("Parsing '%s' failed\n", fileName);
         goto bail;
     }
 
     err = 0;
-    sysCopyMap(&pArchive->map, &map);
-    map.addr = NULL;
 
 bail:
     if (err != 0)
@@ -474,190 +734,776 @@ bail:
     return err;
 }
 
-/*
- * Close a ZipArchive, closing the file and freeing the contents.
- *
- * NOTE: the ZipArchive may not have been fully created.
- */
-void mzCloseZipArchive(ZipArchive* pArchive)
+/*
+ * Close a ZipArchive, closing the file and freeing the contents.
+ *
+ * NOTE: the ZipArchive may not have been fully created.
+ */
+void mzCloseZipArchive(ZipArchive* pArchive)
+{
+    LOGV("Closing archive %p\n", pArchive);
+
+    if (pArchive->fd >= 0)
+        close(pArchive->fd);
+    if (pArchive->map.addr != NULL)
+        sysReleaseShmem(&pArchive->map);
+
+    free(pArchive->pEntries);
+
+    free(pArchive->pNameIndex);
+
+    pArchive->fd = -1;
+    pArchive->pNameIndex = NULL;
+    pArchive->pEntries = NULL;
+}
+
+/*
+ * Find a matching entry.
+ *
+ * Returns NULL if no matching entry found.
+ */
+const ZipEntry* mzFindZipEntry(const ZipArchive* pArchive,
+        const char* entryName)
+{
+    unsigned int nameLen = strlen(entryName);
+    const ZipNameSlot* pSlot;
+
+    if (pArchive->pNameIndex == NULL)
+        return NULL;
+    pSlot = findNameSlot(pArchive, computeHash(entryName, nameLen),
+            entryName, nameLen, NULL);
+    if (pSlot->index == 0)
+        return NULL;
+    return &pArchive->pEntries[pSlot->index - 1];
+}
+
+/*
+ * Look every entry up by name, and report how many slots that took.
+ */
+double mzZipNameIndexProbeCount(const ZipArchive* pArchive, int* pMaxProbe)
+{
+    unsigned int i;
+    long totalProbe = 0;
+    int maxProbe = 0;
+
+    for (i = 0; i < pArchive->numEntries; i++) {
+        const ZipEntry* pEntry = &pArchive->pEntries[i];
+        int probes;
+        findNameSlot(pArchive,
+                computeHash(pEntry->fileName, pEntry->fileNameLen),
+                pEntry->fileName, pEntry->fileNameLen, &probes);
+        totalProbe += probes;
+        if (probes > maxProbe)
+            maxProbe = probes;
+    }
+    if (pMaxProbe != NULL)
+        *pMaxProbe = maxProbe;
+    return pArchive->numEntries > 0 ?
+            (double)totalProbe / pArchive->numEntries : 0;
+}
+
+/*
+ * Find the range of sorted entries whose names begin with "prefix".
+ */
+unsigned int mzFindZipEntryRange(const ZipArchive* pArchive,
+        const char* prefix, unsigned int* pFirst)
+{
+    unsigned int prefixLen = strlen(prefix);
+    unsigned int low, high, first;
+
+    /* The first entry that isn't sorted before prefix...
+     */
+    low = 0;
+    high = pArchive->numEntries;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (compareEntryName(&pArchive->pEntries[mid], prefix, prefixLen,
+                    false) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    first = low;
+
+    /* ...and the first one after it that doesn't begin with prefix.
+     */
+    high = pArchive->numEntries;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (compareEntryName(&pArchive->pEntries[mid], prefix, prefixLen,
+                    true) == 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *pFirst = first;
+    return low - first;
+}
+
+/*
+ * The entry's record in the central directory, which its name follows.
+ */
+static const unsigned char* centralDirEntry(const ZipEntry* pEntry)
+{
+    return (const unsigned char*)pEntry->fileName - CENHDR;
+}
+
+long mzGetZipEntryModTime(const ZipEntry* pEntry)
+{
+    return get4LE(centralDirEntry(pEntry) + CENTIM);
+}
+
+long mzGetZipEntryCrc32(const ZipEntry* pEntry)
+{
+    return get4LE(centralDirEntry(pEntry) + CENCRC);
+}
+
+/*
+ * Return true if the entry is a symbolic link.
+ */
+bool mzIsZipEntrySymlink(const ZipEntry* pEntry)
+{
+    const unsigned char* ptr = centralDirEntry(pEntry);
+    if ((get2LE(ptr + CENVEM) & 0xff00) == CENVEM_UNIX) {
+        return S_ISLNK(get4LE(ptr + CENATX) >> 16);
+    }
+    return false;
+}
+
+/* Call processFunction on the uncompressed data of a STORED entry.
+ *
+ * If the entry is mapped, the data is handed to processFunction
+ * straight from the mapping instead of being copied into a buffer first.
+ * It is passed in STORED_CHUNK_SIZE pieces, so that callers showing
+ * progress still see it move on large entries.
+ */
+static bool processStoredEntry(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, ProcessZipEntryContentsFunction processFunction,
+    void *cookie)
+{
+    const unsigned char *data = mappedData(pArchive, pEntry->offset,
+            pEntry->compLen);
+    unsigned char *buf = NULL;
+    uint64_t bytesLeft = pEntry->compLen;
+    off64_t offset = pEntry->offset;
+    bool ret = true;
+
+    if (data == NULL && bytesLeft > 0) {
+        buf = (unsigned char *) malloc(bytesLeft < STORED_CHUNK_SIZE ?
+                bytesLeft : STORED_CHUNK_SIZE);
+        if (buf == NULL)
+            return false;
+    }
+    while (bytesLeft > 0 && ret) {
+        size_t count = STORED_CHUNK_SIZE;
+        if (count > bytesLeft) {
+            count = bytesLeft;
+        }
+        if (buf != NULL) {
+            ssize_t n = pread64(pArchive->fd, buf, count, offset);
+            if (n < 0 || (size_t)n != count) {
+                LOGE("Can't read %zu bytes from zip file: %ld\n", count, (long)n);
+                ret = false;
+                break;
+            }
+            ret = processFunction(buf, count, cookie);
+        } else {
+            ret = processFunction(data, count, cookie);
+            data += count;
+        }
+        bytesLeft -= count;
+        offset += count;
+    }
+    free(buf);
+    return ret;
+}
+
+/*
+ * Buffered forward-only input, for mzProcessZipStream().  Bytes
+ * buf[pos..len) have been read but not used yet.
+ */
+typedef struct {
+    int fd;
+    unsigned char *buf;
+    size_t bufLen;
+    size_t pos;
+    size_t len;
+} SequentialInput;
+
+/*
+ * Make sure there is unused input, reading more if needed.  Returns how
+ * much there is; 0 at the end of the input or on an error.
+ */
+static size_t fillSequential(SequentialInput *pInput)
+{
+    ssize_t n;
+
+    if (pInput->pos < pInput->len)
+        return pInput->len - pInput->pos;
+    do {
+        n = read(pInput->fd, pInput->buf, pInput->bufLen);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        LOGE("Can't read zip stream: %s\n", strerror(errno));
+    pInput->pos = 0;
+    pInput->len = n > 0 ? n : 0;
+    return pInput->len;
+}
+
+/*
+ * Read exactly "len" bytes, or skip them if "buf" is NULL.
+ */
+static bool readSequential(SequentialInput *pInput, unsigned char *buf,
+    size_t len)
+{
+    while (len > 0) {
+        size_t count = fillSequential(pInput);
+        if (count == 0)
+            return false;
+        if (count > len)
+            count = len;
+        if (buf != NULL) {
+            memcpy(buf, pInput->buf + pInput->pos, count);
+            buf += count;
+        }
+        pInput->pos += count;
+        len -= count;
+    }
+    return true;
+}
+
+/*
+ * Reading state for one entry.  Nothing in here is shared with the
+ * archive, and the archive is only read with pread64(), so any number of
+ * streams may be open on one archive at once, on any threads.
+ *
+ * Streams made by mzProcessZipStream() read from a SequentialInput
+ * instead, and may not know the entry's sizes until they reach its end.
+ */
+struct ZipEntryStream {
+    const ZipArchive *pArchive; /* NULL for sequential streams */
+    SequentialInput *pInput;    /* sequential streams only */
+    const ZipEntry *pEntry;
+    off64_t offset;             /* next compressed byte in the archive */
+    int64_t compRemaining;      /* -1 if it's not known */
+    int64_t uncompRemaining;
+    bool done;
+    unsigned long crc;          /* sequential streams only */
+    z_stream zstream;           /* DEFLATED only */
+    long readBufLen;
+    unsigned char readBuf[];
+};
+
+/*
+ * Size a buffer for "len" bytes of data.
+ */
+static long inflateBufSize(uint64_t len, long max)
+{
+    if (len < INFLATE_BUF_MIN)
+        return INFLATE_BUF_MIN;
+    return len < (uint64_t)max ? (long)len : max;
+}
+
+static ZipEntryStream* openStream(const ZipArchive *pArchive,
+    SequentialInput *pInput, const ZipEntry *pEntry, int64_t compLen)
+{
+    ZipEntryStream *pStream;
+    long readBufLen = 0;
+    int zerr;
+
+    if (pEntry->compression != STORED && pEntry->compression != DEFLATED) {
+        LOGE("Unsupported compression type %d for entry '%s'\n",
+                pEntry->compression, pEntry->fileName);
+        return NULL;
+    }
+
+    if (pEntry->compression == DEFLATED && pInput == NULL)
+        readBufLen = inflateBufSize(compLen, INFLATE_READ_BUF_MAX);
+    pStream = (ZipEntryStream*) malloc(sizeof(ZipEntryStream) + readBufLen);
+    if (pStream == NULL)
+        return NULL;
+    memset(pStream, 0, sizeof(ZipEntryStream));
+    pStream->readBufLen = readBufLen;
+    pStream->pArchive = pArchive;
+    pStream->pInput = pInput;
+    pStream->pEntry = pEntry;
+    pStream->offset = pEntry->offset;
+    pStream->compRemaining = compLen;
+    pStream->uncompRemaining = pEntry->uncompLen;
+    pStream->crc = crc32(0L, Z_NULL, 0);
+    if (pEntry->compression == STORED)
+        return pStream;
+
+    /*
+     * Use the undocumented "negative window bits" feature to tell zlib
+     * that there's no zlib header waiting for it.
+     */
+    pStream->zstream.zalloc = Z_NULL;
+    pStream->zstream.zfree = Z_NULL;
+    pStream->zstream.opaque = Z_NULL;
+    pStream->zstream.data_type = Z_UNKNOWN;
+    zerr = inflateInit2(&pStream->zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        if (zerr == Z_VERSION_ERROR) {
+            LOGE("Installed zlib is not compatible with linked version (%s)\n",
+                ZLIB_VERSION);
+        } else {
+            LOGE("Call to inflateInit2 failed (zerr=%d)\n", zerr);
+        }
+        free(pStream);
+        return NULL;
+    }
+    return pStream;
+}
+
+ZipEntryStream* mzOpenZipEntryStream(const ZipArchive *pArchive,
+    const ZipEntry *pEntry)
+{
+    return openStream(pArchive, NULL, pEntry, pEntry->compLen);
+}
+
+/*
+ * Copy the next part of a STORED entry out of the archive.
+ */
+static long readStoredStream(ZipEntryStream *pStream, unsigned char *buf,
+    long len)
+{
+    if (len > pStream->uncompRemaining)
+        len = pStream->uncompRemaining;
+    if (pStream->pInput != NULL) {
+        if (!readSequential(pStream->pInput, buf, len)) {
+            LOGE("Zip stream ended in the middle of an entry\n");
+            return -1;
+        }
+    } else if (!readArchive(pStream->pArchive, pStream->offset, buf, len)) {
+        LOGE("Can't read %ld bytes from zip file\n", len);
+        return -1;
+    }
+    pStream->offset += len;
+    pStream->compRemaining -= len;
+    pStream->uncompRemaining -= len;
+    return len;
+}
+
+static long readDeflatedStream(ZipEntryStream *pStream, unsigned char *buf,
+    long len)
+{
+    z_stream *zstream = &pStream->zstream;
+    int zerr;
+
+    zstream->next_out = (Bytef*) buf;
+    zstream->avail_out = len;
+    while (zstream->avail_out > 0 && !pStream->done) {
+        /* inflate straight out of the input buffer */
+        if (pStream->pInput != NULL && zstream->avail_in == 0 &&
+                pStream->compRemaining != 0) {
+            SequentialInput *pInput = pStream->pInput;
+            size_t count = fillSequential(pInput);
+            if (pStream->compRemaining > 0 &&
+                    count > (size_t)pStream->compRemaining)
+                count = pStream->compRemaining;
+            zstream->next_in = pInput->buf + pInput->pos;
+            zstream->avail_in = count;
+        }
+
+        /* read as much as we can */
+        if (pStream->pInput == NULL && zstream->avail_in == 0 &&
+                pStream->compRemaining > 0) {
+            long getSize = (pStream->compRemaining > pStream->readBufLen) ?
+                        pStream->readBufLen : pStream->compRemaining;
+            LOGVV("+++ reading %ld bytes (%lld left)\n",
+                getSize, (long long)pStream->compRemaining);
+
+            ssize_t cc = pread64(pStream->pArchive->fd, pStream->readBuf,
+                    getSize, pStream->offset);
+            if (cc != getSize) {
+                LOGW("inflate read failed (%ld vs %ld)\n", (long)cc, getSize);
+                return -1;
+            }
+
+            pStream->compRemaining -= getSize;
+            pStream->offset += getSize;
+
+            zstream->next_in = pStream->readBuf;
+            zstream->avail_in = getSize;
+        }
+
+        /* uncompress the data */
+        Bytef *nextIn = zstream->next_in;
+        zerr = inflate(zstream, Z_NO_FLUSH);
+        if (pStream->pInput != NULL) {
+            long used = zstream->next_in - nextIn;
+            pStream->pInput->pos += used;
+            if (pStream->compRemaining > 0)
+                pStream->compRemaining -= used;
+        }
+        if (zerr == Z_STREAM_END) {
+            /* zstream->total_out is only 32 bits on some systems */
+            long produced = len - zstream->avail_out;
+            pStream->done = true;
+            if (pStream->compRemaining >= 0 &&
+                    pStream->uncompRemaining != produced) {
+                LOGW("Size mismatch on inflated file (%llu vs %llu)\n",
+                    (unsigned long long)(pStream->pEntry->uncompLen -
+                            pStream->uncompRemaining + produced),
+                    (unsigned long long)pStream->pEntry->uncompLen);
+                return -1;
+            }
+        } else if (zerr != Z_OK) {
+            LOGD("zlib inflate call failed (zerr=%d)\n", zerr);
+            return -1;
+        }
+    }
+    pStream->uncompRemaining -= len - zstream->avail_out;
+    return len - zstream->avail_out;
+}
+
+long mzReadZipEntryStream(ZipEntryStream *pStream, unsigned char *buf,
+    long len)
+{
+    long n;
+
+    if (pStream->pEntry->compression == STORED)
+        n = readStoredStream(pStream, buf, len);
+    else
+        n = readDeflatedStream(pStream, buf, len);
+    if (pStream->pInput != NULL && n > 0)
+        pStream->crc = crc32(pStream->crc, buf, n);
+    return n;
+}
+
+void mzCloseZipEntryStream(ZipEntryStream *pStream)
+{
+    if (pStream == NULL)
+        return;
+    if (pStream->pEntry->compression == DEFLATED)
+        inflateEnd(&pStream->zstream);  /* free up any allocated structures */
+    free(pStream);
+}
+
+/*
+ * Hand one entry of a sequential archive to "entryFunction", then read
+ * whatever it left of the entry, and check it against its CRC.
+ * "header" is the entry's local header, and "record" has room for a
+ * central directory record and the longest name and extra field.
+ */
+static bool processSequentialEntry(SequentialInput *pInput,
+    const unsigned char *header, unsigned char *record,
+    MzStreamEntryFunction entryFunction, void *cookie)
+{
+    unsigned int flags = get2LE(header + LOCFLG);
+    bool hasDescriptor = (flags & LOCFLG_DESCRIPTOR) != 0;
+    unsigned char descriptor[ZIP64_EXTHDR];
+    size_t descriptorLen = EXTHDR;
+    unsigned int extraLen = get2LE(header + LOCEXT);
+    const unsigned char *extra;
+    unsigned int zip64Len;
+    unsigned char scratch[32 * 1024];
+    ZipEntryStream *pStream;
+    ZipEntry entry;
+    unsigned long crc;
+    long n;
+    bool ok;
+
+    /* The entry's accessors read what the local header doesn't keep
+     * from a central directory record, so make one up.
+     */
+    memset(record, 0, CENHDR);
+    set4LE(record, CENSIG);
+    memcpy(record + CENTIM, header + LOCTIM, 4);
+    memcpy(record + CENCRC, header + LOCCRC, 4);
+
+    entry.fileName = (const char *)record + CENHDR;
+    entry.fileNameLen = get2LE(header + LOCNAM);
+    entry.offset = 0;
+    entry.compLen = get4LE(header + LOCSIZ);
+    entry.uncompLen = get4LE(header + LOCLEN);
+    entry.compression = get2LE(header + LOCHOW);
+    extra = record + CENHDR + entry.fileNameLen;
+    if (!readSequential(pInput, record + CENHDR, entry.fileNameLen) ||
+            !readSequential(pInput, (unsigned char *)extra, extraLen)) {
+        LOGW("Zip stream ended in a local header\n");
+        return false;
+    }
+    if (!validFilename(entry.fileName, entry.fileNameLen))
+        return false;
+    if (!readZip64Fields(extra, extraLen, &entry.uncompLen, &entry.compLen,
+            NULL)) {
+        LOGW("Bad ZIP64 extra field in '%.*s'\n", entry.fileNameLen,
+                entry.fileName);
+        return false;
+    }
+    /* ZIP64 entries have 64-bit sizes in their data descriptor. */
+    if (findExtraField(extra, extraLen, ZIP64_EXTID, &zip64Len) != NULL)
+        descriptorLen = ZIP64_EXTHDR;
+    if ((flags & LOCFLG_ENCRYPTED) != 0 ||
+            (hasDescriptor && entry.compression != DEFLATED)) {
+        LOGE("Can't stream entry '%.*s' (flags 0x%04x, method %d)\n",
+                entry.fileNameLen, entry.fileName, flags, entry.compression);
+        return false;
+    }
+    if (hasDescriptor) {
+        /* The sizes and CRC follow the data. */
+        entry.compLen = entry.uncompLen = 0;
+        set4LE(record + CENCRC, 0);
+    }
+
+    pStream = openStream(NULL, pInput, &entry,
+            hasDescriptor ? -1 : (int64_t)entry.compLen);
+    if (pStream == NULL)
+        return false;
+    ok = entryFunction(&entry, pStream, cookie);
+    while (ok && (n = mzReadZipEntryStream(pStream, scratch,
+            sizeof(scratch))) != 0) {
+        if (n < 0)
+            ok = false;
+    }
+    crc = pStream->crc;
+    if (ok && pStream->compRemaining > 0)
+        ok = readSequential(pInput, NULL, pStream->compRemaining);
+    mzCloseZipEntryStream(pStream);
+    if (!ok)
+        return false;
+
+    if (hasDescriptor) {
+        /* The descriptor's signature is optional. */
+        if (!readSequential(pInput, descriptor, descriptorLen - 4))
+            return false;
+        if (get4LE(descriptor) == EXTSIG) {
+            memmove(descriptor, descriptor + 4, descriptorLen - 8);
+            if (!readSequential(pInput, descriptor + descriptorLen - 8, 4))
+                return false;
+        }
+        set4LE(record + CENCRC, get4LE(descriptor));
+    }
+    if (crc != (unsigned long)mzGetZipEntryCrc32(&entry)) {
+        LOGW("CRC for entry %.*s (0x%08lx) != expected (0x%08lx)\n",
+                entry.fileNameLen, entry.fileName, crc,
+                mzGetZipEntryCrc32(&entry));
+        return false;
+    }
+    return true;
+}
+
+bool mzProcessZipStream(int fd, MzStreamEntryFunction entryFunction,
+    void *cookie)
 {
-    LOGV("Closing archive %p\n", pArchive);
+    SequentialInput input;
+    unsigned char header[LOCHDR];
+    unsigned char *record;
+    unsigned int numEntries = 0;
+    bool ret = false;
 
-    if (pArchive->fd >= 0)
-        close(pArchive->fd);
-    if (pArchive->map.addr != NULL)
-        sysReleaseShmem(&pArchive->map);
+    memset(&input, 0, sizeof(input));
+    input.fd = fd;
+    input.bufLen = SEQUENTIAL_BUF_SIZE;
+    input.buf = (unsigned char *) malloc(input.bufLen);
+    record = (unsigned char *) malloc(CENHDR + 0xffff + 0xffff);
+    if (input.buf == NULL || record == NULL)
+        goto bail;
 
-    free(pArchive->pEntries);
+    while (true) {
+        unsigned int sig;
 
-    mzHashTableFree(pArchive->pHash);
+        if (!readSequential(&input, header, 4)) {
+            LOGW("Zip stream ended before its central directory\n");
+            break;
+        }
+        sig = get4LE(header);
+        if (sig == CENSIG || sig == ENDSIG) {
+            /* Everything after the entries is only an index to them. */
+            ret = numEntries > 0;
+            if (!ret)
+                LOGI("Found Zip stream, but it looks empty\n");
+            break;
+        }
+        if (sig != LOCSIG) {
+            LOGW("Missed a local header sig (at %d)\n", numEntries);
+            break;
+        }
+        if (!readSequential(&input, header + 4, LOCHDR - 4) ||
+                !processSequentialEntry(&input, header, record,
+                        entryFunction, cookie)) {
+            LOGW("Processing the Zip stream failed (at %d)\n", numEntries);
+            break;
+        }
+        numEntries++;
+    }
 
-    pArchive->fd = -1;
-    pArchive->pHash = NULL;
-    pArchive->pEntries = NULL;
+bail:
+    free(record);
+    free(input.buf);
+    return ret;
 }
 
+#ifdef MINZIP_INFLATE_BACK
 /*
- * Find a matching entry.
- *
- * Returns NULL if no matching entry found.
+ * zlib's inflateBack() decodes straight into its window and pulls input
+ * through a callback, which saves inflate()'s copying in and out of the
+ * sliding window.  Output is gathered into one adaptive buffer so the
+ * process function isn't called for every 32K window.
  */
-const ZipEntry* mzFindZipEntry(const ZipArchive* pArchive,
-        const char* entryName)
+typedef struct {
+    const ZipArchive *pArchive;
+    ProcessZipEntryContentsFunction processFunction;
+    void *cookie;
+    off64_t offset;
+    int64_t compRemaining;
+    unsigned char *readBuf;
+    long readBufLen;
+    unsigned char *procBuf;
+    long procBufLen;
+    long procUsed;
+    uint64_t total;
+    bool failed;
+} InflateBackState;
+
+static unsigned inflateBackIn(void *cookie, unsigned char **buf)
 {
-    unsigned int itemHash = computeHash(entryName, strlen(entryName));
+    InflateBackState *state = (InflateBackState *)cookie;
+    long getSize = (state->compRemaining > state->readBufLen) ?
+                state->readBufLen : state->compRemaining;
+    if (getSize == 0)
+        return 0;
 
-    return (const ZipEntry*)mzHashTableLookup(pArchive->pHash,
-                itemHash, (char*) entryName, hashcmpZipName, false);
+    ssize_t cc = pread64(state->pArchive->fd, state->readBuf, getSize,
+            state->offset);
+    if (cc != getSize) {
+        LOGW("inflate read failed (%ld vs %ld)\n", (long)cc, getSize);
+        state->failed = true;
+        return 0;
+    }
+    state->compRemaining -= getSize;
+    state->offset += getSize;
+    *buf = state->readBuf;
+    return getSize;
 }
 
-/*
- * Return true if the entry is a symbolic link.
- */
-bool mzIsZipEntrySymlink(const ZipEntry* pEntry)
+static bool flushInflateBack(InflateBackState *state)
 {
-    if ((pEntry->versionMadeBy & 0xff00) == CENVEM_UNIX) {
-        return S_ISLNK(pEntry->externalFileAttributes >> 16);
+    if (state->procUsed == 0)
+        return true;
+    LOGVV("+++ processing %d bytes\n", (int) state->procUsed);
+    bool ret = state->processFunction(state->procBuf, state->procUsed,
+            state->cookie);
+    state->procUsed = 0;
+    if (!ret) {
+        LOGW("Process function elected to fail (in inflate)\n");
+        state->failed = true;
     }
-    return false;
+    return ret;
 }
 
-/* Call processFunction on the uncompressed data of a STORED entry.
- */
-static bool processStoredEntry(const ZipArchive *pArchive,
-    const ZipEntry *pEntry, ProcessZipEntryContentsFunction processFunction,
-    void *cookie)
+static int inflateBackOut(void *cookie, unsigned char *data, unsigned len)
 {
-    size_t bytesLeft = pEntry->compLen;
-    while (bytesLeft > 0) {
-        unsigned char buf[32 * 1024];
-        ssize_t n;
-        size_t count;
-        bool ret;
-
-        count = bytesLeft;
-        if (count > sizeof(buf)) {
-            count = sizeof(buf);
-        }
-        n = read(pArchive->fd, buf, count);
-        if (n < 0 || (size_t)n != count) {
-            LOGE("Can't read %zu bytes from zip file: %ld\n", count, n);
-            return false;
-        }
-        ret = processFunction(buf, n, cookie);
-        if (!ret) {
-            return false;
-        }
-        bytesLeft -= count;
+    InflateBackState *state = (InflateBackState *)cookie;
+    state->total += len;
+    while (len > 0) {
+        long count = state->procBufLen - state->procUsed;
+        if (count > (long)len)
+            count = len;
+        memcpy(state->procBuf + state->procUsed, data, count);
+        state->procUsed += count;
+        data += count;
+        len -= count;
+        if (state->procUsed == state->procBufLen && !flushInflateBack(state))
+            return 1;
     }
-    return true;
+    return 0;
 }
 
 static bool processDeflatedEntry(const ZipArchive *pArchive,
     const ZipEntry *pEntry, ProcessZipEntryContentsFunction processFunction,
     void *cookie)
 {
-    long result = -1;
-    unsigned char readBuf[32 * 1024];
-    unsigned char procBuf[32 * 1024];
+    InflateBackState state;
     z_stream zstream;
+    unsigned char *window;
+    bool ret = false;
     int zerr;
-    long compRemaining;
 
-    compRemaining = pEntry->compLen;
+    memset(&state, 0, sizeof(state));
+    state.pArchive = pArchive;
+    state.processFunction = processFunction;
+    state.cookie = cookie;
+    state.offset = pEntry->offset;
+    state.compRemaining = pEntry->compLen;
+    state.readBufLen = inflateBufSize(pEntry->compLen, INFLATE_READ_BUF_MAX);
+    state.procBufLen = inflateBufSize(pEntry->uncompLen, INFLATE_PROC_BUF_MAX);
+
+    window = (unsigned char *) malloc((1 << MAX_WBITS) + state.readBufLen +
+            state.procBufLen);
+    if (window == NULL)
+        return false;
+    state.readBuf = window + (1 << MAX_WBITS);
+    state.procBuf = state.readBuf + state.readBufLen;
 
-    /*
-     * Initialize the zlib stream.
-     */
     memset(&zstream, 0, sizeof(zstream));
-    zstream.zalloc = Z_NULL;
-    zstream.zfree = Z_NULL;
-    zstream.opaque = Z_NULL;
-    zstream.next_in = NULL;
-    zstream.avail_in = 0;
-    zstream.next_out = (Bytef*) procBuf;
-    zstream.avail_out = sizeof(procBuf);
-    zstream.data_type = Z_UNKNOWN;
-
-    /*
-     * Use the undocumented "negative window bits" feature to tell zlib
-     * that there's no zlib header waiting for it.
-     */
-    zerr = inflateInit2(&zstream, -MAX_WBITS);
+    zerr = inflateBackInit(&zstream, MAX_WBITS, window);
     if (zerr != Z_OK) {
-        if (zerr == Z_VERSION_ERROR) {
-            LOGE("Installed zlib is not compatible with linked version (%s)\n",
-                ZLIB_VERSION);
-        } else {
-            LOGE("Call to inflateInit2 failed (zerr=%d)\n", zerr);
-        }
-        goto bail;
+        LOGE("Call to inflateBackInit failed (zerr=%d)\n", zerr);
+        free(window);
+        return false;
     }
 
-    /*
-     * Loop while we have data.
-     */
-    do {
-        /* read as much as we can */
-        if (zstream.avail_in == 0) {
-            long getSize = (compRemaining > (long)sizeof(readBuf)) ?
-                        (long)sizeof(readBuf) : compRemaining;
-            LOGVV("+++ reading %ld bytes (%ld left)\n",
-                getSize, compRemaining);
-
-            int cc = read(pArchive->fd, readBuf, getSize);
-            if (cc != (int) getSize) {
-                LOGW("inflate read failed (%d vs %ld)\n", cc, getSize);
-                goto z_bail;
-            }
-
-            compRemaining -= getSize;
-
-            zstream.next_in = readBuf;
-            zstream.avail_in = getSize;
-        }
-
-        /* uncompress the data */
-        zerr = inflate(&zstream, Z_NO_FLUSH);
-        if (zerr != Z_OK && zerr != Z_STREAM_END) {
-            LOGD("zlib inflate call failed (zerr=%d)\n", zerr);
-            goto z_bail;
+    zerr = inflateBack(&zstream, inflateBackIn, &state, inflateBackOut, &state);
+    if (zerr == Z_STREAM_END && flushInflateBack(&state)) {
+        if (state.total == pEntry->uncompLen) {
+            ret = true;
+        } else {
+            LOGW("Size mismatch on inflated file (%llu vs %llu)\n",
+                (unsigned long long)state.total,
+                (unsigned long long)pEntry->uncompLen);
         }
+    } else if (!state.failed) {
+        LOGD("zlib inflateBack call failed (zerr=%d)\n", zerr);
+    }
 
-        /* write when we're full or when we're done */
-        if (zstream.avail_out == 0 ||
-            (zerr == Z_STREAM_END && zstream.avail_out != sizeof(procBuf)))
-        {
-            long procSize = zstream.next_out - procBuf;
-            LOGVV("+++ processing %d bytes\n", (int) procSize);
-            bool ret = processFunction(procBuf, procSize, cookie);
-            if (!ret) {
-                LOGW("Process function elected to fail (in inflate)\n");
-                goto z_bail;
-            }
+    inflateBackEnd(&zstream);
+    free(window);
+    return ret;
+}
+#else
+static bool processDeflatedEntry(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, ProcessZipEntryContentsFunction processFunction,
+    void *cookie)
+{
+    unsigned char *procBuf;
+    long procBufLen;
+    ZipEntryStream *pStream;
+    long procSize;
+    bool ret = true;
+
+    procBufLen = inflateBufSize(pEntry->uncompLen, INFLATE_PROC_BUF_MAX);
+    procBuf = (unsigned char *) malloc(procBufLen);
+    if (procBuf == NULL)
+        return false;
+    pStream = mzOpenZipEntryStream(pArchive, pEntry);
+    if (pStream == NULL) {
+        free(procBuf);
+        return false;
+    }
 
-            zstream.next_out = procBuf;
-            zstream.avail_out = sizeof(procBuf);
+    while ((procSize = mzReadZipEntryStream(pStream, procBuf,
+            procBufLen)) > 0) {
+        LOGVV("+++ processing %d bytes\n", (int) procSize);
+        if (!processFunction(procBuf, procSize, cookie)) {
+            LOGW("Process function elected to fail (in inflate)\n");
+            ret = false;
+            break;
         }
-    } while (zerr == Z_OK);
-
-    assert(zerr == Z_STREAM_END);       /* other errors should've been caught */
-
-    // success!
-    result = zstream.total_out;
-
-z_bail:
-    inflateEnd(&zstream);        /* free up any allocated structures */
-
-bail:
-    if (result != pEntry->uncompLen) {
-        if (result != -1)        // error already shown?
-            LOGW("Size mismatch on inflated file (%ld vs %ld)\n",
-                result, pEntry->uncompLen);
-        return false;
     }
-    return true;
+    if (procSize < 0 || (ret && !pStream->done))
+        ret = false;
+
+    mzCloseZipEntryStream(pStream);
+    free(procBuf);
+    return ret;
 }
+#endif
 
 /*
  * Stream the uncompressed data through the supplied function,
@@ -674,13 +1520,6 @@ bool mzProcessZipEntryContents(const ZipArchive *pArchive,
     void *cookie)
 {
     bool ret = false;
-    off_t oldOff;
-
-    /* save current offset */
-    oldOff = lseek(pArchive->fd, 0, SEEK_CUR);
-
-    /* Seek to the beginning of the entry's compressed data. */
-    lseek(pArchive->fd, pEntry->offset, SEEK_SET);
 
     switch (pEntry->compression) {
     case STORED:
@@ -695,8 +1534,6 @@ bool mzProcessZipEntryContents(const ZipArchive *pArchive,
         break;
     }
 
-    /* restore file offset */
-    lseek(pArchive->fd, oldOff, SEEK_SET);
     return ret;
 }
 
@@ -723,9 +1560,10 @@ bool mzIsZipEntryIntact(const ZipArchive *pArchive, const ZipEntry *pEntry)
         LOGE("Can't calculate CRC for entry\n");
         return false;
     }
-    if (crc != (unsigned long)pEntry->crc32) {
+    unsigned long expected = (unsigned long)mzGetZipEntryCrc32(pEntry);
+    if (crc != expected) {
         LOGW("CRC for entry %.*s (0x%08lx) != expected (0x%08lx)\n",
-                pEntry->fileNameLen, pEntry->fileName, crc, pEntry->crc32);
+                pEntry->fileNameLen, pEntry->fileName, crc, expected);
         return false;
     }
     return true;
@@ -795,12 +1633,59 @@ static bool writeProcessFunction(const unsigned char *data, int dataLen,
     }
 }
 
+/* Copy a STORED entry to "fd" with sendfile(), so the data never passes
+ * through user space.  Returns 1 on success, 0 on failure, and -1 if the
+ * kernel can't sendfile() to "fd" (it must be a socket before 2.6.33) or
+ * the entry is beyond what an off_t can reach; nothing has been written
+ * in that case.
+ */
+static int sendStoredEntry(const ZipArchive *pArchive,
+    const ZipEntry *pEntry, int fd)
+{
+    off_t offset = pEntry->offset;
+    size_t bytesLeft = pEntry->compLen;
+    off64_t end = pEntry->offset + pEntry->compLen;
+    if ((off_t)end != end) {
+        return -1;
+    }
+    while (bytesLeft > 0) {
+        ssize_t n = sendfile(fd, pArchive->fd, &offset, bytesLeft);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS) &&
+                bytesLeft == (size_t)pEntry->compLen) {
+            return -1;
+        }
+        if (n <= 0) {
+            LOGE("Error sending %zu bytes from zip file: %s\n",
+                 bytesLeft, n < 0 ? strerror(errno) : "unexpected EOF");
+            return 0;
+        }
+        bytesLeft -= n;
+    }
+    return 1;
+}
+
 /*
  * Uncompress "pEntry" in "pArchive" to "fd" at the current offset.
+ *
+ * STORED entries are copied by the kernel where it can; otherwise they
+ * are written straight from the archive's mapping.
  */
 bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
     const ZipEntry *pEntry, int fd)
 {
+    if (pEntry->compression == STORED) {
+        int sent = sendStoredEntry(pArchive, pEntry, fd);
+        if (sent >= 0) {
+            if (!sent) {
+                LOGE("Can't extract entry to file.\n");
+            }
+            return sent;
+        }
+    }
+
     bool ret = mzProcessZipEntryContents(pArchive, pEntry, writeProcessFunction,
                                          (void*)fd);
     if (!ret) {
@@ -812,13 +1697,17 @@ bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
 
 typedef struct {
     unsigned char* buffer;
-    long len;
+    uint64_t len;
 } BufferExtractCookie;
 
 static bool bufferProcessFunction(const unsigned char *data, int dataLen,
     void *cookie) {
     BufferExtractCookie *bec = (BufferExtractCookie*)cookie;
 
+    if ((uint64_t)dataLen > bec->len) {
+        LOGE("Entry is longer than its size\n");
+        return false;
+    }
     memmove(bec->buffer, data, dataLen);
     bec->buffer += dataLen;
     bec->len -= dataLen;
@@ -847,6 +1736,9 @@ bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
 }
 
 
+#define UNZIP_DIRMODE 0755
+#define UNZIP_FILEMODE 0644
+
 /* Helper state to make path translation easier and less malloc-happy.
  */
 typedef struct {
@@ -907,6 +1799,260 @@ static const char *targetEntryPath(MzPathHelper *helper, ZipEntry *pEntry)
     return helper->buf;
 }
 
+/* The directories mzExtractRecursive() has made sure of, as a trie of
+ * path components under the target directory.  A file's directory is
+ * only looked at on disk the first time it comes up, and then with a
+ * mkdir() rather than a stat() of every level from the root.
+ */
+typedef struct MzDirNode {
+    struct MzDirNode *child;
+    struct MzDirNode *next;     /* sibling */
+    bool created;               /* needs the timestamp */
+    unsigned int nameLen;
+    char name[];
+} MzDirNode;
+
+/* Make sure the directories in path[baseLen..len) exist, creating them
+ * as needed.  "path" is modified while this runs, but is restored.
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int dirCacheMake(MzDirNode **pTop, char *path, size_t baseLen,
+        size_t len)
+{
+    MzDirNode **pList = pTop;
+    size_t start = baseLen;
+
+    while (true) {
+        MzDirNode *node;
+        size_t end;
+
+        while (start < len && path[start] == '/') {
+            start++;
+        }
+        if (start >= len) {
+            return 0;
+        }
+        end = start;
+        while (end < len && path[end] != '/') {
+            end++;
+        }
+
+        for (node = *pList; node != NULL; node = node->next) {
+            if (node->nameLen == end - start &&
+                    memcmp(node->name, path + start, end - start) == 0) {
+                break;
+            }
+        }
+        if (node == NULL) {
+            char saved = path[end];
+            bool created = true;
+            int ret = 0;
+
+            path[end] = '\0';
+            if (mkdir(path, UNZIP_DIRMODE) != 0) {
+                struct stat st;
+                created = false;
+                if (errno != EEXIST) {
+                    ret = -1;
+                } else if (stat(path, &st) != 0) {
+                    ret = -1;
+                } else if (!S_ISDIR(st.st_mode)) {
+                    errno = ENOTDIR;
+                    ret = -1;
+                }
+            }
+            path[end] = saved;
+            if (ret != 0) {
+                return ret;
+            }
+
+            node = (MzDirNode *)malloc(sizeof(MzDirNode) + end - start);
+            if (node == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            node->child = NULL;
+            node->next = *pList;
+            node->created = created;
+            node->nameLen = end - start;
+            memcpy(node->name, path + start, end - start);
+            *pList = node;
+        }
+        pList = &node->child;
+        start = end;
+    }
+}
+
+/* Timestamp the directories that were created, now that nothing more
+ * will be created in them, and free the trie.  "path" holds the parent
+ * directory's path (with a trailing slash) in its first "len" bytes.
+ */
+static void dirCacheFinish(MzDirNode *node, char *path, size_t len,
+        size_t size, const struct utimbuf *timestamp)
+{
+    while (node != NULL) {
+        MzDirNode *next = node->next;
+        size_t nodeLen = len + node->nameLen;
+
+        if (nodeLen + 2 <= size) {
+            memcpy(path + len, node->name, node->nameLen);
+            path[nodeLen] = '/';
+            dirCacheFinish(node->child, path, nodeLen + 1, size, timestamp);
+            path[nodeLen] = '\0';
+            if (node->created && timestamp != NULL &&
+                    utime(path, timestamp) != 0) {
+                LOGW("Can't touch directory \"%s\": %s\n",
+                        path, strerror(errno));
+            }
+        }
+        free(node);
+        node = next;
+    }
+}
+
+/* A regular file for mzExtractRecursive() to inflate.
+ */
+enum { MZ_JOB_PENDING, MZ_JOB_DONE, MZ_JOB_FAILED };
+typedef struct {
+    const ZipEntry *pEntry;
+    char *path;
+    int state;
+} MzExtractJob;
+
+/* Shared by the threads inflating one batch of files.
+ */
+typedef struct {
+    const ZipArchive *pArchive;
+    const struct utimbuf *timestamp;
+    MzExtractJob *jobs;
+    unsigned int numJobs;
+    unsigned int nextJob;       // the next one to claim
+    bool failed;                // stop claiming jobs
+    pthread_mutex_t lock;
+    pthread_cond_t jobDone;
+} MzExtractPool;
+
+static bool extractFile(const ZipArchive *pArchive, const MzExtractJob *job,
+        const struct utimbuf *timestamp)
+{
+    int fd = creat(job->path, UNZIP_FILEMODE);
+    if (fd < 0) {
+        LOGE("Can't create target file \"%s\": %s\n",
+                job->path, strerror(errno));
+        return false;
+    }
+
+    bool ok = mzExtractZipEntryToFile(pArchive, job->pEntry, fd);
+    if (close(fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        LOGE("Error extracting \"%s\"\n", job->path);
+        return false;
+    }
+
+    if (timestamp != NULL && utime(job->path, timestamp)) {
+        LOGE("Error touching \"%s\"\n", job->path);
+        return false;
+    }
+
+    LOGD("Extracted file \"%s\"\n", job->path);
+    return true;
+}
+
+static void *extractWorker(void *arg)
+{
+    MzExtractPool *pool = (MzExtractPool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->failed && pool->nextJob < pool->numJobs) {
+        MzExtractJob *job = &pool->jobs[pool->nextJob++];
+        pthread_mutex_unlock(&pool->lock);
+
+        bool ok = extractFile(pool->pArchive, job, pool->timestamp);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = ok ? MZ_JOB_DONE : MZ_JOB_FAILED;
+        if (!ok) {
+            pool->failed = true;
+        }
+        pthread_cond_broadcast(&pool->jobDone);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Inflate the files on up to MZ_EXTRACT_MAX_THREADS threads.  Files
+ * are independent of each other, since their directories were created
+ * up front.  The callback is invoked on this thread, in archive order.
+ */
+static bool extractFiles(const ZipArchive *pArchive,
+        MzExtractJob *jobs, unsigned int numJobs,
+        const struct utimbuf *timestamp,
+        void (*callback)(const char *fn, void *), void *cookie)
+{
+    pthread_t threads[MZ_EXTRACT_MAX_THREADS];
+    int numThreads = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cpus < 1 ? 1 :
+            cpus > MZ_EXTRACT_MAX_THREADS ? MZ_EXTRACT_MAX_THREADS : cpus;
+    if ((unsigned int)maxThreads > numJobs) {
+        maxThreads = numJobs;
+    }
+
+    MzExtractPool pool;
+    pool.pArchive = pArchive;
+    pool.timestamp = timestamp;
+    pool.jobs = jobs;
+    pool.numJobs = numJobs;
+    pool.nextJob = 0;
+    pool.failed = false;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.jobDone, NULL);
+
+    if (maxThreads > 1) {
+        while (numThreads < maxThreads &&
+                pthread_create(&threads[numThreads], NULL,
+                        extractWorker, &pool) == 0) {
+            numThreads++;
+        }
+    }
+
+    unsigned int reported = 0;
+    if (numThreads == 0) {
+        /* One core, or no threads to be had; do it all here.
+         */
+        for (reported = 0; reported < numJobs; reported++) {
+            if (!extractFile(pArchive, &jobs[reported], timestamp)) {
+                pool.failed = true;
+                break;
+            }
+            if (callback != NULL) callback(jobs[reported].path, cookie);
+        }
+    } else {
+        pthread_mutex_lock(&pool.lock);
+        while (reported < numJobs && !pool.failed) {
+            if (jobs[reported].state != MZ_JOB_DONE) {
+                pthread_cond_wait(&pool.jobDone, &pool.lock);
+                continue;
+            }
+            pthread_mutex_unlock(&pool.lock);
+            if (callback != NULL) callback(jobs[reported].path, cookie);
+            pthread_mutex_lock(&pool.lock);
+            reported++;
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    int t;
+    for (t = 0; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&pool.jobDone);
+    pthread_mutex_destroy(&pool.lock);
+    return !pool.failed;
+}
+
 /*
  * Inflate all entries under zipDir to the directory specified by
  * targetDir, which must exist and be a writable directory.
@@ -976,50 +2122,37 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
     helper.buf = NULL;
     helper.bufLen = 0;
 
-    /* Walk through the entries and extract anything whose path begins
-     * with zpath.
-//TODO: since the entries are sorted, binary search for the first match
-//      and stop after the first non-match.
-     */
-    unsigned int i;
-    bool seenMatch = false;
-    int ok = true;
-    for (i = 0; i < pArchive->numEntries; i++) {
-        ZipEntry *pEntry = pArchive->pEntries + i;
-        if (pEntry->fileNameLen < zipDirLen) {
+    /* Extract everything whose path begins with zpath.  If zpath is
+     * empty, that's every entry, which is what we want.
 //TODO: look out for a single empty directory entry that matches zpath, but
 //      missing the trailing slash.  Most zip files seem to include
 //      the trailing slash, but I think it's legal to leave it off.
 //      e.g., zpath "a/b/", entry "a/b", with no children of the entry.
-            /* No chance of matching.
-             */
-#if SORT_ENTRIES
-            if (seenMatch) {
-                /* Since the entries are sorted, we can give up
-                 * on the first mismatch after the first match.
-                 */
-                break;
-            }
-#endif
-            continue;
-        }
-        /* If zpath is empty, this strncmp() will match everything,
-         * which is what we want.
+     */
+    unsigned int i, first, end;
+    int ok = true;
+    MzExtractJob *jobs = NULL;
+    unsigned int numJobs = 0;
+    unsigned int jobsSize = 0;
+    MzDirNode *dirs = NULL;
+    end = mzFindZipEntryRange(pArchive, zpath, &first);
+    end += first;
+    for (i = first; i < end; i++) {
+        ZipEntry *pEntry = pArchive->pEntries + i;
+
+        /* An archive may name an entry more than once.  Those entries
+         * are next to each other, first in the central directory
+         * first; only that one is extracted, as it's the one
+         * mzFindZipEntry() finds.  The others would have two workers
+         * write the same file, or a file written through a symlink
+         * made just before it.
          */
-        if (strncmp(pEntry->fileName, zpath, zipDirLen) != 0) {
-#if SORT_ENTRIES
-            if (seenMatch) {
-                /* Since the entries are sorted, we can give up
-                 * on the first mismatch after the first match.
-                 */
-                break;
-            }
-#endif
+        if (i > first && entryHasName(pEntry - 1, pEntry->fileName,
+                pEntry->fileNameLen)) {
+            LOGW("Skipping duplicate entry \"%.*s\"\n",
+                    pEntry->fileNameLen, pEntry->fileName);
             continue;
         }
-        /* This entry begins with zipDir, so we'll extract it.
-         */
-        seenMatch = true;
 
         /* Find the target location of the entry.
          */
@@ -1040,12 +2173,10 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
 
         /* Create the file or directory.
          */
-#define UNZIP_DIRMODE 0755
-#define UNZIP_FILEMODE 0644
         if (pEntry->fileName[pEntry->fileNameLen-1] == '/') {
             if (!(flags & MZ_EXTRACT_FILES_ONLY)) {
-                int ret = dirCreateHierarchy(
-                        targetFile, UNZIP_DIRMODE, timestamp, false);
+                int ret = dirCacheMake(&dirs, helper.buf,
+                        helper.targetDirLen, strlen(targetFile));
                 if (ret != 0) {
                     LOGE("Can't create containing directory for \"%s\": %s\n",
                             targetFile, strerror(errno));
@@ -1058,8 +2189,8 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
             /* This is not a directory.  First, make sure that
              * the containing directory exists.
              */
-            int ret = dirCreateHierarchy(
-                    targetFile, UNZIP_DIRMODE, timestamp, true);
+            int ret = dirCacheMake(&dirs, helper.buf, helper.targetDirLen,
+                    strrchr(targetFile, '/') - targetFile);
             if (ret != 0) {
                 LOGE("Can't create containing directory for \"%s\": %s\n",
                         targetFile, strerror(errno));
@@ -1075,8 +2206,8 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
                  * The relative target of the symlink is in the
                  * data section of this entry.
                  */
-                if (pEntry->uncompLen == 0) {
-                    LOGE("Symlink entry \"%s\" has no target\n",
+                if (pEntry->uncompLen == 0 || pEntry->uncompLen >= PATH_MAX) {
+                    LOGE("Symlink entry \"%s\" has no usable target\n",
                             targetFile);
                     ok = false;
                     break;
@@ -1110,38 +2241,49 @@ bool mzExtractRecursive(const ZipArchive *pArchive,
                         targetFile, linkTarget);
                 free(linkTarget);
             } else {
-                /* The entry is a regular file.
-                 * Open the target for writing.
+                /* The entry is a regular file.  Its directory exists
+                 * now, so it can be inflated on another thread; the
+                 * callback is invoked once it has been.
                  */
-                int fd = creat(targetFile, UNZIP_FILEMODE);
-                if (fd < 0) {
-                    LOGE("Can't create target file \"%s\": %s\n",
-                            targetFile, strerror(errno));
-                    ok = false;
-                    break;
-                }
-
-                bool ok = mzExtractZipEntryToFile(pArchive, pEntry, fd);
-                close(fd);
-                if (!ok) {
-                    LOGE("Error extracting \"%s\"\n", targetFile);
-                    ok = false;
-                    break;
+                if (numJobs == jobsSize) {
+                    unsigned int newSize = jobsSize ? jobsSize * 2 : 64;
+                    MzExtractJob *newJobs = (MzExtractJob *)realloc(jobs,
+                            newSize * sizeof(MzExtractJob));
+                    if (newJobs == NULL) {
+                        ok = false;
+                        break;
+                    }
+                    jobs = newJobs;
+                    jobsSize = newSize;
                 }
-
-                if (timestamp != NULL && utime(targetFile, timestamp)) {
-                    LOGE("Error touching \"%s\"\n", targetFile);
+                jobs[numJobs].pEntry = pEntry;
+                jobs[numJobs].state = MZ_JOB_PENDING;
+                jobs[numJobs].path = strdup(targetFile);
+                if (jobs[numJobs].path == NULL) {
                     ok = false;
                     break;
                 }
-
-                LOGD("Extracted file \"%s\"\n", targetFile);
+                numJobs++;
+                continue;
             }
         }
 
         if (callback != NULL) callback(targetFile, cookie);
     }
 
+    if (ok && numJobs > 0) {
+        ok = extractFiles(pArchive, jobs, numJobs, timestamp,
+                callback, cookie);
+    }
+
+    for (i = 0; i < numJobs; i++) {
+        free(jobs[i].path);
+    }
+    free(jobs);
+    if (dirs != NULL) {
+        dirCacheFinish(dirs, helper.buf, helper.targetDirLen, helper.bufLen,
+                timestamp);
+    }
     free(helper.buf);
     free(zpath);
 
@@ -8,33 +8,34 @@
 
 #include "inline_magic.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <utime.h>
 
-#include "Hash.h"
 #include "SysUtil.h"
 
 /*
  * One entry in the Zip archive.  Treat this as opaque -- use accessors below.
  *
- * TODO: we're now keeping the pages mapped so we don't have to copy the
- * filename.  We can change the accessors to retrieve the various pieces
- * directly from the source file instead of copying them out, for a very
- * slight speed hit and a modest reduction in memory usage.
+ * The archive stays mapped, so only what the extraction paths need is
+ * kept here; the rest (mod time, CRC, mode) is read from the entry's
+ * central directory record, which fileName points into, when it's asked
+ * for.  This keeps the table small for archives with many entries.
+ *
+ * Offsets and sizes are 64 bits wide, for ZIP64 archives and entries.
  */
 typedef struct ZipEntry {
-    unsigned int fileNameLen;
     const char*  fileName;       // not null-terminated
-    long         offset;
-    long         compLen;
-    long         uncompLen;
-    int          compression;
-    long         modTime;
-    long         crc32;
-    int          versionMadeBy;
-    long         externalFileAttributes;
+    uint16_t     fileNameLen;    // kept next to fileName, so that the
+    uint16_t     compression;    // 64-bit fields need no padding on ARM
+    uint64_t     offset;
+    uint64_t     compLen;
+    uint64_t     uncompLen;
 } ZipEntry;
 
+typedef struct ZipNameSlot ZipNameSlot;
+
 /*
  * One Zip archive.  Treat as opaque.
  */
@@ -42,8 +43,11 @@ typedef struct ZipArchive {
     int         fd;
     unsigned int numEntries;
     ZipEntry*   pEntries;
-    HashTable*  pHash;          // maps file name to ZipEntry
-    MemMapping  map;
+    ZipNameSlot* pNameIndex;    // maps file name to ZipEntry
+    unsigned int nameIndexMask;
+    off64_t     fileLength;
+    MemMapping  map;            // the archive, or its central directory on
+    off64_t     mapOffset;      // if it's too big; where map starts
 } ZipArchive;
 
 /*
@@ -56,7 +60,8 @@ typedef struct {
 } UnterminatedString;
 
 /*
- * Open a Zip archive.
+ * Open a Zip archive.  ZIP64 archives (over 4GB, or with more than
+ * 65535 entries) are supported.
  *
  * On success, returns 0 and populates "pArchive".  Returns nonzero errno
  * value on failure.
@@ -78,6 +83,13 @@ void mzCloseZipArchive(ZipArchive* pArchive);
 const ZipEntry* mzFindZipEntry(const ZipArchive* pArchive,
         const char* entryName);
 
+/*
+ * Look up every entry by name, returning the average number of slots
+ * the name index looked at (and the most, in *pMaxProbe).  For testing
+ * the index's hash.
+ */
+double mzZipNameIndexProbeCount(const ZipArchive* pArchive, int* pMaxProbe);
+
 /*
  * Get the number of entries in the Zip archive.
  */
@@ -87,6 +99,7 @@ INLINE unsigned int mzZipEntryCount(const ZipArchive* pArchive) {
 
 /*
  * Get an entry by index.  Returns NULL if the index is out-of-bounds.
+ * Entries are sorted by name.
  */
 INLINE const ZipEntry*
 mzGetZipEntryAt(const ZipArchive* pArchive, unsigned int index)
@@ -97,6 +110,15 @@ mzGetZipEntryAt(const ZipArchive* pArchive, unsigned int index)
     return NULL;
 }
 
+/*
+ * Find the entries whose names begin with "prefix" ("" matches all of
+ * them), in O(log n).  Returns how many there are; they are the
+ * entries at *pFirst onwards.  To look under a directory, end "prefix"
+ * with a slash.
+ */
+unsigned int mzFindZipEntryRange(const ZipArchive* pArchive,
+        const char* prefix, unsigned int* pFirst);
+
 /*
  * Get the index number of an entry in the archive.
  */
@@ -114,18 +136,14 @@ INLINE UnterminatedString mzGetZipEntryFileName(const ZipEntry* pEntry) {
     ret.len = pEntry->fileNameLen;
     return ret;
 }
-INLINE long mzGetZipEntryOffset(const ZipEntry* pEntry) {
+INLINE off64_t mzGetZipEntryOffset(const ZipEntry* pEntry) {
     return pEntry->offset;
 }
-INLINE long mzGetZipEntryUncompLen(const ZipEntry* pEntry) {
+INLINE uint64_t mzGetZipEntryUncompLen(const ZipEntry* pEntry) {
     return pEntry->uncompLen;
 }
-INLINE long mzGetZipEntryModTime(const ZipEntry* pEntry) {
-    return pEntry->modTime;
-}
-INLINE long mzGetZipEntryCrc32(const ZipEntry* pEntry) {
-    return pEntry->crc32;
-}
+long mzGetZipEntryModTime(const ZipEntry* pEntry);
+long mzGetZipEntryCrc32(const ZipEntry* pEntry);
 bool mzIsZipEntrySymlink(const ZipEntry* pEntry);
 
 
@@ -145,11 +163,61 @@ typedef bool (*ProcessZipEntryContentsFunction)(const unsigned char *data,
  * mzProcessZipEntryContents() immediately returns false.
  *
  * This is useful for calculating the hash of an entry's uncompressed contents.
+ *
+ * Like everything that reads entries, this may be called on several
+ * threads at once for the same archive.
  */
 bool mzProcessZipEntryContents(const ZipArchive *pArchive,
     const ZipEntry *pEntry, ProcessZipEntryContentsFunction processFunction,
     void *cookie);
 
+/*
+ * Pull-style reading of one entry's uncompressed data, for callers that
+ * want to interleave it with other work.  Each stream keeps its own
+ * position in the archive, so several may be open on one archive at
+ * once and be read on different threads.
+ */
+typedef struct ZipEntryStream ZipEntryStream;
+
+/*
+ * Returns NULL if the entry's compression isn't supported or zlib
+ * can't be set up.
+ */
+ZipEntryStream* mzOpenZipEntryStream(const ZipArchive *pArchive,
+    const ZipEntry *pEntry);
+
+/*
+ * Read up to "len" uncompressed bytes into "buf".  Returns the number
+ * of bytes read, 0 at the end of the entry, or -1 if the entry is
+ * damaged.  Only the last read of an entry returns less than "len".
+ */
+long mzReadZipEntryStream(ZipEntryStream *pStream, unsigned char *buf,
+    long len);
+
+void mzCloseZipEntryStream(ZipEntryStream *pStream);
+
+/*
+ * Called by mzProcessZipStream() for each entry.  The entry's data can
+ * be read from "pStream" (which must not be closed), or left alone to
+ * skip it.  Return false to stop.
+ */
+typedef bool (*MzStreamEntryFunction)(const ZipEntry *pEntry,
+    ZipEntryStream *pStream, void *cookie);
+
+/*
+ * Read a Zip archive from "fd" in a single forward pass, going by the
+ * local headers, so that it can come from a pipe or a socket.  Every
+ * entry is checked against its CRC.  Entries are seen in archive order,
+ * and can't be looked up by name.  Symlinks look like files, since only
+ * the central directory knows about them.  Entries written with a data
+ * descriptor (as by zip tools writing to a pipe) have their sizes and
+ * CRC after the data, so for those they read as 0.
+ *
+ * Returns true if the whole archive was read.
+ */
+bool mzProcessZipStream(int fd, MzStreamEntryFunction entryFunction,
+    void *cookie);
+
 /*
  * Read an entry into a buffer allocated by the caller.
  */
@@ -163,7 +231,8 @@ bool mzReadZipEntry(const ZipArchive* pArchive, const ZipEntry* pEntry,
 bool mzIsZipEntryIntact(const ZipArchive *pArchive, const ZipEntry *pEntry);
 
 /*
- * Inflate and write an entry to a file.
+ * Inflate and write an entry to a file.  STORED entries are copied
+ * without passing through a user-space buffer.
  */
 bool mzExtractZipEntryToFile(const ZipArchive *pArchive,
     const ZipEntry *pEntry, int fd);
@@ -202,9 +271,15 @@ bool mzExtractZipEntryToBuffer(const ZipArchive *pArchive,
  *
  * If callback is non-NULL, it will be invoked with each unpacked file.
  *
+ * Directories and symlinks are created in archive order on the calling
+ * thread; regular files are then inflated by up to
+ * MZ_EXTRACT_MAX_THREADS threads (one per CPU).  The callback is always
+ * invoked on the calling thread.
+ *
  * Returns true on success, false on failure.
  */
 enum { MZ_EXTRACT_FILES_ONLY = 1, MZ_EXTRACT_DRY_RUN = 2 };
+#define MZ_EXTRACT_MAX_THREADS 4
 bool mzExtractRecursive(const ZipArchive *pArchive,
         const char *zipDir, const char *targetDir,
         int flags, const struct utimbuf *timestamp,
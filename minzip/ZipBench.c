@@ -0,0 +1,236 @@
+/*
+ * Measure how fast minzip unpacks real packages.
+ *
+ *     minzip_bench [-r runs] package.zip...
+ *
+ * Every entry is inflated to nowhere, to time the inflate path on its
+ * own, and then written to /dev/null, to time it with the writes that
+ * extraction does.  Throughput is counted in uncompressed bytes.
+ *
+ * Every name is also looked up, in the archive's name index and in the
+ * general HashTable that minzip used to index archives with, to compare
+ * the two.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "Hash.h"
+#include "Zip.h"
+
+#define LOOKUP_ROUNDS 20
+
+static double nowSeconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static bool discardProcessFunction(const unsigned char *data, int dataLen,
+    void *cookie)
+{
+    (void)data;
+    (void)dataLen;
+    (void)cookie;
+    return true;
+}
+
+static bool processAll(const ZipArchive *pArchive, int nullFd)
+{
+    unsigned int i;
+    unsigned int count = mzZipEntryCount(pArchive);
+    for (i = 0; i < count; i++) {
+        const ZipEntry *pEntry = mzGetZipEntryAt(pArchive, i);
+        bool ok;
+        if (nullFd < 0) {
+            ok = mzProcessZipEntryContents(pArchive, pEntry,
+                    discardProcessFunction, NULL);
+        } else {
+            ok = mzExtractZipEntryToFile(pArchive, pEntry, nullFd);
+        }
+        if (!ok) {
+            fprintf(stderr, "failed on %.*s\n", pEntry->fileNameLen,
+                    pEntry->fileName);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * How archives were indexed before they had their own name index.
+ */
+static unsigned int hashTableHash(const void *item)
+{
+    const ZipEntry *pEntry = (const ZipEntry *)item;
+    unsigned int hash = 2;
+    unsigned int i;
+    for (i = 0; i < pEntry->fileNameLen; i++)
+        hash = hash * 31 + pEntry->fileName[i];
+    return hash;
+}
+
+static int hashTableCompare(const void *tableItem, const void *looseItem)
+{
+    const ZipEntry *pEntry1 = (const ZipEntry *)tableItem;
+    const ZipEntry *pEntry2 = (const ZipEntry *)looseItem;
+    if (pEntry1->fileNameLen != pEntry2->fileNameLen)
+        return pEntry1->fileNameLen - pEntry2->fileNameLen;
+    return memcmp(pEntry1->fileName, pEntry2->fileName, pEntry1->fileNameLen);
+}
+
+static int hashTableCompareName(const void *tableItem, const void *looseItem)
+{
+    const ZipEntry *pEntry = (const ZipEntry *)tableItem;
+    const char *name = (const char *)looseItem;
+    unsigned int nameLen = strlen(name);
+    if (pEntry->fileNameLen != nameLen)
+        return pEntry->fileNameLen - nameLen;
+    return memcmp(pEntry->fileName, name, nameLen);
+}
+
+static unsigned int hashTableNameHash(const char *name)
+{
+    unsigned int hash = 2;
+    while (*name != '\0')
+        hash = hash * 31 + *name++;
+    return hash;
+}
+
+static void benchLookups(const ZipArchive *pArchive)
+{
+    unsigned int count = mzZipEntryCount(pArchive);
+    char **names = (char **)calloc(count, sizeof(char *));
+    HashTable *pHash = mzHashTableCreate(mzHashSize(count), NULL);
+    unsigned int i;
+    int round;
+    int missed = 0;
+    int maxProbe;
+    double avgProbe;
+    double start, indexTime, hashTime;
+
+    if (names == NULL || pHash == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free(names);
+        mzHashTableFree(pHash);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        const ZipEntry *pEntry = mzGetZipEntryAt(pArchive, i);
+        names[i] = strndup(pEntry->fileName, pEntry->fileNameLen);
+        mzHashTableLookup(pHash, hashTableHash(pEntry), (void *)pEntry,
+                hashTableCompare, true);
+    }
+
+    start = nowSeconds();
+    for (round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            if (mzFindZipEntry(pArchive, names[i]) == NULL)
+                missed++;
+        }
+    }
+    indexTime = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            if (mzHashTableLookup(pHash, hashTableNameHash(names[i]),
+                        names[i], hashTableCompareName, false) == NULL)
+                missed++;
+        }
+    }
+    hashTime = nowSeconds() - start;
+
+    avgProbe = mzZipNameIndexProbeCount(pArchive, &maxProbe);
+    printf("  lookup   %8.1f ns  (name index, avg %.3f probes, max %d)\n",
+           indexTime * 1e9 / ((double)count * LOOKUP_ROUNDS), avgProbe, maxProbe);
+    printf("  lookup   %8.1f ns  (HashTable)\n",
+           hashTime * 1e9 / ((double)count * LOOKUP_ROUNDS));
+    mzHashTableProbeCount(pHash, hashTableHash, hashTableCompare);
+    if (missed > 0)
+        printf("  %d lookups failed!\n", missed);
+
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    mzHashTableFree(pHash);
+}
+
+static void report(const char *what, long long bytes, double seconds)
+{
+    printf("  %-8s %8.1f MB/s  (%.3fs)\n", what,
+           seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0, seconds);
+}
+
+static int benchPackage(const char *path, int runs, int nullFd)
+{
+    ZipArchive archive;
+    long long compBytes = 0, uncompBytes = 0;
+    double inflateTime = 0, writeTime = 0;
+    unsigned int i;
+    int run;
+
+    if (mzOpenZipArchive(path, &archive) != 0) {
+        fprintf(stderr, "can't open %s\n", path);
+        return 1;
+    }
+    for (i = 0; i < mzZipEntryCount(&archive); i++) {
+        const ZipEntry *pEntry = mzGetZipEntryAt(&archive, i);
+        compBytes += pEntry->compLen;
+        uncompBytes += mzGetZipEntryUncompLen(pEntry);
+    }
+    printf("%s: %u entries, %lld bytes, %lld compressed\n", path,
+           mzZipEntryCount(&archive), uncompBytes, compBytes);
+
+    /* The first pass pulls the package into the page cache. */
+    if (!processAll(&archive, -1)) {
+        mzCloseZipArchive(&archive);
+        return 1;
+    }
+    for (run = 0; run < runs; run++) {
+        double start = nowSeconds();
+        processAll(&archive, -1);
+        inflateTime += nowSeconds() - start;
+
+        start = nowSeconds();
+        processAll(&archive, nullFd);
+        writeTime += nowSeconds() - start;
+    }
+
+    report("inflate", uncompBytes * runs, inflateTime);
+    report("extract", uncompBytes * runs, writeTime);
+    benchLookups(&archive);
+    mzCloseZipArchive(&archive);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 3;
+    int nullFd;
+    int ret = 0;
+    int i = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        runs = atoi(argv[2]);
+        i = 3;
+    }
+    if (i >= argc || runs <= 0) {
+        fprintf(stderr, "usage: %s [-r runs] package.zip...\n", argv[0]);
+        return 2;
+    }
+
+    nullFd = open("/dev/null", O_WRONLY);
+    if (nullFd < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+    for (; i < argc; i++)
+        ret |= benchPackage(argv[i], runs, nullFd);
+    close(nullFd);
+    return ret;
+}
@@ -0,0 +1,254 @@
+/*
+ * Check how minzip treats archives that name an entry more than once,
+ * when looking entries up and when extracting them.
+ *
+ *     minzip_test [scratch dir]
+ *
+ * The archives are written to the scratch directory (/tmp by default),
+ * with stored entries, and removed again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "Zip.h"
+
+typedef struct {
+    const char *name;
+    const char *data;       /* a symlink's target */
+    bool symlink;
+} TestEntry;
+
+static void put2(FILE *f, unsigned int v)
+{
+    fputc(v & 0xff, f);
+    fputc((v >> 8) & 0xff, f);
+}
+
+static void put4(FILE *f, unsigned long v)
+{
+    put2(f, v & 0xffff);
+    put2(f, (v >> 16) & 0xffff);
+}
+
+/*
+ * Write "count" stored entries, in order, to "path".
+ */
+static bool writeArchive(const char *path, const TestEntry *entries,
+    int count)
+{
+    FILE *f = fopen(path, "wb");
+    unsigned long offsets[16];
+    unsigned long cdOffset;
+    int i;
+
+    if (f == NULL || count > 16) {
+        if (f != NULL)
+            fclose(f);
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        size_t nameLen = strlen(entries[i].name);
+        size_t len = strlen(entries[i].data);
+        unsigned long crc = crc32(0, (const Bytef *)entries[i].data, len);
+
+        offsets[i] = ftell(f);
+        put4(f, 0x04034b50);
+        put2(f, 10);            /* version needed */
+        put2(f, 0);             /* flags */
+        put2(f, 0);             /* stored */
+        put4(f, 0);             /* time and date */
+        put4(f, crc);
+        put4(f, len);
+        put4(f, len);
+        put2(f, nameLen);
+        put2(f, 0);             /* extra */
+        fwrite(entries[i].name, 1, nameLen, f);
+        fwrite(entries[i].data, 1, len, f);
+    }
+    cdOffset = ftell(f);
+    for (i = 0; i < count; i++) {
+        size_t nameLen = strlen(entries[i].name);
+        size_t len = strlen(entries[i].data);
+        unsigned long crc = crc32(0, (const Bytef *)entries[i].data, len);
+
+        put4(f, 0x02014b50);
+        put2(f, 3 << 8 | 10);   /* made by Unix */
+        put2(f, 10);
+        put2(f, 0);
+        put2(f, 0);
+        put4(f, 0);
+        put4(f, crc);
+        put4(f, len);
+        put4(f, len);
+        put2(f, nameLen);
+        put2(f, 0);             /* extra */
+        put2(f, 0);             /* comment */
+        put2(f, 0);             /* disk */
+        put2(f, 0);             /* internal attributes */
+        put4(f, (entries[i].symlink ? 0120777UL : 0100644UL) << 16);
+        put4(f, offsets[i]);
+        fwrite(entries[i].name, 1, nameLen, f);
+    }
+    put4(f, 0x06054b50);
+    put2(f, 0);
+    put2(f, 0);
+    put2(f, count);
+    put2(f, count);
+    put4(f, ftell(f) - 12 - cdOffset);
+    put4(f, cdOffset);
+    put2(f, 0);                 /* comment */
+    return fclose(f) == 0;
+}
+
+/*
+ * Does "pEntry" hold "data"?
+ */
+static bool entryHolds(const ZipArchive *pArchive, const ZipEntry *pEntry,
+    const char *data)
+{
+    unsigned char buf[64];
+    size_t len = strlen(data);
+
+    if (pEntry == NULL || mzGetZipEntryUncompLen(pEntry) != len ||
+            len > sizeof(buf))
+        return false;
+    return mzExtractZipEntryToBuffer(pArchive, pEntry, buf) &&
+            memcmp(buf, data, len) == 0;
+}
+
+/*
+ * Whichever order qsort() leaves them in, a name that's in the archive
+ * twice finds the entry that comes first in the central directory.
+ */
+static int testDuplicateNames(const char *dir)
+{
+    static const TestEntry entries[] = {
+        { "b", "b" },
+        { "dup", "first" },
+        { "a", "a" },
+        { "dup", "second" },
+        { "c", "c" },
+        { "dup", "third" },
+    };
+    char path[256];
+    ZipArchive archive;
+    int failed = 0;
+
+    snprintf(path, sizeof(path), "%s/minzip_test_dup.zip", dir);
+    if (!writeArchive(path, entries, sizeof(entries) / sizeof(entries[0])) ||
+            mzOpenZipArchive(path, &archive) != 0) {
+        fprintf(stderr, "can't write and open %s\n", path);
+        unlink(path);
+        return 1;
+    }
+    if (!entryHolds(&archive, mzFindZipEntry(&archive, "dup"), "first")) {
+        fprintf(stderr, "duplicate names: didn't find the first \"dup\"\n");
+        failed = 1;
+    }
+    if (!entryHolds(&archive, mzFindZipEntry(&archive, "a"), "a") ||
+            !entryHolds(&archive, mzFindZipEntry(&archive, "c"), "c")) {
+        fprintf(stderr, "duplicate names: lost the other entries\n");
+        failed = 1;
+    }
+    mzCloseZipArchive(&archive);
+    unlink(path);
+    return failed;
+}
+
+/*
+ * Does the file at "path" hold "data"?
+ */
+static bool fileHolds(const char *path, const char *data)
+{
+    char buf[64];
+    FILE *f = fopen(path, "rb");
+    size_t len;
+
+    if (f == NULL)
+        return false;
+    len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return len == strlen(data) && memcmp(buf, data, len) == 0;
+}
+
+/*
+ * mzExtractRecursive() extracts only the first of the entries with a
+ * name, so no two threads write one file, and no file is written
+ * through a symlink that another entry of the same name made.
+ */
+static int testExtractDuplicates(const char *dir)
+{
+    static const TestEntry entries[] = {
+        { "f", "first" },
+        { "link", "../minzip_test_escaped", true },
+        { "f", "second" },
+        { "link", "written through the link" },
+        { "g", "a file" },
+        { "g", "f", true },
+    };
+    char target[256], escaped[256], path[512];
+    ZipArchive archive;
+    struct stat st;
+    int failed = 0;
+
+    snprintf(path, sizeof(path), "%s/minzip_test_extract.zip", dir);
+    snprintf(target, sizeof(target), "%s/minzip_test_out", dir);
+    snprintf(escaped, sizeof(escaped), "%s/minzip_test_escaped", dir);
+    if (!writeArchive(path, entries, sizeof(entries) / sizeof(entries[0])) ||
+            mzOpenZipArchive(path, &archive) != 0 ||
+            mkdir(target, 0755) != 0) {
+        fprintf(stderr, "can't write and open %s\n", path);
+        unlink(path);
+        return 1;
+    }
+    if (!mzExtractRecursive(&archive, "", target, 0, NULL, NULL, NULL)) {
+        fprintf(stderr, "duplicate extraction: failed\n");
+        failed = 1;
+    }
+    if (access(escaped, F_OK) == 0) {
+        fprintf(stderr, "duplicate extraction: wrote through a symlink\n");
+        failed = 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/f", target);
+    if (!fileHolds(path, "first")) {
+        fprintf(stderr, "duplicate extraction: didn't keep the first \"f\"\n");
+        failed = 1;
+    }
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/g", target);
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+            !fileHolds(path, "a file")) {
+        fprintf(stderr, "duplicate extraction: didn't keep the first \"g\"\n");
+        failed = 1;
+    }
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/link", target);
+    if (lstat(path, &st) != 0 || !S_ISLNK(st.st_mode)) {
+        fprintf(stderr, "duplicate extraction: didn't keep the symlink\n");
+        failed = 1;
+    }
+    unlink(path);
+    rmdir(target);
+    unlink(escaped);
+    mzCloseZipArchive(&archive);
+    snprintf(path, sizeof(path), "%s/minzip_test_extract.zip", dir);
+    unlink(path);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    int failed = 0;
+
+    failed |= testDuplicateNames(dir);
+    failed |= testExtractDuplicates(dir);
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
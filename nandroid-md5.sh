@@ -1,4 +0,0 @@
-#!/sbin/sh
-cd $1
-md5sum *img > nandroid.md5
-return $?
\ No newline at end of file
@@ -39,8 +39,16 @@
 
 #include <sys/vfs.h>
 
+#include "dirstats.h"
 #include "extendedcommands.h"
 #include "nandroid.h"
+#include "nandroid_blobs.h"
+#include "nandroid_diff.h"
+#include "nandroid_index.h"
+#include "nandroid_io.h"
+#include "nandroid_jobs.h"
+#include "nandroid_plan.h"
+#include "nandroid_verify.h"
 
 #ifndef BOARD_USES_BMLUTILS
 int write_raw_image(const char* partition, const char* filename) {
@@ -63,66 +71,205 @@ int yaffs_files_total = 0;
 int yaffs_files_count = 0;
 void yaffs_callback(char* filename)
 {
+    yaffs_files_count++;
+    if (nandroid_job_active()) {
+        // Several jobs may be running; the file names would just be noise.
+        if (yaffs_files_total != 0)
+            nandroid_job_set_progress((float)yaffs_files_count / (float)yaffs_files_total);
+        return;
+    }
     char* justfile = basename(filename);
     if (strlen(justfile) < 30)
         ui_print(justfile);
-    yaffs_files_count++;
     if (yaffs_files_total != 0)
         ui_set_progress((float)yaffs_files_count / (float)yaffs_files_total);
     ui_reset_text_col();
 }
 
-void compute_directory_stats(char* directory)
+// The tree was walked for the estimate when the job was added; the
+// child has its own copy of the job, so it needn't walk it again.
+static void start_file_progress(const NandroidJob* job)
 {
-    char tmp[PATH_MAX];
-    sprintf(tmp, "find %s | wc -l > /tmp/dircount", directory);
-    __system(tmp);
-    char count_text[100];
-    FILE* f = fopen("/tmp/dircount", "r");
-    fread(count_text, 1, sizeof(count_text), f);
-    fclose(f);
     yaffs_files_count = 0;
-    yaffs_files_total = atoi(count_text);
-    ui_reset_progress();
-    ui_show_progress(1, 0);
+    yaffs_files_total = dir_stats_objects(&job->stats);
 }
 
-int nandroid_backup_partition_extended(const char* backup_path, char* root, int umount_when_finished) {
-    int ret = 0;
+// Runs in the job's child process.
+static int backup_partition_job(NandroidJob* job)
+{
     char mount_point[PATH_MAX];
-    translate_root_path(root, mount_point, PATH_MAX);
-    char* name = basename(mount_point);
+    translate_root_path(job->root, mount_point, PATH_MAX);
 
-    struct stat file_info;
     mkyaffs2image_callback callback = NULL;
+    struct stat file_info;
     if (0 != stat("/sdcard/clockworkmod/.hidenandroidprogress", &file_info)) {
         callback = yaffs_callback;
     }
-    
-    ui_print("Backing up %s...\n", name);
-    if (0 != (ret = ensure_root_path_mounted(root) != 0)) {
-        ui_print("Can't mount %s!\n", mount_point);
+
+    nandroid_job_print("Backing up %s...\n", job->name);
+    start_file_progress(job);
+
+    char index[PATH_MAX];
+    sprintf(index, "%s.idx", job->image);
+    NandroidWriter writer;
+    if (0 != nandroid_writer_open(&writer, job->image, job->compression, index))
+        return -1;
+    int ret = mkyaffs2image(mount_point, writer.path, 0, callback);
+    if (0 != nandroid_writer_close(&writer) && 0 == ret)
+        ret = -1;
+    if (0 != ret) {
+        nandroid_job_print("Error while making a yaffs2 image of %s!\n", mount_point);
         return ret;
     }
-    compute_directory_stats(mount_point);
-    char tmp[PATH_MAX];
-    sprintf(tmp, "%s/%s.img", backup_path, name);
-    ret = mkyaffs2image(mount_point, tmp, 0, callback);
-    if (umount_when_finished) {
-        ensure_root_path_unmounted(root);
+    nandroid_job_set_md5(writer.md5_hex);
+    return 0;
+}
+
+// Runs in the job's child process.
+static int backup_blobs_job(NandroidJob* job)
+{
+    char mount_point[PATH_MAX];
+    translate_root_path(job->root, mount_point, PATH_MAX);
+
+    nandroid_blobs_callback callback = NULL;
+    struct stat file_info;
+    if (0 != stat("/sdcard/clockworkmod/.hidenandroidprogress", &file_info)) {
+        callback = yaffs_callback;
     }
+
+    nandroid_job_print("Backing up %s...\n", job->name);
+    start_file_progress(job);
+
+    NandroidWriter writer;
+    if (0 != nandroid_writer_open(&writer, job->image, job->compression, NULL))
+        return -1;
+    int ret = nandroid_blobs_backup(mount_point, writer.path, job->name, job->image, callback);
+    if (0 != nandroid_writer_close(&writer) && 0 == ret)
+        ret = -1;
     if (0 != ret) {
-        ui_print("Error while making a yaffs2 image of %s!\n", mount_point);
+        nandroid_job_print("Error while backing up %s!\n", mount_point);
         return ret;
     }
+    nandroid_blobs_record_last(job->name, job->image);
+    nandroid_job_set_md5(writer.md5_hex);
     return 0;
 }
 
-int nandroid_backup_partition(const char* backup_path, char* root) {
-    return nandroid_backup_partition_extended(backup_path, root, 1);
+// Runs in the job's child process.
+static int backup_raw_job(NandroidJob* job)
+{
+    nandroid_job_print("Backing up %s...\n", job->name);
+
+    NandroidWriter writer;
+    if (0 != nandroid_writer_open(&writer, job->image, job->compression, NULL))
+        return -1;
+    int ret = read_raw_image(job->root, writer.path);
+    if (0 != nandroid_writer_close(&writer) && 0 == ret)
+        ret = -1;
+    if (0 != ret) {
+        nandroid_job_print("Error while dumping %s image!\n", job->name);
+        return ret;
+    }
+    nandroid_job_set_md5(writer.md5_hex);
+    return 0;
 }
 
-int nandroid_backup(const char* backup_path)
+static void add_raw_job(NandroidJob* jobs, int* count, const char* backup_path, const char* partition, int compression)
+{
+    NandroidJob* job = &jobs[(*count)++];
+    memset(job, 0, sizeof(*job));
+    job->name = partition;
+    job->root = partition;
+    job->run = backup_raw_job;
+    job->compression = compression;
+    job->estimate = nandroid_estimate_raw(partition);
+    sprintf(job->image, "%s/%s.img", backup_path, partition);
+}
+
+static int add_partition_job(NandroidJob* jobs, int* count, const char* backup_path, const char* root, int umount_when_finished, int incremental, int compression)
+{
+    char mount_point[PATH_MAX];
+    translate_root_path(root, mount_point, PATH_MAX);
+    char* name = basename(mount_point);
+
+    // Mount everything up front; the children share our mount table.
+    if (0 != ensure_root_path_mounted(root)) {
+        ui_print("Can't mount %s!\n", mount_point);
+        return -1;
+    }
+
+    NandroidJob* job = &jobs[(*count)++];
+    memset(job, 0, sizeof(*job));
+    job->name = strdup(name);
+    job->root = root;
+    job->run = incremental ? backup_blobs_job : backup_partition_job;
+    job->umount_when_finished = umount_when_finished;
+    job->compression = compression;
+    job->incremental = incremental;
+    sprintf(job->image, "%s/%s.%s", backup_path, name, incremental ? "manifest" : "img");
+
+    dir_stats_compute(mount_point, &job->stats);
+    if (incremental)
+        job->estimate = nandroid_estimate_incremental(&job->stats, name);
+    else
+        job->estimate = nandroid_estimate_yaffs2(&job->stats);
+    return 0;
+}
+
+static int compare_job_images(const void* a, const void* b)
+{
+    const NandroidJob* job_a = (const NandroidJob*)a;
+    const NandroidJob* job_b = (const NandroidJob*)b;
+    return strcmp(basename(job_a->image), basename(job_b->image));
+}
+
+// Writes the md5 sums the jobs computed in the same format (and order)
+// as "md5sum *img", so "md5sum -c" can check them at restore time.
+static int write_md5_file(const char* backup_path, NandroidJob* jobs, int count)
+{
+    NandroidJob* sorted = malloc(count * sizeof(NandroidJob));
+    if (sorted == NULL)
+        return -1;
+    memcpy(sorted, jobs, count * sizeof(NandroidJob));
+    qsort(sorted, count, sizeof(NandroidJob), compare_job_images);
+
+    char tmp[PATH_MAX];
+    sprintf(tmp, "%s/nandroid.md5", backup_path);
+    FILE* f = fopen(tmp, "w");
+    if (f == NULL) {
+        free(sorted);
+        return -1;
+    }
+    int ret = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        if (strlen(sorted[i].md5) != 2 * MD5_DIGEST_SIZE) {
+            ret = -1;
+            break;
+        }
+        fprintf(f, "%s  %s\n", sorted[i].md5, basename(sorted[i].image));
+    }
+    if (fclose(f) != 0)
+        ret = -1;
+    free(sorted);
+    return ret;
+}
+
+static void free_jobs(NandroidJob* jobs, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (jobs[i].run != backup_raw_job) {
+            if (jobs[i].umount_when_finished)
+                ensure_root_path_unmounted(jobs[i].root);
+            free((char*)jobs[i].name);
+        }
+    }
+}
+
+#define NANDROID_MAX_BACKUP_JOBS 8
+
+static int nandroid_backup_extended(const char* backup_path, int incremental)
 {
     ui_set_background(BACKGROUND_ICON_INSTALLING);
     
@@ -138,36 +285,27 @@ int nandroid_backup(const char* backup_path)
     uint64_t sdcard_free = bavail * bsize;
     uint64_t sdcard_free_mb = sdcard_free / (uint64_t)(1024 * 1024);
     ui_print("SD Card space free: %lluMB\n", sdcard_free_mb);
-    if (sdcard_free_mb < 150)
-        ui_print("There may not be enough free space to complete backup... continuing...\n");
-    
-    char tmp[PATH_MAX];
-    sprintf(tmp, "mkdir -p %s", backup_path);
-    __system(tmp);
 
-#ifndef BOARD_RECOVERY_IGNORE_BOOTABLES
-    ui_print("Backing up boot...\n");
-    sprintf(tmp, "%s/%s", backup_path, "boot.img");
-    ret = read_raw_image("boot", tmp);
-    if (0 != ret)
-        return print_and_error("Error while dumping boot image!\n");
+    NandroidJob jobs[NANDROID_MAX_BACKUP_JOBS];
+    int count = 0;
+    int compression = nandroid_get_compression();
+    if (compression != NANDROID_COMPRESSION_NONE)
+        ui_print("Compressing images with %s.\n", nandroid_compression_name(compression));
 
-    ui_print("Backing up recovery...\n");
-    sprintf(tmp, "%s/%s", backup_path, "recovery.img");
-    ret = read_raw_image("recovery", tmp);
-    if (0 != ret)
-        return print_and_error("Error while dumping recovery image!\n");
+#ifndef BOARD_RECOVERY_IGNORE_BOOTABLES
+    add_raw_job(jobs, &count, backup_path, "boot", compression);
+    add_raw_job(jobs, &count, backup_path, "recovery", compression);
 #endif
 
-    if (0 != (ret = nandroid_backup_partition(backup_path, "SYSTEM:")))
-        return ret;
+    if (0 != add_partition_job(jobs, &count, backup_path, "SYSTEM:", 1, incremental, compression))
+        goto done;
 
-    if (0 != (ret = nandroid_backup_partition(backup_path, "DATA:")))
-        return ret;
+    if (0 != add_partition_job(jobs, &count, backup_path, "DATA:", 1, incremental, compression))
+        goto done;
 
 #ifdef HAS_DATADATA
-    if (0 != (ret = nandroid_backup_partition(backup_path, "DATADATA:")))
-        return ret;
+    if (0 != add_partition_job(jobs, &count, backup_path, "DATADATA:", 1, incremental, compression))
+        goto done;
 #endif
 
     struct stat st;
@@ -177,12 +315,12 @@ int nandroid_backup(const char* backup_path)
     }
     else
     {
-        if (0 != (ret = nandroid_backup_partition_extended(backup_path, "SDCARD:/.android_secure", 0)))
-            return ret;
+        if (0 != add_partition_job(jobs, &count, backup_path, "SDCARD:/.android_secure", 0, incremental, compression))
+            goto done;
     }
 
-    if (0 != (ret = nandroid_backup_partition_extended(backup_path, "CACHE:", 0)))
-        return ret;
+    if (0 != add_partition_job(jobs, &count, backup_path, "CACHE:", 0, incremental, compression))
+        goto done;
 
     if (0 != stat(SDEXT_DEVICE, &st))
     {
@@ -192,22 +330,55 @@ int nandroid_backup(const char* backup_path)
     {
         if (0 != ensure_root_path_mounted("SDEXT:"))
             ui_print("Could not mount sd-ext. sd-ext backup may not be supported on this device. Skipping backup of sd-ext.\n");
-        else if (0 != (ret = nandroid_backup_partition(backup_path, "SDEXT:")))
-            return ret;
+        else if (0 != add_partition_job(jobs, &count, backup_path, "SDEXT:", 1, incremental, compression))
+            goto done;
     }
 
-    ui_print("Generating md5 sum...\n");
-    sprintf(tmp, "nandroid-md5.sh %s", backup_path);
-    if (0 != (ret = __system(tmp))) {
+    NandroidStats stats;
+    nandroid_stats_load(&stats);
+    if (0 != (ret = nandroid_plan_backup(jobs, count, &stats, sdcard_free)))
+        goto done;
+
+    char tmp[PATH_MAX];
+    sprintf(tmp, "mkdir -p %s", backup_path);
+    __system(tmp);
+
+    int max_jobs = nandroid_get_max_jobs();
+    if (max_jobs > 1)
+        ui_print("Running up to %d backups at once.\n", max_jobs);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    ret = nandroid_run_jobs(jobs, count, max_jobs);
+    if (0 != ret)
+        goto done;
+    gettimeofday(&end, NULL);
+    nandroid_plan_record(&stats, jobs, count, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+
+    if (0 != (ret = write_md5_file(backup_path, jobs, count))) {
         ui_print("Error while generating md5 sum!\n");
-        return ret;
+        goto done;
     }
+    free_jobs(jobs, count);
     
     sync();
     ui_set_background(BACKGROUND_ICON_NONE);
     ui_reset_progress();
     ui_print("\nBackup complete!\n");
     return 0;
+
+done:
+    free_jobs(jobs, count);
+    return print_and_error("Error while backing up!\n");
+}
+
+int nandroid_backup(const char* backup_path)
+{
+    return nandroid_backup_extended(backup_path, 0);
+}
+
+int nandroid_backup_incremental(const char* backup_path)
+{
+    return nandroid_backup_extended(backup_path, 1);
 }
 
 typedef int (*format_function)(char* root);
@@ -218,6 +389,43 @@ static void ensure_directory(const char* dir) {
     __system(tmp);
 }
 
+// Checks images in the background while nandroid_restore() runs.
+static NandroidVerifier* restore_verifier = NULL;
+
+static int wait_for_md5(const char* image)
+{
+    if (restore_verifier == NULL)
+        return 0;
+    if (0 != nandroid_verify_wait(restore_verifier, basename(image))) {
+        ui_print("MD5 mismatch!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Set while nandroid_restore_differential() runs.
+static int restore_differential = 0;
+
+// Restores a partition without formatting it, by only writing what
+// differs from the backup.  Returns 1 if the backup has no list of its
+// files to compare against, so the partition must be restored in full.
+static int restore_partition_differential(const char* backup, int incremental, const char* root,
+                                          const char* mount_point, unyaffs_callback callback)
+{
+    char index[PATH_MAX];
+    struct stat file_info;
+    if (!incremental) {
+        sprintf(index, "%s.idx", backup);
+        if (0 != stat(index, &file_info))
+            return 1;
+    }
+    if (0 != ensure_root_path_mounted(root)) {
+        ui_print("Can't mount %s!\n", mount_point);
+        return -1;
+    }
+    return nandroid_diff_restore(backup, incremental ? NULL : index, mount_point, callback);
+}
+
 int nandroid_restore_partition_extended(const char* backup_path, const char* root, int umount_when_finished) {
     int ret = 0;
     char mount_point[PATH_MAX];
@@ -225,13 +433,19 @@ int nandroid_restore_partition_extended(const char* backup_path, const char* roo
     char* name = basename(mount_point);
     
     char tmp[PATH_MAX];
-    sprintf(tmp, "%s/%s.img", backup_path, name);
     struct stat file_info;
+    sprintf(tmp, "%s/%s.manifest", backup_path, name);
+    int incremental = (0 == stat(tmp, &file_info));
+    if (!incremental)
+        sprintf(tmp, "%s/%s.img", backup_path, name);
     if (0 != (ret = statfs(tmp, &file_info))) {
         ui_print("%s.img not found. Skipping restore of %s.\n", name, mount_point);
         return 0;
     }
 
+    if (0 != (ret = wait_for_md5(tmp)))
+        return ret;
+
     ensure_directory(mount_point);
 
     unyaffs_callback callback = NULL;
@@ -240,6 +454,16 @@ int nandroid_restore_partition_extended(const char* backup_path, const char* roo
     }
 
     ui_print("Restoring %s...\n", name);
+    if (restore_differential) {
+        ret = restore_partition_differential(tmp, incremental, root, mount_point, callback);
+        if (ret == 0 && umount_when_finished)
+            ensure_root_path_unmounted(root);
+        if (ret < 0)
+            ui_print("Error while restoring %s!\n", mount_point);
+        if (ret <= 0)
+            return ret;
+        ui_print("%s has no index; restoring all of it.\n", name);
+    }
     /*
     if (0 != (ret = ensure_root_path_unmounted(root))) {
         ui_print("Can't unmount %s!\n", mount_point);
@@ -256,7 +480,16 @@ int nandroid_restore_partition_extended(const char* backup_path, const char* roo
         return ret;
     }
     
-    if (0 != (ret = unyaffs(tmp, mount_point, callback))) {
+    NandroidReader reader;
+    if (0 != (ret = nandroid_reader_open(&reader, tmp)))
+        return ret;
+    if (incremental)
+        ret = nandroid_blobs_restore(reader.path, mount_point, NULL, 0, callback);
+    else
+        ret = unyaffs(reader.path, mount_point, callback);
+    if (0 != nandroid_reader_close(&reader) && 0 == ret)
+        ret = -1;
+    if (0 != ret) {
         ui_print("Error while restoring %s!\n", mount_point);
         return ret;
     }
@@ -272,32 +505,67 @@ int nandroid_restore_partition(const char* backup_path, const char* root) {
     return nandroid_restore_partition_extended(backup_path, root, 1);
 }
 
-int nandroid_restore(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext)
+// flash_image seeks around in the image, so it can't be handed a pipe.
+// Compressed raw images are uncompressed to /tmp first; boot images are
+// small.  "image" gets the name of the file to flash.
+static int uncompress_raw_image(const char* backup_image, char* image)
 {
-    ui_set_background(BACKGROUND_ICON_INSTALLING);
-    ui_show_indeterminate_progress();
-    yaffs_files_total = 0;
+    NandroidReader reader;
+    if (0 != nandroid_reader_open(&reader, backup_image))
+        return -1;
+    if (reader.compression == NANDROID_COMPRESSION_NONE) {
+        strcpy(image, backup_image);
+        return 0;
+    }
 
-    if (ensure_root_path_mounted("SDCARD:") != 0)
-        return print_and_error("Can't mount /sdcard\n");
-    
-    char tmp[PATH_MAX];
+    sprintf(image, "/tmp/nandroid-%s", basename(backup_image));
+    int ret = 0;
+    FILE* in = fopen(reader.path, "rb");
+    FILE* out = fopen(image, "wb");
+    if (in == NULL || out == NULL) {
+        ret = -1;
+    } else {
+        char buf[4096];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+            if (fwrite(buf, 1, len, out) != len) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+    if (in != NULL)
+        fclose(in);
+    if (out != NULL && fclose(out) != 0)
+        ret = -1;
+    if (0 != nandroid_reader_close(&reader))
+        ret = -1;
+    if (0 != ret)
+        unlink(image);
+    return ret;
+}
 
-    ui_print("Checking MD5 sums...\n");
-    sprintf(tmp, "cd %s && md5sum -c nandroid.md5", backup_path);
-    if (0 != __system(tmp))
-        return print_and_error("MD5 mismatch!\n");
-    
+static int restore_images(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext)
+{
+    char tmp[PATH_MAX];
     int ret;
 #ifndef BOARD_RECOVERY_IGNORE_BOOTABLES
     if (restore_boot)
     {
+        sprintf(tmp, "%s/boot.img", backup_path);
+        if (0 != (ret = wait_for_md5(tmp)))
+            return ret;
         ui_print("Erasing boot before restore...\n");
         if (0 != (ret = format_root_device("BOOT:")))
             return print_and_error("Error while formatting BOOT:!\n");
-        sprintf(tmp, "%s/boot.img", backup_path);
         ui_print("Restoring boot image...\n");
-        if (0 != (ret = write_raw_image("boot", tmp))) {
+        char image[PATH_MAX];
+        if (0 != (ret = uncompress_raw_image(tmp, image)))
+            return print_and_error("Error while uncompressing boot image!\n");
+        ret = write_raw_image("boot", image);
+        if (0 != strcmp(image, tmp))
+            unlink(image);
+        if (0 != ret) {
             ui_print("Error while flashing boot image!");
             return ret;
         }
@@ -324,6 +592,68 @@ int nandroid_restore(const char* backup_path, int restore_boot, int restore_syst
     if (restore_sdext && 0 != (ret = nandroid_restore_partition(backup_path, "SDEXT:")))
         return ret;
 
+    return 0;
+}
+
+// Adds the names a partition's image may have to "images".
+static void add_restore_images(const char** images, int* count, char names[][64], const char* root)
+{
+    char mount_point[PATH_MAX];
+    translate_root_path(root, mount_point, PATH_MAX);
+    char* name = basename(mount_point);
+    snprintf(names[*count], 64, "%s.img", name);
+    images[*count] = names[*count];
+    (*count)++;
+    snprintf(names[*count], 64, "%s.manifest", name);
+    images[*count] = names[*count];
+    (*count)++;
+}
+
+#define NANDROID_MAX_RESTORE_IMAGES 16
+
+int nandroid_restore(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext)
+{
+    ui_set_background(BACKGROUND_ICON_INSTALLING);
+    ui_show_indeterminate_progress();
+    yaffs_files_total = 0;
+
+    if (ensure_root_path_mounted("SDCARD:") != 0)
+        return print_and_error("Can't mount /sdcard\n");
+
+    // Same order as restore_images().
+    const char* images[NANDROID_MAX_RESTORE_IMAGES + 1];
+    char names[NANDROID_MAX_RESTORE_IMAGES][64];
+    int count = 0;
+#ifndef BOARD_RECOVERY_IGNORE_BOOTABLES
+    if (restore_boot)
+        images[count++] = "boot.img";
+#endif
+    if (restore_system)
+        add_restore_images(images, &count, names, "SYSTEM:");
+    if (restore_data) {
+        add_restore_images(images, &count, names, "DATA:");
+#ifdef HAS_DATADATA
+        add_restore_images(images, &count, names, "DATADATA:");
+#endif
+        add_restore_images(images, &count, names, "SDCARD:/.android_secure");
+    }
+    if (restore_cache)
+        add_restore_images(images, &count, names, "CACHE:");
+    if (restore_sdext)
+        add_restore_images(images, &count, names, "SDEXT:");
+    images[count] = NULL;
+
+    ui_print("Checking MD5 sums...\n");
+    NandroidVerifier verifier;
+    if (0 != nandroid_verify_start(&verifier, backup_path, images))
+        return print_and_error("Can't read nandroid.md5!\n");
+    restore_verifier = &verifier;
+    int ret = restore_images(backup_path, restore_boot, restore_system, restore_data, restore_cache, restore_sdext);
+    restore_verifier = NULL;
+    nandroid_verify_finish(&verifier);
+    if (0 != ret)
+        return ret;
+
     sync();
     ui_set_background(BACKGROUND_ICON_NONE);
     ui_reset_progress();
@@ -331,6 +661,56 @@ int nandroid_restore(const char* backup_path, int restore_boot, int restore_syst
     return 0;
 }
 
+int nandroid_restore_differential(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext)
+{
+    restore_differential = 1;
+    int ret = nandroid_restore(backup_path, restore_boot, restore_system, restore_data, restore_cache, restore_sdext);
+    restore_differential = 0;
+    return ret;
+}
+
+int nandroid_restore_files(const char* backup_path, const char* root, const char** paths, int count)
+{
+    char mount_point[PATH_MAX];
+    translate_root_path(root, mount_point, PATH_MAX);
+    char* name = basename(mount_point);
+
+    if (ensure_root_path_mounted("SDCARD:") != 0)
+        return print_and_error("Can't mount /sdcard\n");
+
+    char image[PATH_MAX];
+    char index[PATH_MAX];
+    struct stat file_info;
+    sprintf(image, "%s/%s.img", backup_path, name);
+    sprintf(index, "%s.idx", image);
+    if (0 != stat(image, &file_info)) {
+        ui_print("%s.img not found!\n", name);
+        return -1;
+    }
+    if (0 != ensure_root_path_mounted(root)) {
+        ui_print("Can't mount %s!\n", mount_point);
+        return -1;
+    }
+
+    unyaffs_callback callback = NULL;
+    if (0 != stat("/sdcard/clockworkmod/.hidenandroidprogress", &file_info)) {
+        callback = yaffs_callback;
+    }
+
+    ui_set_background(BACKGROUND_ICON_INSTALLING);
+    ui_show_indeterminate_progress();
+    yaffs_files_total = 0;
+    ui_print("Restoring files to %s...\n", mount_point);
+    int ret = nandroid_index_restore(image, index, mount_point, paths, count, callback);
+    sync();
+    ui_set_background(BACKGROUND_ICON_NONE);
+    ui_reset_progress();
+    if (0 != ret)
+        return print_and_error("Error while restoring files!\n");
+    ui_print("\nRestore complete!\n");
+    return 0;
+}
+
 void nandroid_generate_timestamp_path(char* backup_path)
 {
     time_t t = time(NULL);
@@ -349,28 +729,36 @@ void nandroid_generate_timestamp_path(char* backup_path)
 
 int nandroid_usage()
 {
-    printf("Usage: nandroid backup\n");
-    printf("Usage: nandroid restore <directory>\n");
+    printf("Usage: nandroid backup [--incremental]\n");
+    printf("Usage: nandroid restore [--differential] <directory>\n");
+    printf("Usage: nandroid restore-files <directory> <root> <path>...\n");
     return 1;
 }
 
 int nandroid_main(int argc, char** argv)
 {
-    if (argc > 3 || argc < 2)
+    if (argc >= 5 && strcmp("restore-files", argv[1]) == 0)
+        return nandroid_restore_files(argv[2], argv[3], (const char**)argv + 4, argc - 4);
+
+    if (argc > 4 || argc < 2)
         return nandroid_usage();
     
     if (strcmp("backup", argv[1]) == 0)
     {
-        if (argc != 2)
+        if (argc == 4 || (argc == 3 && strcmp("--incremental", argv[2]) != 0))
             return nandroid_usage();
         
         char backup_path[PATH_MAX];
         nandroid_generate_timestamp_path(backup_path);
+        if (argc == 3)
+            return nandroid_backup_incremental(backup_path);
         return nandroid_backup(backup_path);
     }
 
     if (strcmp("restore", argv[1]) == 0)
     {
+        if (argc == 4 && strcmp("--differential", argv[2]) == 0)
+            return nandroid_restore_differential(argv[3], 1, 1, 1, 1, 1);
         if (argc != 3)
             return nandroid_usage();
         return nandroid_restore(argv[2], 1, 1, 1, 1, 1);
@@ -3,7 +3,10 @@
 
 int nandroid_main(int argc, char** argv);
 int nandroid_backup(const char* backup_path);
+int nandroid_backup_incremental(const char* backup_path);
 int nandroid_restore(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext);
+int nandroid_restore_differential(const char* backup_path, int restore_boot, int restore_system, int restore_data, int restore_cache, int restore_sdext);
+int nandroid_restore_files(const char* backup_path, const char* root, const char** paths, int count);
 void nandroid_generate_timestamp_path(char* backup_path);
 
 #endif
\ No newline at end of file
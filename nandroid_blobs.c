@@ -0,0 +1,733 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "mincrypt/sha.h"
+#include "minzip/Hash.h"
+#include "nandroid_blobs.h"
+#include "nandroid_io.h"
+#include "nandroid_jobs.h"
+
+#define SHA_HEX_SIZE (2 * SHA_DIGEST_SIZE)
+
+// One regular file from the previous manifest of a partition.
+typedef struct {
+    char* path;
+    unsigned long long size;
+    long mtime;
+    unsigned long ino;
+    char* hashes;
+} CachedFile;
+
+typedef struct {
+    FILE* manifest;
+    HashTable* previous;
+    unsigned char* buf;
+    nandroid_blobs_callback callback;
+    int root_len;
+    int files_read;
+    int files_unchanged;
+    int chunks_written;
+} BackupState;
+
+typedef struct {
+    char* path;
+    long mtime;
+} DeferredTime;
+
+static unsigned int hash_path(const char* path)
+{
+    unsigned int hash = 2;
+    while (*path)
+        hash = hash * 31 + *path++;
+    return hash;
+}
+
+static int compare_cached_files(const void* a, const void* b)
+{
+    return strcmp(((const CachedFile*)a)->path, ((const CachedFile*)b)->path);
+}
+
+static void free_cached_file(void* ptr)
+{
+    CachedFile* cached = (CachedFile*)ptr;
+    free(cached->path);
+    free(cached->hashes);
+    free(cached);
+}
+
+// Manifest paths are escaped so that every field is a single word.
+void nandroid_write_escaped(FILE* f, const char* s)
+{
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c <= ' ' || c == '%' || c >= 0x7f)
+            fprintf(f, "%%%02x", c);
+        else
+            fputc(c, f);
+    }
+}
+
+void nandroid_unescape(char* s)
+{
+    char* out = s;
+    while (*s) {
+        unsigned int c;
+        if (s[0] == '%' && s[1] && s[2] && sscanf(s + 1, "%2x", &c) == 1) {
+            *out++ = (char)c;
+            s += 3;
+        } else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+}
+
+char* nandroid_read_line(FILE* f, char** buf, size_t* len)
+{
+    size_t used = 0;
+    for (;;) {
+        if (*len - used < 2) {
+            size_t new_len = *len ? *len * 2 : 1024;
+            char* new_buf = realloc(*buf, new_len);
+            if (new_buf == NULL)
+                return NULL;
+            *buf = new_buf;
+            *len = new_len;
+        }
+        if (fgets(*buf + used, *len - used, f) == NULL)
+            return used ? *buf : NULL;
+        used += strlen(*buf + used);
+        if (used > 0 && (*buf)[used - 1] == '\n') {
+            (*buf)[used - 1] = '\0';
+            return *buf;
+        }
+    }
+}
+
+int nandroid_split_fields(char* line, char** fields, int count)
+{
+    int i;
+    for (i = 0; i < count - 1; i++) {
+        fields[i] = line;
+        line = strchr(line, ' ');
+        if (line == NULL)
+            return -1;
+        *line++ = '\0';
+    }
+    fields[count - 1] = line;
+    return 0;
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+const char** nandroid_sort_paths(const char** paths, int count)
+{
+    const char** sorted = malloc((count + 1) * sizeof(char*));
+    if (sorted == NULL)
+        return NULL;
+    memcpy(sorted, paths, count * sizeof(char*));
+    qsort(sorted, count, sizeof(char*), compare_paths);
+    sorted[count] = NULL;
+    return sorted;
+}
+
+int nandroid_path_selected(const char** sorted, int count, const char* path)
+{
+    char buf[PATH_MAX];
+    const char* key = buf;
+    if (count > 0 && sorted[0][0] == '\0')
+        return 1;
+    if (strlcpy(buf, path, sizeof(buf)) >= sizeof(buf))
+        return 0;
+    for (;;) {
+        if (bsearch(&key, sorted, count, sizeof(char*), compare_paths) != NULL)
+            return 1;
+        char* slash = strrchr(buf, '/');
+        if (slash == NULL)
+            return 0;
+        *slash = '\0';
+    }
+}
+
+static void blob_path(const char* hex, char* path)
+{
+    sprintf(path, "%s/%.2s/%s", NANDROID_BLOBS_DIR, hex, hex + 2);
+}
+
+static void sha_hex(const unsigned char* data, int len, char* hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    SHA_CTX ctx;
+    SHA_init(&ctx);
+    SHA_update(&ctx, data, len);
+    const uint8_t* digest = SHA_final(&ctx);
+    int i;
+    for (i = 0; i < SHA_DIGEST_SIZE; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+    hex[SHA_HEX_SIZE] = '\0';
+}
+
+static int write_all(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static ssize_t read_all(int fd, unsigned char* data, size_t len)
+{
+    size_t so_far = 0;
+    while (so_far < len) {
+        ssize_t n = read(fd, data + so_far, len - so_far);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        so_far += n;
+    }
+    return so_far;
+}
+
+// Adds one chunk to the store, unless it is already there.  The chunk
+// is written under a temporary name and renamed into place, so a blob
+// that exists is always complete.
+static int store_chunk(BackupState* s, const unsigned char* data, int len, char* hex)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+
+    sha_hex(data, len, hex);
+    blob_path(hex, path);
+    if (0 == access(path, F_OK))
+        return 0;
+
+    sprintf(tmp, "%s/%.2s", NANDROID_BLOBS_DIR, hex);
+    if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
+        nandroid_job_print("E:Can't create %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    sprintf(tmp, "%s/%.2s/.tmp.%d", NANDROID_BLOBS_DIR, hex, getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        nandroid_job_print("E:Can't create %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    int ret = write_all(fd, data, len);
+    if (close(fd) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmp, path) != 0)
+        ret = -1;
+    if (ret != 0) {
+        nandroid_job_print("E:Error writing blob %s: %s\n", hex, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    s->chunks_written++;
+    return 0;
+}
+
+static int blobs_exist(const char* hashes)
+{
+    char path[PATH_MAX];
+    while (*hashes && *hashes != '-') {
+        char hex[SHA_HEX_SIZE + 1];
+        strncpy(hex, hashes, SHA_HEX_SIZE);
+        hex[SHA_HEX_SIZE] = '\0';
+        blob_path(hex, path);
+        if (0 != access(path, F_OK))
+            return 0;
+        hashes += SHA_HEX_SIZE;
+        if (*hashes == ',')
+            hashes++;
+    }
+    return 1;
+}
+
+// Loads the regular files from a manifest into a hash table keyed by
+// path.  Returns NULL if there is no usable manifest.
+static HashTable* load_cached_files(const char* manifest)
+{
+    // The manifest may be compressed like any other image.
+    NandroidReader reader;
+    if (0 != nandroid_reader_open(&reader, manifest))
+        return NULL;
+    FILE* f = fopen(reader.path, "r");
+    if (f == NULL) {
+        nandroid_reader_close(&reader);
+        return NULL;
+    }
+
+    HashTable* table = mzHashTableCreate(1024, free_cached_file);
+    char* line = NULL;
+    size_t len = 0;
+    if (table == NULL || nandroid_read_line(f, &line, &len) == NULL ||
+        strcmp(line, NANDROID_MANIFEST_HEADER) != 0) {
+        mzHashTableFree(table);
+        free(line);
+        fclose(f);
+        nandroid_reader_close(&reader);
+        return NULL;
+    }
+
+    while (nandroid_read_line(f, &line, &len) != NULL) {
+        // f <mode> <uid> <gid> <mtime> <size> <ino> <hashes> <path>
+        char* fields[9];
+        if (line[0] != 'f' || nandroid_split_fields(line, fields, 9) != 0)
+            continue;
+        CachedFile* cached = malloc(sizeof(CachedFile));
+        if (cached == NULL)
+            break;
+        nandroid_unescape(fields[8]);
+        cached->path = strdup(fields[8]);
+        cached->mtime = strtol(fields[4], NULL, 10);
+        cached->size = strtoull(fields[5], NULL, 10);
+        cached->ino = strtoul(fields[6], NULL, 10);
+        cached->hashes = strdup(fields[7]);
+        if (mzHashTableLookup(table, hash_path(cached->path), cached,
+                              compare_cached_files, true) != cached) {
+            free_cached_file(cached);
+        }
+    }
+
+    free(line);
+    fclose(f);
+    if (0 != nandroid_reader_close(&reader)) {
+        mzHashTableFree(table);
+        return NULL;
+    }
+    return table;
+}
+
+static int backup_file(BackupState* s, const char* path, const char* rel,
+                       const struct stat* st)
+{
+    fprintf(s->manifest, "f %o %d %d %ld %llu %lu ", st->st_mode & 07777,
+            (int)st->st_uid, (int)st->st_gid, (long)st->st_mtime,
+            (unsigned long long)st->st_size, (unsigned long)st->st_ino);
+
+    if (s->previous != NULL) {
+        CachedFile key;
+        key.path = (char*)rel;
+        CachedFile* cached = mzHashTableLookup(s->previous, hash_path(rel),
+                &key, compare_cached_files, false);
+        if (cached != NULL && cached->size == (unsigned long long)st->st_size &&
+            cached->mtime == (long)st->st_mtime &&
+            cached->ino == (unsigned long)st->st_ino &&
+            blobs_exist(cached->hashes)) {
+            fputs(cached->hashes, s->manifest);
+            s->files_unchanged++;
+            return 0;
+        }
+    }
+
+    if (st->st_size == 0) {
+        fputc('-', s->manifest);
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        nandroid_job_print("E:Can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int first = 1;
+    for (;;) {
+        char hex[SHA_HEX_SIZE + 1];
+        ssize_t len = read_all(fd, s->buf, NANDROID_BLOB_CHUNK_SIZE);
+        if (len < 0) {
+            nandroid_job_print("E:Error reading %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (len == 0)
+            break;
+        if (0 != store_chunk(s, s->buf, len, hex)) {
+            close(fd);
+            return -1;
+        }
+        if (!first)
+            fputc(',', s->manifest);
+        fputs(hex, s->manifest);
+        first = 0;
+        if (len < NANDROID_BLOB_CHUNK_SIZE)
+            break;
+    }
+    close(fd);
+    if (first)
+        fputc('-', s->manifest);  // the file shrank to nothing under us
+    s->files_read++;
+    return 0;
+}
+
+// Walks the tree below "path" (a PATH_MAX buffer that is modified and
+// restored as we descend), writing one manifest line per object.
+static int backup_tree(BackupState* s, char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        nandroid_job_print("E:Can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    size_t len = strlen(path);
+    struct dirent* de;
+    while (ret == 0 && (de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (len + 1 + strlen(de->d_name) >= PATH_MAX) {
+            nandroid_job_print("E:Path too long in %s\n", path);
+            ret = -1;
+            break;
+        }
+        path[len] = '/';
+        strcpy(path + len + 1, de->d_name);
+        const char* rel = path + s->root_len + 1;
+
+        struct stat st;
+        if (lstat(path, &st) != 0) {
+            nandroid_job_print("E:Can't stat %s: %s\n", path, strerror(errno));
+            ret = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            fprintf(s->manifest, "d %o %d %d %ld ", st.st_mode & 07777,
+                    (int)st.st_uid, (int)st.st_gid, (long)st.st_mtime);
+            nandroid_write_escaped(s->manifest, rel);
+            fputc('\n', s->manifest);
+            ret = backup_tree(s, path);
+        } else if (S_ISREG(st.st_mode)) {
+            ret = backup_file(s, path, rel, &st);
+            fputc(' ', s->manifest);
+            nandroid_write_escaped(s->manifest, rel);
+            fputc('\n', s->manifest);
+        } else if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t target_len = readlink(path, target, sizeof(target) - 1);
+            if (target_len < 0) {
+                nandroid_job_print("E:Can't read link %s: %s\n", path, strerror(errno));
+                ret = -1;
+            } else {
+                target[target_len] = '\0';
+                fprintf(s->manifest, "l %o %d %d %ld ", st.st_mode & 07777,
+                        (int)st.st_uid, (int)st.st_gid, (long)st.st_mtime);
+                nandroid_write_escaped(s->manifest, target);
+                fputc(' ', s->manifest);
+                nandroid_write_escaped(s->manifest, rel);
+                fputc('\n', s->manifest);
+            }
+        } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode) || S_ISFIFO(st.st_mode)) {
+            char type = S_ISCHR(st.st_mode) ? 'c' : S_ISBLK(st.st_mode) ? 'b' : 'p';
+            fprintf(s->manifest, "%c %o %d %d %ld %lu ", type, st.st_mode & 07777,
+                    (int)st.st_uid, (int)st.st_gid, (long)st.st_mtime,
+                    (unsigned long)st.st_rdev);
+            nandroid_write_escaped(s->manifest, rel);
+            fputc('\n', s->manifest);
+        }
+        // Sockets are skipped; they are recreated by whoever owns them.
+
+        if (ret == 0 && s->callback != NULL)
+            s->callback(path);
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return ret;
+}
+
+int nandroid_blobs_backup(const char* directory, const char* manifest,
+                          const char* name, const char* record,
+                          nandroid_blobs_callback callback)
+{
+    BackupState s;
+    char path[PATH_MAX];
+    memset(&s, 0, sizeof(s));
+    s.callback = callback;
+
+    if (mkdir(NANDROID_BLOBS_DIR, 0755) != 0 && errno != EEXIST) {
+        nandroid_job_print("E:Can't create %s: %s\n", NANDROID_BLOBS_DIR, strerror(errno));
+        return -1;
+    }
+
+    // The previous manifest of this partition, if any, lets us skip
+    // reading files that haven't changed.
+    char last[PATH_MAX];
+    sprintf(last, "%s/%s.last", NANDROID_BLOBS_DIR, name);
+    FILE* f = fopen(last, "r");
+    if (f != NULL) {
+        if (fgets(path, sizeof(path), f) != NULL) {
+            path[strcspn(path, "\n")] = '\0';
+            s.previous = load_cached_files(path);
+        }
+        fclose(f);
+    }
+
+    s.buf = malloc(NANDROID_BLOB_CHUNK_SIZE);
+    s.manifest = fopen(manifest, "w");
+    if (s.buf == NULL || s.manifest == NULL) {
+        nandroid_job_print("E:Can't create manifest %s\n", record);
+        free(s.buf);
+        if (s.manifest != NULL)
+            fclose(s.manifest);
+        mzHashTableFree(s.previous);
+        return -1;
+    }
+    fprintf(s.manifest, "%s\n", NANDROID_MANIFEST_HEADER);
+
+    strlcpy(path, directory, sizeof(path));
+    s.root_len = strlen(path);
+    while (s.root_len > 1 && path[s.root_len - 1] == '/')
+        path[--s.root_len] = '\0';
+
+    int ret = backup_tree(&s, path);
+    if (fclose(s.manifest) != 0)
+        ret = -1;
+    free(s.buf);
+    mzHashTableFree(s.previous);
+    if (ret != 0)
+        return ret;
+
+    nandroid_job_print("%s: %d files unchanged, %d read, %d new chunks.\n",
+                       name, s.files_unchanged, s.files_read, s.chunks_written);
+    return 0;
+}
+
+void nandroid_blobs_record_last(const char* name, const char* record)
+{
+    char last[PATH_MAX];
+    sprintf(last, "%s/%s.last", NANDROID_BLOBS_DIR, name);
+    FILE* f = fopen(last, "w");
+    if (f != NULL) {
+        fprintf(f, "%s\n", record);
+        fclose(f);
+    }
+}
+
+static int restore_file(const char* path, const char* hashes, unsigned char* buf)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        ui_print("Can't create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    while (ret == 0 && *hashes && *hashes != '-') {
+        char hex[SHA_HEX_SIZE + 1];
+        char actual[SHA_HEX_SIZE + 1];
+        char blob[PATH_MAX];
+        strncpy(hex, hashes, SHA_HEX_SIZE);
+        hex[SHA_HEX_SIZE] = '\0';
+        hashes += SHA_HEX_SIZE;
+        if (*hashes == ',')
+            hashes++;
+
+        blob_path(hex, blob);
+        int in = open(blob, O_RDONLY);
+        if (in < 0) {
+            ui_print("Missing blob %s for %s\n", hex, path);
+            ret = -1;
+            break;
+        }
+        ssize_t len = read_all(in, buf, NANDROID_BLOB_CHUNK_SIZE);
+        close(in);
+        if (len < 0) {
+            ret = -1;
+            break;
+        }
+        sha_hex(buf, len, actual);
+        if (strcmp(hex, actual) != 0) {
+            ui_print("Blob %s is corrupt!\n", hex);
+            ret = -1;
+            break;
+        }
+        if (write_all(fd, buf, len) != 0) {
+            ui_print("Error writing %s: %s\n", path, strerror(errno));
+            ret = -1;
+        }
+    }
+    if (close(fd) != 0)
+        ret = -1;
+    return ret;
+}
+
+int nandroid_blobs_file_matches(const char* path, const char* hashes)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    unsigned char* buf = malloc(NANDROID_BLOB_CHUNK_SIZE);
+    int matches = buf != NULL;
+    while (matches) {
+        char hex[SHA_HEX_SIZE + 1];
+        ssize_t len = read_all(fd, buf, NANDROID_BLOB_CHUNK_SIZE);
+        if (len < 0) {
+            matches = 0;
+        } else if (len == 0) {
+            // The file ended; so should the list.
+            matches = *hashes == '\0' || *hashes == '-';
+            break;
+        } else if (*hashes == '\0' || *hashes == '-') {
+            matches = 0;
+        } else {
+            sha_hex(buf, len, hex);
+            matches = strncmp(hex, hashes, SHA_HEX_SIZE) == 0;
+            hashes += SHA_HEX_SIZE;
+            if (*hashes == ',')
+                hashes++;
+        }
+    }
+    free(buf);
+    close(fd);
+    return matches;
+}
+
+static void set_metadata(const char* path, int mode, int uid, int gid, long mtime)
+{
+    struct utimbuf times;
+    chown(path, uid, gid);
+    // chmod after chown, which clears the setuid bits.
+    chmod(path, mode);
+    times.actime = times.modtime = mtime;
+    utime(path, &times);
+}
+
+int nandroid_blobs_restore(const char* manifest, const char* directory,
+                           const char** paths, int count,
+                           nandroid_blobs_callback callback)
+{
+    FILE* f = fopen(manifest, "r");
+    if (f == NULL) {
+        ui_print("Can't open %s\n", manifest);
+        return -1;
+    }
+    const char** selected = NULL;
+    if (paths != NULL && (selected = nandroid_sort_paths(paths, count)) == NULL) {
+        fclose(f);
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t len = 0;
+    if (nandroid_read_line(f, &line, &len) == NULL || strcmp(line, NANDROID_MANIFEST_HEADER) != 0) {
+        ui_print("%s is not a nandroid manifest!\n", manifest);
+        free(line);
+        free(selected);
+        fclose(f);
+        return -1;
+    }
+
+    unsigned char* buf = malloc(NANDROID_BLOB_CHUNK_SIZE);
+    DeferredTime* dirs = NULL;
+    int num_dirs = 0;
+    int ret = buf == NULL ? -1 : 0;
+    char path[PATH_MAX];
+
+    while (ret == 0 && nandroid_read_line(f, &line, &len) != NULL) {
+        char* fields[9];
+        int num_fields;
+        switch (line[0]) {
+            case 'd': num_fields = 6; break;
+            case 'f': num_fields = 9; break;
+            case 'l': num_fields = 7; break;
+            case 'c': case 'b': case 'p': num_fields = 7; break;
+            default: continue;
+        }
+        if (nandroid_split_fields(line, fields, num_fields) != 0) {
+            ui_print("Corrupt manifest line in %s\n", manifest);
+            ret = -1;
+            break;
+        }
+        int mode = strtol(fields[1], NULL, 8);
+        int uid = strtol(fields[2], NULL, 10);
+        int gid = strtol(fields[3], NULL, 10);
+        long mtime = strtol(fields[4], NULL, 10);
+        nandroid_unescape(fields[num_fields - 1]);
+        if (selected != NULL && !nandroid_path_selected(selected, count, fields[num_fields - 1]))
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", directory, fields[num_fields - 1]) >= (int)sizeof(path)) {
+            ret = -1;
+            break;
+        }
+
+        if (line[0] == 'd') {
+            if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+                ui_print("Can't create %s: %s\n", path, strerror(errno));
+                ret = -1;
+                break;
+            }
+            chown(path, uid, gid);
+            chmod(path, mode);
+            // Creating the children changes the mtime, so set it last.
+            DeferredTime* new_dirs = realloc(dirs, (num_dirs + 1) * sizeof(DeferredTime));
+            if (new_dirs == NULL) {
+                ret = -1;
+                break;
+            }
+            dirs = new_dirs;
+            dirs[num_dirs].path = strdup(path);
+            dirs[num_dirs].mtime = mtime;
+            num_dirs++;
+        } else if (line[0] == 'f') {
+            ret = restore_file(path, fields[7], buf);
+            if (ret == 0)
+                set_metadata(path, mode, uid, gid, mtime);
+        } else if (line[0] == 'l') {
+            nandroid_unescape(fields[5]);
+            if (symlink(fields[5], path) != 0) {
+                ui_print("Can't symlink %s: %s\n", path, strerror(errno));
+                ret = -1;
+                break;
+            }
+            lchown(path, uid, gid);
+        } else {
+            int type = line[0] == 'c' ? S_IFCHR : line[0] == 'b' ? S_IFBLK : S_IFIFO;
+            if (mknod(path, type | mode, strtoul(fields[5], NULL, 10)) != 0) {
+                ui_print("Can't create %s: %s\n", path, strerror(errno));
+                ret = -1;
+                break;
+            }
+            set_metadata(path, mode, uid, gid, mtime);
+        }
+
+        if (ret == 0 && callback != NULL)
+            callback(path);
+    }
+
+    // Deepest directories come last in the manifest.
+    while (num_dirs > 0) {
+        struct utimbuf times;
+        num_dirs--;
+        times.actime = times.modtime = dirs[num_dirs].mtime;
+        utime(dirs[num_dirs].path, &times);
+        free(dirs[num_dirs].path);
+    }
+    free(dirs);
+    free(selected);
+    free(buf);
+    free(line);
+    fclose(f);
+    return ret;
+}
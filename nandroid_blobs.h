@@ -0,0 +1,70 @@
+#ifndef NANDROID_BLOBS_H
+#define NANDROID_BLOBS_H
+
+#include <stdio.h>
+
+// Incremental nandroid backups.
+//
+// Instead of a yaffs2 image, an incremental backup of a partition is a
+// small text manifest (<name>.manifest) listing every file, directory
+// and symlink with its metadata.  File contents are cut into chunks of
+// NANDROID_BLOB_CHUNK_SIZE bytes, and each chunk is stored once in a
+// shared store under NANDROID_BLOBS_DIR, named by its SHA-1.  Chunks
+// already in the store are never written again, and files whose size,
+// mtime and inode match the previous backup of the same partition are
+// not even read.
+
+#define NANDROID_BLOBS_DIR "/sdcard/clockworkmod/blobs"
+#define NANDROID_BLOB_CHUNK_SIZE (1024 * 1024)
+#define NANDROID_MANIFEST_HEADER "# nandroid manifest 1"
+
+// Called once for every object backed up or restored.
+typedef void (*nandroid_blobs_callback)(char* filename);
+
+// Back up everything under "directory" to the blob store, writing the
+// manifest to "manifest".  "name" identifies the partition ("system",
+// "data", ...) and is used to find the previous manifest.  "record" is
+// where the manifest will finally live, if "manifest" is only a pipe
+// leading there.  Returns 0 on success.
+int nandroid_blobs_backup(const char* directory, const char* manifest,
+                          const char* name, const char* record,
+                          nandroid_blobs_callback callback);
+
+// Make "record" the manifest the next backup of "name" compares against.
+// Only for a backup whose manifest made it to "record" whole.
+void nandroid_blobs_record_last(const char* name, const char* record);
+
+// Recreate the tree described by "manifest" under "directory".  If
+// "paths" isn't NULL, only those "count" paths and everything below them
+// are restored.  Anything in the way, other than directories and regular
+// files, must have been removed.  Returns 0 on success.
+int nandroid_blobs_restore(const char* manifest, const char* directory,
+                           const char** paths, int count,
+                           nandroid_blobs_callback callback);
+
+// Returns nonzero if the contents of "path" hash to "hashes", as listed
+// for a file in a manifest.
+int nandroid_blobs_file_matches(const char* path, const char* hashes);
+
+// Helpers for nandroid's line based text files, where fields are
+// separated by single spaces and paths are %-escaped.
+void nandroid_write_escaped(FILE* f, const char* s);
+void nandroid_unescape(char* s);
+
+// Reads a whole line of any length into *buf (growing it as needed),
+// without the trailing newline.  Returns NULL at the end of the file.
+char* nandroid_read_line(FILE* f, char** buf, size_t* len);
+
+// Splits "line" at spaces into exactly "count" fields; the last field
+// gets the rest of the line.  Returns 0 on success.
+int nandroid_split_fields(char* line, char** fields, int count);
+
+// Returns a sorted copy of "paths" (but not of the strings) for
+// nandroid_path_selected(), to be freed with free().
+const char** nandroid_sort_paths(const char** paths, int count);
+
+// Returns nonzero if "path", or one of the directories it is in, is
+// among the "count" paths in "sorted".  "" selects everything.
+int nandroid_path_selected(const char** sorted, int count, const char* path);
+
+#endif
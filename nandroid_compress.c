@@ -0,0 +1,459 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nandroid_compress.h"
+
+#define CODEC_BUFFER_SIZE (64 * 1024)
+
+// Worst case LZ4 output for a full block, plus the block header.
+#define LZ_OUT_SIZE (NANDROID_LZ_BLOCK_SIZE + NANDROID_LZ_BLOCK_SIZE / 255 + 16 + 8)
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+// The last match has to start this far from the end of a block, and
+// the last literals have to be at least LZ_LAST_LITERALS long.
+#define LZ_MF_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+int nandroid_get_compression()
+{
+    int compression = NANDROID_COMPRESSION_NONE;
+    char name[32];
+    FILE* f = fopen(NANDROID_COMPRESSION_FILE, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%31s", name) == 1) {
+            if (strcmp(name, "deflate") == 0 || strcmp(name, "gzip") == 0)
+                compression = NANDROID_COMPRESSION_DEFLATE;
+            else if (strcmp(name, "lz") == 0)
+                compression = NANDROID_COMPRESSION_LZ;
+        }
+        fclose(f);
+    }
+    return compression;
+}
+
+const char* nandroid_compression_name(int compression)
+{
+    switch (compression) {
+        case NANDROID_COMPRESSION_DEFLATE: return "deflate";
+        case NANDROID_COMPRESSION_LZ: return "lz";
+        default: return "none";
+    }
+}
+
+int nandroid_detect_compression(const unsigned char* header, size_t len)
+{
+    if (len >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+        return NANDROID_COMPRESSION_DEFLATE;
+    if (len >= 4 && memcmp(header, NANDROID_LZ_MAGIC, 4) == 0)
+        return NANDROID_COMPRESSION_LZ;
+    return NANDROID_COMPRESSION_NONE;
+}
+
+static void put_le32(unsigned char* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned char* lz_put_length(unsigned char* op, size_t n)
+{
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// Compresses one block (at most 64KB, so every offset fits in 16 bits)
+// in LZ4 block format.  Returns the compressed length, or -1 if it
+// wouldn't be smaller than "cap".
+static int lz_compress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    uint16_t table[1 << LZ_HASH_BITS];
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src;
+    const unsigned char* end = src + len;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + cap;
+
+    memset(table, 0, sizeof(table));
+    if (len > LZ_MF_LIMIT) {
+        const unsigned char* mf_limit = end - LZ_MF_LIMIT;
+        const unsigned char* match_limit = end - LZ_LAST_LITERALS;
+        while (ip < mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+            const unsigned char* ref = src + table[h];
+            table[h] = ip - src;
+            if (ref >= ip || read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            const unsigned char* m = ip + LZ_MIN_MATCH;
+            const unsigned char* r = ref + LZ_MIN_MATCH;
+            while (m < match_limit && *m == *r) {
+                m++;
+                r++;
+            }
+            size_t lit = ip - anchor;
+            size_t ml = m - ip - LZ_MIN_MATCH;
+            if (op + 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1 > oend)
+                return -1;
+
+            unsigned char* token = op++;
+            if (lit >= 15) {
+                *token = 15 << 4;
+                op = lz_put_length(op, lit - 15);
+            } else {
+                *token = lit << 4;
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = (ip - ref) & 0xff;
+            *op++ = (ip - ref) >> 8;
+            if (ml >= 15) {
+                *token |= 15;
+                op = lz_put_length(op, ml - 15);
+            } else {
+                *token |= ml;
+            }
+            ip = anchor = m;
+        }
+    }
+
+    size_t lit = end - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend)
+        return -1;
+    if (lit >= 15) {
+        *op++ = 15 << 4;
+        op = lz_put_length(op, lit - 15);
+    } else {
+        *op++ = lit << 4;
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+static int lz_get_length(const unsigned char** ip, const unsigned char* iend, size_t* n)
+{
+    unsigned char b;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Returns the decompressed length, or -1 if the block is corrupt.
+static int lz_decompress_block(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + len;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + cap;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && lz_get_length(&ip, iend, &lit) != 0)
+            return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+        size_t ml = token & 15;
+        if (ml == 15 && lz_get_length(&ip, iend, &ml) != 0)
+            return -1;
+        ml += LZ_MIN_MATCH;
+        if (ml > (size_t)(oend - op))
+            return -1;
+        // Matches may overlap their own output.
+        const unsigned char* ref = op - offset;
+        while (ml-- > 0)
+            *op++ = *ref++;
+    }
+    return op - dst;
+}
+
+static int lz_write_block(NandroidCodec* c)
+{
+    int stored = lz_compress_block(c->in, c->in_len, c->out + 8, c->in_len);
+    put_le32(c->out, c->in_len);
+    if (stored < 0) {
+        put_le32(c->out + 4, c->in_len | NANDROID_LZ_STORED);
+        if (c->output(c->cookie, c->out, 8) != 0)
+            return -1;
+        if (c->output(c->cookie, c->in, c->in_len) != 0)
+            return -1;
+    } else {
+        put_le32(c->out + 4, stored);
+        if (c->output(c->cookie, c->out, 8 + stored) != 0)
+            return -1;
+    }
+    c->in_len = 0;
+    return 0;
+}
+
+static void free_codec(NandroidCodec* c)
+{
+    free(c->in);
+    free(c->out);
+    c->in = c->out = NULL;
+}
+
+int nandroid_encoder_init(NandroidCodec* c, int compression,
+                          nandroid_output_function output, void* cookie)
+{
+    memset(c, 0, sizeof(*c));
+    c->compression = compression;
+    c->output = output;
+    c->cookie = cookie;
+
+    if (compression == NANDROID_COMPRESSION_DEFLATE) {
+        c->out = malloc(CODEC_BUFFER_SIZE);
+        // 16 + MAX_WBITS asks for a gzip header instead of a zlib one.
+        if (c->out == NULL || deflateInit2(&c->zstream, 1, Z_DEFLATED,
+                16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free_codec(c);
+            return -1;
+        }
+        return 0;
+    }
+    if (compression == NANDROID_COMPRESSION_LZ) {
+        c->in = malloc(NANDROID_LZ_BLOCK_SIZE);
+        c->out = malloc(LZ_OUT_SIZE);
+        if (c->in == NULL || c->out == NULL) {
+            free_codec(c);
+            return -1;
+        }
+        return output(cookie, (const unsigned char*)NANDROID_LZ_MAGIC, 4);
+    }
+    return -1;
+}
+
+static int deflate_run(NandroidCodec* c, int flush)
+{
+    int zerr;
+    do {
+        c->zstream.next_out = c->out;
+        c->zstream.avail_out = CODEC_BUFFER_SIZE;
+        zerr = deflate(&c->zstream, flush);
+        if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR)
+            return -1;
+        size_t have = CODEC_BUFFER_SIZE - c->zstream.avail_out;
+        if (have > 0 && c->output(c->cookie, c->out, have) != 0)
+            return -1;
+    } while (c->zstream.avail_out == 0 || (flush == Z_FINISH && zerr != Z_STREAM_END));
+    return 0;
+}
+
+int nandroid_encoder_write(NandroidCodec* c, const unsigned char* data, size_t len)
+{
+    if (c->compression == NANDROID_COMPRESSION_DEFLATE) {
+        c->zstream.next_in = (unsigned char*)data;
+        c->zstream.avail_in = len;
+        return deflate_run(c, Z_NO_FLUSH);
+    }
+
+    while (len > 0) {
+        size_t n = NANDROID_LZ_BLOCK_SIZE - c->in_len;
+        if (n > len)
+            n = len;
+        memcpy(c->in + c->in_len, data, n);
+        c->in_len += n;
+        data += n;
+        len -= n;
+        if (c->in_len == NANDROID_LZ_BLOCK_SIZE && lz_write_block(c) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int nandroid_encoder_finish(NandroidCodec* c)
+{
+    int ret = 0;
+    if (c->compression == NANDROID_COMPRESSION_DEFLATE) {
+        c->zstream.next_in = NULL;
+        c->zstream.avail_in = 0;
+        ret = deflate_run(c, Z_FINISH);
+        deflateEnd(&c->zstream);
+    } else {
+        if (c->in_len > 0)
+            ret = lz_write_block(c);
+        if (ret == 0) {
+            unsigned char end[8];
+            memset(end, 0, sizeof(end));
+            ret = c->output(c->cookie, end, sizeof(end));
+        }
+    }
+    free_codec(c);
+    return ret;
+}
+
+int nandroid_decoder_init(NandroidCodec* c, int compression,
+                          nandroid_output_function output, void* cookie)
+{
+    memset(c, 0, sizeof(*c));
+    c->compression = compression;
+    c->output = output;
+    c->cookie = cookie;
+
+    if (compression == NANDROID_COMPRESSION_DEFLATE) {
+        c->out = malloc(CODEC_BUFFER_SIZE);
+        if (c->out == NULL || inflateInit2(&c->zstream, 16 + MAX_WBITS) != Z_OK) {
+            free_codec(c);
+            return -1;
+        }
+        return 0;
+    }
+    if (compression == NANDROID_COMPRESSION_LZ) {
+        c->in = malloc(LZ_OUT_SIZE);
+        c->out = malloc(NANDROID_LZ_BLOCK_SIZE);
+        if (c->in == NULL || c->out == NULL) {
+            free_codec(c);
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static int inflate_write(NandroidCodec* c, const unsigned char* data, size_t len)
+{
+    c->zstream.next_in = (unsigned char*)data;
+    c->zstream.avail_in = len;
+    while (c->zstream.avail_in > 0) {
+        if (c->done)
+            return -1;                  // garbage after the end
+        c->zstream.next_out = c->out;
+        c->zstream.avail_out = CODEC_BUFFER_SIZE;
+        int zerr = inflate(&c->zstream, Z_NO_FLUSH);
+        if (zerr == Z_STREAM_END)
+            c->done = 1;
+        else if (zerr != Z_OK)
+            return -1;
+        size_t have = CODEC_BUFFER_SIZE - c->zstream.avail_out;
+        if (have > 0 && c->output(c->cookie, c->out, have) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// What the lz decoder is collecting in c->in.
+#define LZ_STATE_MAGIC 0
+#define LZ_STATE_HEADER 1
+#define LZ_STATE_DATA 2
+
+// Handles whatever c->in holds once it is complete.
+static int lz_decode_collected(NandroidCodec* c)
+{
+    if (c->state == LZ_STATE_MAGIC) {
+        if (memcmp(c->in, NANDROID_LZ_MAGIC, 4) != 0)
+            return -1;
+        c->state = LZ_STATE_HEADER;
+        return 0;
+    }
+
+    if (c->state == LZ_STATE_HEADER) {
+        c->raw_len = get_le32(c->in);
+        c->stored_len = get_le32(c->in + 4);
+        if (c->raw_len == 0) {
+            c->done = 1;
+            return 0;
+        }
+        size_t stored = c->stored_len & ~NANDROID_LZ_STORED;
+        if (c->raw_len > NANDROID_LZ_BLOCK_SIZE || stored == 0 || stored > LZ_OUT_SIZE)
+            return -1;
+        if ((c->stored_len & NANDROID_LZ_STORED) && stored != c->raw_len)
+            return -1;
+        c->state = LZ_STATE_DATA;
+        return 0;
+    }
+
+    if (c->stored_len & NANDROID_LZ_STORED) {
+        if (c->output(c->cookie, c->in, c->raw_len) != 0)
+            return -1;
+    } else {
+        int raw = lz_decompress_block(c->in, c->stored_len, c->out, c->raw_len);
+        if (raw != (int)c->raw_len)
+            return -1;
+        if (c->output(c->cookie, c->out, raw) != 0)
+            return -1;
+    }
+    c->state = LZ_STATE_HEADER;
+    return 0;
+}
+
+static int lz_write(NandroidCodec* c, const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        if (c->done)
+            return -1;                  // garbage after the end
+        size_t want;
+        switch (c->state) {
+            case LZ_STATE_MAGIC: want = 4; break;
+            case LZ_STATE_HEADER: want = 8; break;
+            default: want = c->stored_len & ~NANDROID_LZ_STORED; break;
+        }
+        size_t n = want - c->in_len;
+        if (n > len)
+            n = len;
+        memcpy(c->in + c->in_len, data, n);
+        c->in_len += n;
+        data += n;
+        len -= n;
+        if (c->in_len < want)
+            break;
+        c->in_len = 0;
+        if (lz_decode_collected(c) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int nandroid_decoder_write(NandroidCodec* c, const unsigned char* data, size_t len)
+{
+    if (c->compression == NANDROID_COMPRESSION_DEFLATE)
+        return inflate_write(c, data, len);
+    return lz_write(c, data, len);
+}
+
+int nandroid_decoder_finish(NandroidCodec* c)
+{
+    if (c->compression == NANDROID_COMPRESSION_DEFLATE)
+        inflateEnd(&c->zstream);
+    free_codec(c);
+    return c->done ? 0 : -1;
+}
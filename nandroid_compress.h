@@ -0,0 +1,77 @@
+#ifndef NANDROID_COMPRESS_H
+#define NANDROID_COMPRESS_H
+
+#include <stddef.h>
+
+#include "zlib.h"
+
+// Optional compression of nandroid images.  Compressed images keep
+// their usual names; restore tells them apart by their first bytes.
+//
+//    deflate
+//        a gzip stream (zlib level 1), so "gunzip < system.img" works
+//        on a PC.
+//
+//    lz
+//        "NLZ1", then blocks of up to NANDROID_LZ_BLOCK_SIZE bytes.
+//        Each block is a little-endian header of the raw length and
+//        the stored length, followed by the stored bytes: LZ4 block
+//        format, or the raw bytes when NANDROID_LZ_STORED is set in
+//        the stored length.  A raw length of 0 ends the stream.  Much
+//        faster than deflate, at a lower ratio.
+
+#define NANDROID_COMPRESSION_FILE "/sdcard/clockworkmod/.nandroidcompression"
+
+#define NANDROID_COMPRESSION_NONE 0
+#define NANDROID_COMPRESSION_DEFLATE 1
+#define NANDROID_COMPRESSION_LZ 2
+
+#define NANDROID_LZ_MAGIC "NLZ1"
+#define NANDROID_LZ_BLOCK_SIZE (64 * 1024)
+#define NANDROID_LZ_STORED 0x80000000
+
+// Bytes needed by nandroid_detect_compression().
+#define NANDROID_COMPRESSION_HEADER_SIZE 4
+
+// The codec to write new images with, as named in
+// NANDROID_COMPRESSION_FILE ("deflate" or "lz").  Defaults to none.
+int nandroid_get_compression();
+
+const char* nandroid_compression_name(int compression);
+
+// Looks at the first bytes of an image to find out how it was written.
+int nandroid_detect_compression(const unsigned char* header, size_t len);
+
+// Receives the output of an encoder or decoder.  Returns 0 on success.
+typedef int (*nandroid_output_function)(void* cookie, const unsigned char* data, size_t len);
+
+typedef struct {
+    int compression;
+    nandroid_output_function output;
+    void* cookie;
+    z_stream zstream;
+    unsigned char* in;              // lz: the block being collected
+    size_t in_len;
+    unsigned char* out;
+    int done;                       // decoders: end of stream seen
+    int state;                      // lz decoder: what "in" is collecting
+    unsigned int raw_len;           // lz decoder: current block
+    unsigned int stored_len;
+} NandroidCodec;
+
+// Streaming compression: everything passed to the encoder comes out of
+// "output" compressed once nandroid_encoder_finish() has returned.
+// Each function returns 0 on success.
+int nandroid_encoder_init(NandroidCodec* c, int compression,
+                          nandroid_output_function output, void* cookie);
+int nandroid_encoder_write(NandroidCodec* c, const unsigned char* data, size_t len);
+int nandroid_encoder_finish(NandroidCodec* c);
+
+// The reverse.  nandroid_decoder_finish() fails if the stream was
+// truncated.
+int nandroid_decoder_init(NandroidCodec* c, int compression,
+                          nandroid_output_function output, void* cookie);
+int nandroid_decoder_write(NandroidCodec* c, const unsigned char* data, size_t len);
+int nandroid_decoder_finish(NandroidCodec* c);
+
+#endif
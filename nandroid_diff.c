@@ -0,0 +1,426 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "minzip/DirUtil.h"
+#include "minzip/Hash.h"
+#include "nandroid_blobs.h"
+#include "nandroid_diff.h"
+#include "nandroid_index.h"
+#include "nandroid_io.h"
+
+// One object of the backup.
+typedef struct {
+    char* path;
+    char type;                      // f, d, l, h (hard link) or s
+    unsigned int mode;              // including the file type bits
+    int uid;
+    int gid;
+    long mtime;
+    unsigned long long size;
+    long long rdev;                 // -1 if the backup doesn't say
+    char* target;                   // symlinks and hard links
+    char* hashes;                   // files in manifests
+    int seen;                       // found intact on the partition
+} Entry;
+
+typedef struct {
+    HashTable* entries;             // by path
+    Entry** list;                   // in backup order
+    int count;
+    int size;
+    const char* directory;
+    int root_len;
+    int removed;
+    int updated;
+} Diff;
+
+static unsigned int hash_path(const char* path)
+{
+    unsigned int hash = 2;
+    while (*path)
+        hash = hash * 31 + *path++;
+    return hash;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const Entry*)a)->path, ((const Entry*)b)->path);
+}
+
+static void free_entry(void* ptr)
+{
+    Entry* e = (Entry*)ptr;
+    free(e->path);
+    free(e->target);
+    free(e->hashes);
+    free(e);
+}
+
+static Entry* find_entry(Diff* d, const char* path)
+{
+    Entry key;
+    key.path = (char*)path;
+    return (Entry*)mzHashTableLookup(d->entries, hash_path(path), &key, compare_entries, false);
+}
+
+// Takes ownership of "e".
+static int add_entry(Diff* d, Entry* e)
+{
+    if (e->path == NULL) {
+        free_entry(e);
+        return -1;
+    }
+    if (d->count == d->size) {
+        int new_size = d->size ? d->size * 2 : 1024;
+        Entry** new_list = realloc(d->list, new_size * sizeof(Entry*));
+        if (new_list == NULL) {
+            free_entry(e);
+            return -1;
+        }
+        d->list = new_list;
+        d->size = new_size;
+    }
+    if (mzHashTableLookup(d->entries, hash_path(e->path), e, compare_entries, true) != e) {
+        // Listed twice; the first one wins.
+        free_entry(e);
+        return 0;
+    }
+    d->list[d->count++] = e;
+    return 0;
+}
+
+static int load_manifest(Diff* d, const char* manifest)
+{
+    NandroidReader reader;
+    if (0 != nandroid_reader_open(&reader, manifest))
+        return -1;
+    FILE* f = fopen(reader.path, "r");
+    if (f == NULL) {
+        nandroid_reader_close(&reader);
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t len = 0;
+    int ret = 0;
+    if (nandroid_read_line(f, &line, &len) == NULL || strcmp(line, NANDROID_MANIFEST_HEADER) != 0) {
+        ui_print("%s is not a nandroid manifest!\n", manifest);
+        ret = -1;
+    }
+    while (ret == 0 && nandroid_read_line(f, &line, &len) != NULL) {
+        char* fields[9];
+        int num_fields;
+        unsigned int type;
+        switch (line[0]) {
+            case 'd': num_fields = 6; type = S_IFDIR; break;
+            case 'f': num_fields = 9; type = S_IFREG; break;
+            case 'l': num_fields = 7; type = S_IFLNK; break;
+            case 'c': num_fields = 7; type = S_IFCHR; break;
+            case 'b': num_fields = 7; type = S_IFBLK; break;
+            case 'p': num_fields = 7; type = S_IFIFO; break;
+            default: continue;
+        }
+        if (nandroid_split_fields(line, fields, num_fields) != 0) {
+            ui_print("Corrupt manifest line in %s\n", manifest);
+            ret = -1;
+            break;
+        }
+        Entry* e = calloc(1, sizeof(Entry));
+        if (e == NULL) {
+            ret = -1;
+            break;
+        }
+        e->type = line[0] == 'c' || line[0] == 'b' || line[0] == 'p' ? 's' : line[0];
+        e->mode = type | (strtoul(fields[1], NULL, 8) & 07777);
+        e->uid = strtol(fields[2], NULL, 10);
+        e->gid = strtol(fields[3], NULL, 10);
+        e->mtime = strtol(fields[4], NULL, 10);
+        e->rdev = -1;
+        if (e->type == 'f') {
+            e->size = strtoull(fields[5], NULL, 10);
+            e->hashes = strdup(fields[7]);
+        } else if (e->type == 'l') {
+            nandroid_unescape(fields[5]);
+            e->target = strdup(fields[5]);
+        } else if (e->type == 's') {
+            e->rdev = strtoull(fields[5], NULL, 10);
+        }
+        nandroid_unescape(fields[num_fields - 1]);
+        e->path = strdup(fields[num_fields - 1]);
+        ret = add_entry(d, e);
+    }
+    free(line);
+    fclose(f);
+    if (0 != nandroid_reader_close(&reader))
+        ret = -1;
+    return ret;
+}
+
+static int load_index(Diff* d, const char* index)
+{
+    FILE* f = fopen(index, "r");
+    if (f == NULL)
+        return -1;
+
+    char* line = NULL;
+    size_t len = 0;
+    int ret = 0;
+    if (nandroid_read_line(f, &line, &len) == NULL || strcmp(line, NANDROID_INDEX_HEADER) != 0) {
+        ui_print("%s is not a nandroid index!\n", index);
+        ret = -1;
+    }
+    while (ret == 0 && nandroid_read_line(f, &line, &len) != NULL) {
+        NandroidIndexLine l;
+        if (nandroid_index_parse_line(line, &l) != 0) {
+            ui_print("Corrupt index line in %s\n", index);
+            ret = -1;
+            break;
+        }
+        Entry* e = calloc(1, sizeof(Entry));
+        if (e == NULL) {
+            ret = -1;
+            break;
+        }
+        e->type = l.type;
+        e->mode = strtoul(l.fields[3], NULL, 8);
+        e->uid = strtol(l.fields[4], NULL, 10);
+        e->gid = strtol(l.fields[5], NULL, 10);
+        e->mtime = strtol(l.fields[6], NULL, 10);
+        e->size = strtoull(l.fields[7], NULL, 10);
+        e->rdev = -1;
+        if (l.target != NULL)
+            e->target = strdup(l.target);
+        e->path = strdup(l.path);
+        ret = add_entry(d, e);
+    }
+    free(line);
+    fclose(f);
+    return ret;
+}
+
+// Returns nonzero if the object at "path" can be kept as "e", perhaps
+// after fixing its metadata.
+static int is_intact(Diff* d, const Entry* e, const char* path, const struct stat* st)
+{
+    switch (e->type) {
+        case 'd':
+            return S_ISDIR(st->st_mode);
+        case 'f':
+            if (!S_ISREG(st->st_mode) || (unsigned long long)st->st_size != e->size)
+                return 0;
+            if (st->st_mtime == e->mtime)
+                return 1;
+            return e->hashes != NULL && nandroid_blobs_file_matches(path, e->hashes);
+        case 'l': {
+            char target[PATH_MAX];
+            if (!S_ISLNK(st->st_mode))
+                return 0;
+            ssize_t len = readlink(path, target, sizeof(target) - 1);
+            if (len < 0)
+                return 0;
+            target[len] = '\0';
+            return strcmp(target, e->target) == 0;
+        }
+        case 'h': {
+            char other[PATH_MAX];
+            struct stat other_st;
+            snprintf(other, sizeof(other), "%s/%s", d->directory, e->target);
+            return S_ISREG(st->st_mode) && lstat(other, &other_st) == 0 &&
+                   other_st.st_dev == st->st_dev && other_st.st_ino == st->st_ino;
+        }
+        default:
+            return (st->st_mode & S_IFMT) == (e->mode & S_IFMT) &&
+                   (e->rdev < 0 || (long long)st->st_rdev == e->rdev);
+    }
+}
+
+static void fix_metadata(Diff* d, const Entry* e, const char* path, const struct stat* st)
+{
+    int changed = 0;
+    if (e->type == 'h')
+        return;
+    if (st->st_uid != (uid_t)e->uid || st->st_gid != (gid_t)e->gid) {
+        lchown(path, e->uid, e->gid);
+        changed = 1;
+    }
+    if (e->type != 'l') {
+        // chmod after chown, which clears the setuid bits.
+        if (changed || (st->st_mode & 07777) != (e->mode & 07777)) {
+            chmod(path, e->mode & 07777);
+            changed = 1;
+        }
+        // Directories get their mtime once everything below is done.
+        if (e->type != 'd' && st->st_mtime != e->mtime) {
+            struct utimbuf times;
+            times.actime = times.modtime = e->mtime;
+            utime(path, &times);
+            changed = 1;
+        }
+    }
+    if (changed)
+        d->updated++;
+}
+
+static int remove_object(Diff* d, const char* path, const struct stat* st)
+{
+    int ret = S_ISDIR(st->st_mode) ? dirUnlinkHierarchy(path) : unlink(path);
+    if (ret != 0) {
+        ui_print("Can't remove %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    d->removed++;
+    return 0;
+}
+
+// Compares everything below "path" (a buffer of PATH_MAX) against the
+// backup, removing whatever has to be written again.
+static int compare_tree(Diff* d, char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        ui_print("Can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    size_t len = strlen(path);
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        const char* name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+        // Made by mkfs, never backed up.
+        if (len == (size_t)d->root_len && strcmp(name, "lost+found") == 0)
+            continue;
+        if (len + 1 + strlen(name) >= PATH_MAX) {
+            ret = -1;
+            continue;
+        }
+        path[len] = '/';
+        strcpy(path + len + 1, name);
+
+        struct stat st;
+        Entry* e = find_entry(d, path + d->root_len + 1);
+        if (lstat(path, &st) != 0) {
+            ret = -1;
+        } else if (e == NULL || !is_intact(d, e, path, &st)) {
+            if (remove_object(d, path, &st) != 0)
+                ret = -1;
+        } else {
+            e->seen = 1;
+            fix_metadata(d, e, path, &st);
+            if (e->type == 'd' && compare_tree(d, path) != 0)
+                ret = -1;
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return ret;
+}
+
+// A hard link is only intact if the file it shares is.
+static void check_hard_links(Diff* d)
+{
+    int i;
+    for (i = 0; i < d->count; i++) {
+        Entry* e = d->list[i];
+        if (e->type != 'h' || !e->seen)
+            continue;
+        Entry* other = find_entry(d, e->target);
+        if (other != NULL && !other->seen) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", d->directory, e->path);
+            unlink(path);
+            e->seen = 0;
+            d->removed++;
+        }
+    }
+}
+
+static void set_directory_times(Diff* d)
+{
+    int i;
+    // Deepest directories come last in the backup.
+    for (i = d->count - 1; i >= 0; i--) {
+        Entry* e = d->list[i];
+        char path[PATH_MAX];
+        struct stat st;
+        if (e->type != 'd')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", d->directory, e->path);
+        if (lstat(path, &st) == 0 && st.st_mtime != e->mtime) {
+            struct utimbuf times;
+            times.actime = times.modtime = e->mtime;
+            utime(path, &times);
+        }
+    }
+}
+
+int nandroid_diff_restore(const char* backup, const char* index, const char* directory,
+                          nandroid_diff_callback callback)
+{
+    Diff d;
+    memset(&d, 0, sizeof(d));
+    d.directory = directory;
+    d.root_len = strlen(directory);
+    d.entries = mzHashTableCreate(1024, free_entry);
+    if (d.entries == NULL)
+        return -1;
+
+    int ret = index != NULL ? load_index(&d, index) : load_manifest(&d, backup);
+    if (ret == 0) {
+        char path[PATH_MAX];
+        strlcpy(path, directory, sizeof(path));
+        ret = compare_tree(&d, path);
+    }
+
+    const char** paths = NULL;
+    int count = 0;
+    if (ret == 0) {
+        check_hard_links(&d);
+        paths = malloc((d.count + 1) * sizeof(char*));
+        if (paths == NULL)
+            ret = -1;
+    }
+    if (ret == 0) {
+        int i;
+        for (i = 0; i < d.count; i++) {
+            if (!d.list[i]->seen)
+                paths[count++] = d.list[i]->path;
+        }
+        ui_print("%d of %d objects differ; %d removed, %d fixed up.\n",
+                 count, d.count, d.removed, d.updated);
+    }
+
+    if (ret == 0 && count > 0) {
+        if (index != NULL) {
+            ret = nandroid_index_restore(backup, index, directory, paths, count, callback);
+        } else {
+            NandroidReader reader;
+            ret = nandroid_reader_open(&reader, backup);
+            if (ret == 0) {
+                ret = nandroid_blobs_restore(reader.path, directory, paths, count, callback);
+                if (0 != nandroid_reader_close(&reader))
+                    ret = -1;
+            }
+        }
+    }
+    if (ret == 0)
+        set_directory_times(&d);
+
+    free(paths);
+    free(d.list);
+    mzHashTableFree(d.entries);
+    return ret;
+}
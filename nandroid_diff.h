@@ -0,0 +1,23 @@
+#ifndef NANDROID_DIFF_H
+#define NANDROID_DIFF_H
+
+// Differential restores.
+//
+// Rather than formatting a partition and unpacking the whole backup,
+// the live tree is compared against the backup's list of objects (the
+// manifest of an incremental backup, or the index of a yaffs2 image).
+// Files whose size and mtime match are left alone; for incremental
+// backups a file whose size matches but mtime doesn't is hashed and
+// compared against the manifest.  Anything that isn't in the backup is
+// deleted, anything that differs is written again from the backup, and
+// objects that only differ in owner, mode or mtime are just fixed up.
+
+typedef void (*nandroid_diff_callback)(char* filename);
+
+// Brings "directory" in line with the backup.  "backup" is the yaffs2
+// image or manifest of the partition (compressed or not), and "index"
+// the image's index, or NULL for a manifest.  Returns 0 on success.
+int nandroid_diff_restore(const char* backup, const char* index, const char* directory,
+                          nandroid_diff_callback callback);
+
+#endif
@@ -0,0 +1,559 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "minzip/DirUtil.h"
+#include "nandroid_blobs.h"
+#include "nandroid_index.h"
+#include "nandroid_io.h"
+
+#define YAFFS_CHUNK_TOTAL (NANDROID_YAFFS_CHUNK_SIZE + NANDROID_YAFFS_SPARE_SIZE)
+
+#define YAFFS_OBJECTID_ROOT 1
+// Object ids are only 28 bits; the rest may carry extra header info.
+#define YAFFS_OBJECTID_MASK 0x0fffffff
+#define YAFFS_EXTRA_HEADER_INFO_FLAG 0x80000000
+// mkyaffs2image numbers objects from 257 up; anything far beyond the
+// number of objects a partition can hold means the stream is garbage.
+#define YAFFS_MAX_OBJECT_ID (16 * 1024 * 1024)
+
+#define YAFFS_OBJECT_TYPE_FILE 1
+#define YAFFS_OBJECT_TYPE_SYMLINK 2
+#define YAFFS_OBJECT_TYPE_DIRECTORY 3
+#define YAFFS_OBJECT_TYPE_HARDLINK 4
+#define YAFFS_OBJECT_TYPE_SPECIAL 5
+
+// Field offsets in yaffs_ObjectHeader.
+#define OH_TYPE 0
+#define OH_PARENT 4
+#define OH_NAME 10
+#define OH_NAME_SIZE 256
+#define OH_MODE 268
+#define OH_UID 272
+#define OH_GID 276
+#define OH_MTIME 284
+#define OH_FILE_SIZE 292
+#define OH_EQUIVALENT 296
+#define OH_ALIAS 300
+#define OH_ALIAS_SIZE 160
+#define OH_RDEV 460
+
+// Tag offsets in the spare.
+#define TAGS_OBJECT_ID 4
+#define TAGS_CHUNK_ID 8
+#define TAGS_BYTE_COUNT 12
+
+typedef struct {
+    unsigned int id;
+    unsigned int chunk_id;
+    unsigned int byte_count;
+} YaffsTags;
+
+typedef struct {
+    unsigned int id;
+    unsigned int type;
+    unsigned int parent;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    unsigned int mtime;
+    unsigned int size;
+    unsigned int equivalent;
+    unsigned int rdev;
+    char name[OH_NAME_SIZE];
+    char alias[OH_ALIAS_SIZE];
+} YaffsObject;
+
+typedef struct {
+    const char* directory;
+    const char** paths;
+    int count;
+    nandroid_index_callback callback;
+    unsigned char chunk[YAFFS_CHUNK_TOTAL];
+    int fd;
+} Extract;
+
+static unsigned int get32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void parse_tags(const unsigned char* chunk, YaffsTags* tags)
+{
+    const unsigned char* spare = chunk + NANDROID_YAFFS_CHUNK_SIZE;
+    unsigned int chunk_id = get32(spare + TAGS_CHUNK_ID);
+    tags->id = get32(spare + TAGS_OBJECT_ID) & YAFFS_OBJECTID_MASK;
+    tags->chunk_id = (chunk_id & YAFFS_EXTRA_HEADER_INFO_FLAG) ? 0 : chunk_id;
+    tags->byte_count = get32(spare + TAGS_BYTE_COUNT);
+}
+
+static void parse_header(const unsigned char* chunk, unsigned int id, YaffsObject* o)
+{
+    o->id = id;
+    o->type = get32(chunk + OH_TYPE);
+    o->parent = get32(chunk + OH_PARENT);
+    o->mode = get32(chunk + OH_MODE);
+    o->uid = get32(chunk + OH_UID);
+    o->gid = get32(chunk + OH_GID);
+    o->mtime = get32(chunk + OH_MTIME);
+    o->size = get32(chunk + OH_FILE_SIZE);
+    o->equivalent = get32(chunk + OH_EQUIVALENT);
+    o->rdev = get32(chunk + OH_RDEV);
+    memcpy(o->name, chunk + OH_NAME, OH_NAME_SIZE);
+    o->name[OH_NAME_SIZE - 1] = '\0';
+    memcpy(o->alias, chunk + OH_ALIAS, OH_ALIAS_SIZE);
+    o->alias[OH_ALIAS_SIZE - 1] = '\0';
+}
+
+static char type_char(unsigned int type)
+{
+    switch (type) {
+        case YAFFS_OBJECT_TYPE_FILE: return 'f';
+        case YAFFS_OBJECT_TYPE_SYMLINK: return 'l';
+        case YAFFS_OBJECT_TYPE_DIRECTORY: return 'd';
+        case YAFFS_OBJECT_TYPE_HARDLINK: return 'h';
+        default: return 's';
+    }
+}
+
+// Records the path of object "id" in a table indexed by object id, and
+// returns it.  Returns NULL if the object can't be placed.
+static char* remember_path(char*** paths, unsigned int* size, const YaffsObject* o)
+{
+    if (o->id >= YAFFS_MAX_OBJECT_ID || o->parent >= YAFFS_MAX_OBJECT_ID)
+        return NULL;
+    if (o->id >= *size) {
+        unsigned int new_size = *size ? *size : 1024;
+        while (new_size <= o->id)
+            new_size *= 2;
+        char** new_paths = realloc(*paths, new_size * sizeof(char*));
+        if (new_paths == NULL)
+            return NULL;
+        memset(new_paths + *size, 0, (new_size - *size) * sizeof(char*));
+        *paths = new_paths;
+        *size = new_size;
+    }
+
+    const char* parent = "";
+    if (o->parent != YAFFS_OBJECTID_ROOT) {
+        if (o->parent >= *size || (*paths)[o->parent] == NULL)
+            return NULL;
+        parent = (*paths)[o->parent];
+    }
+    char* path = malloc(strlen(parent) + 1 + strlen(o->name) + 1);
+    if (path == NULL)
+        return NULL;
+    if (parent[0] != '\0')
+        sprintf(path, "%s/%s", parent, o->name);
+    else
+        strcpy(path, o->name);
+    free((*paths)[o->id]);
+    (*paths)[o->id] = path;
+    return path;
+}
+
+static void free_paths(char** paths, unsigned int size)
+{
+    unsigned int i;
+    for (i = 0; i < size; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+int nandroid_indexer_open(NandroidIndexer* ix, const char* index)
+{
+    memset(ix, 0, sizeof(*ix));
+    strlcpy(ix->path, index, sizeof(ix->path));
+    ix->out = fopen(index, "w");
+    if (ix->out == NULL)
+        return -1;
+    fprintf(ix->out, "%s\n", NANDROID_INDEX_HEADER);
+    return 0;
+}
+
+static void index_chunk(NandroidIndexer* ix)
+{
+    YaffsTags tags;
+    YaffsObject o;
+    parse_tags(ix->chunk, &tags);
+    if (tags.chunk_id != 0 || tags.id == YAFFS_OBJECTID_ROOT)
+        return;
+
+    parse_header(ix->chunk, tags.id, &o);
+    char* path = remember_path(&ix->paths, &ix->paths_size, &o);
+    if (path == NULL) {
+        ix->error = 1;
+        return;
+    }
+
+    fprintf(ix->out, "%llu %u %c %o %u %u %u %u ", (unsigned long long)ix->offset,
+            o.id, type_char(o.type), o.mode, o.uid, o.gid, o.mtime, o.size);
+    if (o.type == YAFFS_OBJECT_TYPE_SYMLINK) {
+        nandroid_write_escaped(ix->out, o.alias);
+        fputc(' ', ix->out);
+    } else if (o.type == YAFFS_OBJECT_TYPE_HARDLINK) {
+        if (o.equivalent >= ix->paths_size || ix->paths[o.equivalent] == NULL) {
+            ix->error = 1;
+            return;
+        }
+        nandroid_write_escaped(ix->out, ix->paths[o.equivalent]);
+        fputc(' ', ix->out);
+    }
+    nandroid_write_escaped(ix->out, path);
+    fputc('\n', ix->out);
+}
+
+void nandroid_indexer_feed(NandroidIndexer* ix, const unsigned char* data, size_t len)
+{
+    while (len > 0 && !ix->error) {
+        size_t n = YAFFS_CHUNK_TOTAL - ix->chunk_len;
+        if (n > len)
+            n = len;
+        memcpy(ix->chunk + ix->chunk_len, data, n);
+        ix->chunk_len += n;
+        data += n;
+        len -= n;
+        if (ix->chunk_len == YAFFS_CHUNK_TOTAL) {
+            index_chunk(ix);
+            ix->offset += YAFFS_CHUNK_TOTAL;
+            ix->chunk_len = 0;
+        }
+    }
+}
+
+int nandroid_indexer_close(NandroidIndexer* ix)
+{
+    // A partial chunk at the end means the image isn't what we think.
+    if (ix->chunk_len != 0)
+        ix->error = 1;
+    if (fclose(ix->out) != 0)
+        ix->error = 1;
+    free_paths(ix->paths, ix->paths_size);
+    if (ix->error) {
+        unlink(ix->path);
+        return -1;
+    }
+    return 0;
+}
+
+int nandroid_index_parse_line(char* line, NandroidIndexLine* l)
+{
+    char* fields[9];
+    char* rest[2];
+    if (nandroid_split_fields(line, fields, 9) != 0)
+        return -1;
+    memcpy(l->fields, fields, sizeof(l->fields));
+    l->type = fields[2][0];
+    l->target = NULL;
+    l->path = fields[8];
+    if (l->type == 'l' || l->type == 'h') {
+        if (nandroid_split_fields(fields[8], rest, 2) != 0)
+            return -1;
+        l->target = rest[0];
+        l->path = rest[1];
+        nandroid_unescape(l->target);
+    }
+    nandroid_unescape(l->path);
+    return 0;
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+char** nandroid_index_list(const char* index, const char* prefix)
+{
+    FILE* f = fopen(index, "r");
+    if (f == NULL)
+        return NULL;
+
+    char* line = NULL;
+    size_t len = 0;
+    if (nandroid_read_line(f, &line, &len) == NULL || strcmp(line, NANDROID_INDEX_HEADER) != 0) {
+        free(line);
+        fclose(f);
+        return NULL;
+    }
+
+    size_t prefix_len = strlen(prefix);
+    int count = 0, size = 16;
+    char** list = malloc((size + 1) * sizeof(char*));
+    while (list != NULL && nandroid_read_line(f, &line, &len) != NULL) {
+        NandroidIndexLine l;
+        if (nandroid_index_parse_line(line, &l) != 0)
+            continue;
+        char* path = l.path;
+        if (prefix_len > 0) {
+            if (strncmp(path, prefix, prefix_len) != 0 || path[prefix_len] != '/')
+                continue;
+            path += prefix_len + 1;
+        }
+        if (path[0] == '\0' || strchr(path, '/') != NULL)
+            continue;
+
+        if (count == size) {
+            size *= 2;
+            char** new_list = realloc(list, (size + 1) * sizeof(char*));
+            if (new_list == NULL)
+                break;
+            list = new_list;
+        }
+        char* name = malloc(strlen(path) + 2);
+        if (name == NULL)
+            break;
+        sprintf(name, "%s%s", path, l.type == 'd' ? "/" : "");
+        list[count++] = name;
+    }
+    if (list != NULL) {
+        list[count] = NULL;
+        qsort(list, count, sizeof(char*), compare_strings);
+    }
+    free(line);
+    fclose(f);
+    return list;
+}
+
+static int is_selected(Extract* x, const char* path)
+{
+    return nandroid_path_selected(x->paths, x->count, path);
+}
+
+// Reads the next chunk from x->fd.  Returns 1 if there was one, 0 at the
+// end of the image and -1 on errors.
+static int read_chunk(Extract* x)
+{
+    size_t have = 0;
+    while (have < YAFFS_CHUNK_TOTAL) {
+        ssize_t len = read(x->fd, x->chunk + have, YAFFS_CHUNK_TOTAL - have);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            return -1;
+        if (len == 0)
+            return have == 0 ? 0 : -1;
+        have += len;
+    }
+    return 1;
+}
+
+static void set_metadata(const char* path, const YaffsObject* o)
+{
+    struct utimbuf times;
+    chown(path, o->uid, o->gid);
+    chmod(path, o->mode & 07777);
+    times.actime = times.modtime = o->mtime;
+    utime(path, &times);
+}
+
+// Recreates one object under x->directory.  A file's data chunks are
+// read from x->fd, which must be positioned right after its header.
+static int extract_object(Extract* x, const YaffsObject* o, const char* path, const char* target)
+{
+    char full[PATH_MAX];
+    if (snprintf(full, sizeof(full), "%s/%s", x->directory, path) >= (int)sizeof(full))
+        return -1;
+    dirCreateHierarchy(full, 0755, NULL, true);
+
+    if (o->type == YAFFS_OBJECT_TYPE_DIRECTORY) {
+        struct stat st;
+        if (lstat(full, &st) == 0 && !S_ISDIR(st.st_mode))
+            unlink(full);
+        if (mkdir(full, 0700) != 0 && errno != EEXIST) {
+            ui_print("Can't create %s: %s\n", full, strerror(errno));
+            return -1;
+        }
+        set_metadata(full, o);
+    } else if (o->type == YAFFS_OBJECT_TYPE_FILE) {
+        unlink(full);
+        int out = open(full, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (out < 0) {
+            ui_print("Can't create %s: %s\n", full, strerror(errno));
+            return -1;
+        }
+        unsigned int remaining = o->size;
+        unsigned int chunk_id = 1;
+        while (remaining > 0) {
+            YaffsTags tags;
+            if (read_chunk(x) != 1) {
+                ui_print("%s is truncated!\n", path);
+                close(out);
+                return -1;
+            }
+            parse_tags(x->chunk, &tags);
+            if (tags.id != o->id || tags.chunk_id != chunk_id) {
+                ui_print("Unexpected chunk in %s!\n", path);
+                close(out);
+                return -1;
+            }
+            unsigned int len = tags.byte_count;
+            if (len > remaining || len > NANDROID_YAFFS_CHUNK_SIZE)
+                len = remaining < NANDROID_YAFFS_CHUNK_SIZE ? remaining : NANDROID_YAFFS_CHUNK_SIZE;
+            if (write(out, x->chunk, len) != (ssize_t)len) {
+                ui_print("Error writing %s: %s\n", full, strerror(errno));
+                close(out);
+                return -1;
+            }
+            remaining -= len;
+            chunk_id++;
+        }
+        if (close(out) != 0)
+            return -1;
+        set_metadata(full, o);
+    } else if (o->type == YAFFS_OBJECT_TYPE_SYMLINK) {
+        unlink(full);
+        if (symlink(o->alias, full) != 0) {
+            ui_print("Can't symlink %s: %s\n", full, strerror(errno));
+            return -1;
+        }
+        lchown(full, o->uid, o->gid);
+    } else if (o->type == YAFFS_OBJECT_TYPE_HARDLINK) {
+        char existing[PATH_MAX];
+        if (target == NULL)
+            return -1;
+        snprintf(existing, sizeof(existing), "%s/%s", x->directory, target);
+        unlink(full);
+        if (link(existing, full) != 0) {
+            // The other name wasn't selected; not worth failing over.
+            ui_print("Skipping hard link %s to %s\n", path, target);
+            return 0;
+        }
+    } else {
+        unlink(full);
+        if (mknod(full, o->mode, o->rdev) != 0) {
+            ui_print("Can't create %s: %s\n", full, strerror(errno));
+            return -1;
+        }
+        set_metadata(full, o);
+    }
+
+    if (x->callback != NULL)
+        x->callback(full);
+    return 0;
+}
+
+// Reads the whole image, extracting the selected objects as they pass.
+static int restore_by_scanning(Extract* x)
+{
+    char** paths = NULL;
+    unsigned int paths_size = 0;
+    int ret = 0;
+    int r;
+
+    while (ret == 0 && (r = read_chunk(x)) == 1) {
+        YaffsTags tags;
+        YaffsObject o;
+        parse_tags(x->chunk, &tags);
+        if (tags.chunk_id != 0 || tags.id == YAFFS_OBJECTID_ROOT)
+            continue;
+        parse_header(x->chunk, tags.id, &o);
+        char* path = remember_path(&paths, &paths_size, &o);
+        if (path == NULL) {
+            ui_print("Corrupt image!\n");
+            ret = -1;
+            break;
+        }
+        if (!is_selected(x, path))
+            continue;
+        const char* target = NULL;
+        if (o.type == YAFFS_OBJECT_TYPE_HARDLINK && o.equivalent < paths_size)
+            target = paths[o.equivalent];
+        ret = extract_object(x, &o, path, target);
+    }
+    if (r < 0)
+        ret = -1;
+    free_paths(paths, paths_size);
+    return ret;
+}
+
+// Seeks straight to each selected object listed in the index.
+static int restore_from_index(Extract* x, FILE* f)
+{
+    char* line = NULL;
+    size_t len = 0;
+    int ret = 0;
+
+    while (ret == 0 && nandroid_read_line(f, &line, &len) != NULL) {
+        NandroidIndexLine l;
+        if (nandroid_index_parse_line(line, &l) != 0)
+            continue;
+        if (!is_selected(x, l.path))
+            continue;
+
+        off64_t offset = strtoull(l.fields[0], NULL, 10);
+        unsigned int id = strtoul(l.fields[1], NULL, 10);
+        YaffsTags tags;
+        YaffsObject o;
+        if (lseek64(x->fd, offset, SEEK_SET) != offset || read_chunk(x) != 1) {
+            ui_print("Can't read %s from the image!\n", l.path);
+            ret = -1;
+            break;
+        }
+        parse_tags(x->chunk, &tags);
+        if (tags.id != id || tags.chunk_id != 0) {
+            ui_print("The index doesn't match the image!\n");
+            ret = -1;
+            break;
+        }
+        parse_header(x->chunk, id, &o);
+        ret = extract_object(x, &o, l.path, l.target);
+    }
+    free(line);
+    return ret;
+}
+
+int nandroid_index_restore(const char* image, const char* index, const char* directory,
+                           const char** paths, int count, nandroid_index_callback callback)
+{
+    Extract x;
+    memset(&x, 0, sizeof(x));
+    x.directory = directory;
+    x.count = count;
+    x.callback = callback;
+    x.paths = nandroid_sort_paths(paths, count);
+    if (x.paths == NULL)
+        return -1;
+
+    NandroidReader reader;
+    if (0 != nandroid_reader_open(&reader, image)) {
+        free(x.paths);
+        return -1;
+    }
+    x.fd = open(reader.path, O_RDONLY | O_LARGEFILE);
+    if (x.fd < 0) {
+        ui_print("Can't open %s\n", image);
+        nandroid_reader_close(&reader);
+        free(x.paths);
+        return -1;
+    }
+
+    int ret;
+    FILE* f = NULL;
+    char* header = NULL;
+    size_t header_len = 0;
+    if (reader.compression == NANDROID_COMPRESSION_NONE && index != NULL)
+        f = fopen(index, "r");
+    if (f != NULL && nandroid_read_line(f, &header, &header_len) != NULL &&
+        strcmp(header, NANDROID_INDEX_HEADER) == 0) {
+        ret = restore_from_index(&x, f);
+    } else {
+        ui_print("Scanning the whole image...\n");
+        ret = restore_by_scanning(&x);
+    }
+    free(header);
+    if (f != NULL)
+        fclose(f);
+    close(x.fd);
+    if (0 != nandroid_reader_close(&reader))
+        ret = -1;
+    free(x.paths);
+    return ret;
+}
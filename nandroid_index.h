@@ -0,0 +1,73 @@
+#ifndef NANDROID_INDEX_H
+#define NANDROID_INDEX_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Index files for yaffs2 nandroid images.
+//
+// mkyaffs2image writes a stream of NANDROID_YAFFS_CHUNK_SIZE byte chunks,
+// each followed by NANDROID_YAFFS_SPARE_SIZE bytes of spare holding the
+// chunk's tags.  Every object starts with a header chunk (chunk id 0)
+// and a file's data chunks follow its header directly.  While a backup
+// is written, the index records where each object's header is, so that
+// single files can be restored without reading the whole image:
+//
+//    # nandroid index 1
+//    <offset> <object id> <type> <mode> <uid> <gid> <mtime> <size> [<target>] <path>
+//
+// <type> is one of f (file), d (directory), l (symlink), h (hard link)
+// or s (device, fifo or socket).  Symlinks and hard links carry their
+// target.  <mode> is octal and includes the file type bits.  Paths are
+// relative to the partition and %-escaped.
+
+#define NANDROID_YAFFS_CHUNK_SIZE 2048
+#define NANDROID_YAFFS_SPARE_SIZE 64
+#define NANDROID_INDEX_HEADER "# nandroid index 1"
+
+typedef void (*nandroid_index_callback)(char* filename);
+
+// Builds the index from the image stream as it is written.
+typedef struct {
+    char path[PATH_MAX];
+    FILE* out;
+    unsigned char chunk[NANDROID_YAFFS_CHUNK_SIZE + NANDROID_YAFFS_SPARE_SIZE];
+    size_t chunk_len;
+    uint64_t offset;                // of the chunk being collected
+    char** paths;                   // by object id
+    unsigned int paths_size;
+    int error;
+} NandroidIndexer;
+
+// Returns 0 if the index file could be created.
+int nandroid_indexer_open(NandroidIndexer* ix, const char* index);
+void nandroid_indexer_feed(NandroidIndexer* ix, const unsigned char* data, size_t len);
+// Returns 0 if the index is complete; otherwise it is removed.
+int nandroid_indexer_close(NandroidIndexer* ix);
+
+// One line of an index, split in place.
+typedef struct {
+    char* fields[8];                // offset, id, type, mode, uid, gid, mtime, size
+    char type;
+    char* target;                   // links only
+    char* path;
+} NandroidIndexLine;
+
+// Splits and unescapes one line of an index.  Returns 0 if it is valid.
+int nandroid_index_parse_line(char* line, NandroidIndexLine* l);
+
+// Lists what the index has directly below "prefix" ("" for the top of
+// the partition).  Directories get a trailing '/'.  Returns a NULL
+// terminated array for free_string_array(), or NULL.
+char** nandroid_index_list(const char* index, const char* prefix);
+
+// Restores the objects named in "paths" (and everything below them)
+// from "image" into "directory", over whatever is there.  If "index"
+// exists and the image isn't compressed, only the needed chunks are
+// read; otherwise the image is scanned from start to end.  Returns 0
+// on success.
+int nandroid_index_restore(const char* image, const char* index, const char* directory,
+                           const char** paths, int count, nandroid_index_callback callback);
+
+#endif
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "nandroid_io.h"
+#include "nandroid_jobs.h"
+
+#define WRITER_BUFFER_SIZE (64 * 1024)
+
+static int write_all(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Where the (possibly compressed) image data ends up.
+static int write_image(void* cookie, const unsigned char* data, size_t len)
+{
+    NandroidWriter* w = (NandroidWriter*)cookie;
+    if (w->error)
+        return -1;
+    MD5_update(&w->md5, data, len);
+    if (0 != write_all(w->out_fd, data, len)) {
+        w->error = errno ? errno : EIO;
+        nandroid_job_print("E:Error writing %s: %s\n", w->image, strerror(w->error));
+        return -1;
+    }
+    return 0;
+}
+
+static void* writer_thread(void* cookie)
+{
+    NandroidWriter* w = (NandroidWriter*)cookie;
+    unsigned char* buf = malloc(WRITER_BUFFER_SIZE);
+    if (buf == NULL)
+        w->error = ENOMEM;
+
+    for (;;) {
+        ssize_t len;
+        if (buf != NULL) {
+            len = read(w->pipefd[0], buf, WRITER_BUFFER_SIZE);
+        } else {
+            unsigned char drain[512];
+            len = read(w->pipefd[0], drain, sizeof(drain));
+        }
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        // After an error keep draining, or the producer blocks forever.
+        if (w->error)
+            continue;
+        if (w->indexing)
+            nandroid_indexer_feed(&w->indexer, buf, len);
+        if (w->compression != NANDROID_COMPRESSION_NONE) {
+            if (0 != nandroid_encoder_write(&w->codec, buf, len) && !w->error) {
+                w->error = EIO;
+                nandroid_job_print("E:Error compressing %s\n", w->image);
+            }
+        } else {
+            write_image(w, buf, len);
+        }
+        w->bytes += len;
+    }
+
+    if (w->compression != NANDROID_COMPRESSION_NONE) {
+        if (0 != nandroid_encoder_finish(&w->codec) && !w->error) {
+            w->error = EIO;
+            nandroid_job_print("E:Error compressing %s\n", w->image);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+int nandroid_writer_open(NandroidWriter* w, const char* image, int compression, const char* index)
+{
+    memset(w, 0, sizeof(*w));
+    strlcpy(w->image, image, sizeof(w->image));
+    w->compression = compression;
+    MD5_init(&w->md5);
+
+    w->out_fd = open(image, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w->out_fd < 0) {
+        nandroid_job_print("E:Can't create %s: %s\n", image, strerror(errno));
+        return -1;
+    }
+    if (compression != NANDROID_COMPRESSION_NONE &&
+        0 != nandroid_encoder_init(&w->codec, compression, write_image, w)) {
+        nandroid_job_print("E:Can't start %s compression for %s\n",
+                           nandroid_compression_name(compression), image);
+        close(w->out_fd);
+        return -1;
+    }
+    if (pipe(w->pipefd) != 0) {
+        nandroid_job_print("E:Can't create pipe for %s: %s\n", image, strerror(errno));
+        if (compression != NANDROID_COMPRESSION_NONE)
+            nandroid_encoder_finish(&w->codec);
+        close(w->out_fd);
+        return -1;
+    }
+    // The index is a convenience; the backup doesn't depend on it.
+    if (index != NULL && 0 == nandroid_indexer_open(&w->indexer, index))
+        w->indexing = 1;
+    // Reopening the pipe through /proc works for anything that takes a
+    // file name, including children of __system(), which inherit the fd.
+    sprintf(w->path, "/proc/self/fd/%d", w->pipefd[1]);
+
+    if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+        nandroid_job_print("E:Can't start writer for %s\n", image);
+        if (compression != NANDROID_COMPRESSION_NONE)
+            nandroid_encoder_finish(&w->codec);
+        if (w->indexing)
+            nandroid_indexer_close(&w->indexer);
+        close(w->pipefd[0]);
+        close(w->pipefd[1]);
+        close(w->out_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int nandroid_writer_close(NandroidWriter* w)
+{
+    // Once our copy of the write end is gone, the thread sees EOF as
+    // soon as the producer has closed its own.
+    close(w->pipefd[1]);
+    pthread_join(w->thread, NULL);
+    close(w->pipefd[0]);
+
+    if (close(w->out_fd) != 0 && !w->error) {
+        w->error = errno;
+        nandroid_job_print("E:Error closing %s: %s\n", w->image, strerror(w->error));
+    }
+    if (w->indexing && 0 != nandroid_indexer_close(&w->indexer))
+        nandroid_job_print("Couldn't index %s; single file restore will be slow.\n", w->image);
+    if (w->error)
+        return -1;
+
+    MD5_hex(MD5_final(&w->md5), w->md5_hex);
+    return 0;
+}
+
+static int write_pipe(void* cookie, const unsigned char* data, size_t len)
+{
+    NandroidReader* r = (NandroidReader*)cookie;
+    if (0 != write_all(r->pipefd[1], data, len)) {
+        r->error = errno ? errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static void* reader_thread(void* cookie)
+{
+    NandroidReader* r = (NandroidReader*)cookie;
+    unsigned char* buf = malloc(WRITER_BUFFER_SIZE);
+    int ret = -1;
+
+    if (buf != NULL)
+        ret = nandroid_decoder_write(&r->codec, r->header, r->header_len);
+    while (ret == 0) {
+        ssize_t len = read(r->in_fd, buf, WRITER_BUFFER_SIZE);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            ret = -1;
+        if (len <= 0)
+            break;
+        ret = nandroid_decoder_write(&r->codec, buf, len);
+    }
+    if (0 != nandroid_decoder_finish(&r->codec))
+        ret = -1;
+    if (ret != 0 && !r->error)
+        r->error = EIO;
+
+    // Lets the consumer see the end of the image.
+    close(r->pipefd[1]);
+    free(buf);
+    return NULL;
+}
+
+int nandroid_reader_open(NandroidReader* r, const char* image)
+{
+    memset(r, 0, sizeof(*r));
+    strlcpy(r->image, image, sizeof(r->image));
+
+    r->in_fd = open(image, O_RDONLY);
+    if (r->in_fd < 0) {
+        nandroid_job_print("E:Can't open %s: %s\n", image, strerror(errno));
+        return -1;
+    }
+    while (r->header_len < (int)sizeof(r->header)) {
+        ssize_t len = read(r->in_fd, r->header + r->header_len, sizeof(r->header) - r->header_len);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        r->header_len += len;
+    }
+
+    r->compression = nandroid_detect_compression(r->header, r->header_len);
+    if (r->compression == NANDROID_COMPRESSION_NONE) {
+        close(r->in_fd);
+        r->in_fd = -1;
+        strlcpy(r->path, image, sizeof(r->path));
+        return 0;
+    }
+
+    if (0 != nandroid_decoder_init(&r->codec, r->compression, write_pipe, r)) {
+        nandroid_job_print("E:Can't start %s decompression for %s\n",
+                           nandroid_compression_name(r->compression), image);
+        close(r->in_fd);
+        return -1;
+    }
+    if (pipe(r->pipefd) != 0) {
+        nandroid_job_print("E:Can't create pipe for %s: %s\n", image, strerror(errno));
+        nandroid_decoder_finish(&r->codec);
+        close(r->in_fd);
+        return -1;
+    }
+    // Children of __system() must only inherit the read end, or they
+    // would never see the end of the image.
+    fcntl(r->pipefd[1], F_SETFD, FD_CLOEXEC);
+    // A consumer that gives up early closes the pipe under the thread.
+    signal(SIGPIPE, SIG_IGN);
+    sprintf(r->path, "/proc/self/fd/%d", r->pipefd[0]);
+
+    if (pthread_create(&r->thread, NULL, reader_thread, r) != 0) {
+        nandroid_job_print("E:Can't start reader for %s\n", image);
+        nandroid_decoder_finish(&r->codec);
+        close(r->pipefd[0]);
+        close(r->pipefd[1]);
+        close(r->in_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int nandroid_reader_close(NandroidReader* r)
+{
+    if (r->compression == NANDROID_COMPRESSION_NONE)
+        return 0;
+
+    close(r->pipefd[0]);
+    pthread_join(r->thread, NULL);
+    close(r->in_fd);
+    if (r->error) {
+        nandroid_job_print("E:Error decompressing %s\n", r->image);
+        return -1;
+    }
+    return 0;
+}
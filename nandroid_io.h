@@ -0,0 +1,69 @@
+#ifndef NANDROID_IO_H
+#define NANDROID_IO_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "md5.h"
+#include "nandroid_compress.h"
+#include "nandroid_index.h"
+
+// Sits between an image producer (mkyaffs2image, dump_image, dd) and
+// the image file on the sdcard.  The producer is handed "path", which
+// is the write end of a pipe; a thread copies everything that comes
+// through to the real image, compressing it if asked to and computing
+// the md5 of what lands on the card on the way, so the image never has
+// to be read back.
+typedef struct NandroidWriter {
+    char path[PATH_MAX];            // give this to the producer
+    char image[PATH_MAX];           // the file actually written
+    int pipefd[2];
+    int out_fd;
+    pthread_t thread;
+    int compression;
+    NandroidCodec codec;
+    int indexing;
+    NandroidIndexer indexer;
+    MD5_CTX md5;
+    char md5_hex[2 * MD5_DIGEST_SIZE + 1];
+    uint64_t bytes;                 // before compression
+    int error;
+} NandroidWriter;
+
+// Creates the image and starts the copy thread.  "compression" is one
+// of the NANDROID_COMPRESSION_* codecs.  If "index" isn't NULL the
+// stream is a yaffs2 image, and an index of it is written there.
+// Returns 0 on success.
+int nandroid_writer_open(NandroidWriter* w, const char* image, int compression, const char* index);
+
+// Waits for the producer's data to drain and closes the image.  Must be
+// called after the producer has closed "path".  Returns 0 if the whole
+// stream made it to the image, in which case md5_hex is filled in.
+int nandroid_writer_close(NandroidWriter* w);
+
+// The other way round, for restoring.  If the image is compressed, a
+// thread decompresses it into a pipe and "path" is the read end;
+// otherwise "path" is just the image itself.
+typedef struct NandroidReader {
+    char path[PATH_MAX];            // give this to the consumer
+    char image[PATH_MAX];
+    int pipefd[2];
+    int in_fd;
+    pthread_t thread;
+    int compression;
+    NandroidCodec codec;
+    unsigned char header[NANDROID_COMPRESSION_HEADER_SIZE];
+    int header_len;
+    int error;
+} NandroidReader;
+
+// Opens the image and works out how it was compressed.  Returns 0 on
+// success.
+int nandroid_reader_open(NandroidReader* r, const char* image);
+
+// Must be called after the consumer has closed "path".  Returns 0 if
+// the whole image was decompressed without errors.
+int nandroid_reader_close(NandroidReader* r);
+
+#endif
@@ -0,0 +1,272 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "nandroid_jobs.h"
+
+// Write end of the pipe back to the parent, only set in a job's child.
+static FILE* job_pipe = NULL;
+// Last progress sent to the parent; smaller steps aren't worth a write
+// and a wakeup, with a call for every file backed up.
+static float sent_progress = -1;
+#define PROGRESS_STEP 0.01f
+
+int nandroid_get_max_jobs()
+{
+    int max_jobs = NANDROID_DEFAULT_JOBS;
+    FILE* f = fopen(NANDROID_JOBS_FILE, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &max_jobs) != 1)
+            max_jobs = NANDROID_DEFAULT_JOBS;
+        fclose(f);
+    }
+    if (max_jobs < 1)
+        max_jobs = 1;
+    if (max_jobs > NANDROID_MAX_JOBS)
+        max_jobs = NANDROID_MAX_JOBS;
+    return max_jobs;
+}
+
+int nandroid_job_active()
+{
+    return job_pipe != NULL;
+}
+
+void nandroid_job_set_progress(float fraction)
+{
+    if (job_pipe == NULL) {
+        ui_set_progress(fraction);
+        return;
+    }
+    if (fraction < 1.0f && fraction >= sent_progress &&
+        fraction - sent_progress < PROGRESS_STEP)
+        return;
+    sent_progress = fraction;
+    fprintf(job_pipe, "progress %f\n", fraction);
+    fflush(job_pipe);
+}
+
+void nandroid_job_set_md5(const char* md5_hex)
+{
+    if (job_pipe == NULL)
+        return;
+    fprintf(job_pipe, "md5 %s\n", md5_hex);
+    fflush(job_pipe);
+}
+
+void nandroid_job_print(const char* fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (job_pipe == NULL) {
+        ui_print("%s", buf);
+        return;
+    }
+    // One line per command; the parent puts the newlines back.
+    char* line = strtok(buf, "\n");
+    while (line != NULL) {
+        fprintf(job_pipe, "ui_print %s\n", line);
+        line = strtok(NULL, "\n");
+    }
+    fflush(job_pipe);
+}
+
+static int start_job(NandroidJob* job)
+{
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        LOGE("Can't create pipe for %s: %s\n", job->name, strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("Can't fork %s job: %s\n", job->name, strerror(errno));
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // The ui threads don't exist in the child, so everything
+        // that would hit the screen has to go through the pipe.
+        close(pipefd[0]);
+        job_pipe = fdopen(pipefd[1], "w");
+        int ret = job->run(job);
+        fclose(job_pipe);
+        _exit(ret == 0 ? 0 : 1);
+    }
+
+    close(pipefd[1]);
+    job->pid = pid;
+    job->fd = pipefd[0];
+    job->line_len = 0;
+    return 0;
+}
+
+static void handle_job_command(NandroidJob* job, char* line)
+{
+    char* command = strtok(line, " ");
+    if (command == NULL) {
+        return;
+    } else if (strcmp(command, "progress") == 0) {
+        char* fraction_s = strtok(NULL, " ");
+        if (fraction_s == NULL)
+            return;
+        float fraction = strtof(fraction_s, NULL);
+        if (fraction < 0.0) fraction = 0.0;
+        if (fraction > 1.0) fraction = 1.0;
+        job->progress = fraction;
+    } else if (strcmp(command, "md5") == 0) {
+        char* md5 = strtok(NULL, " ");
+        if (md5 != NULL)
+            strlcpy(job->md5, md5, sizeof(job->md5));
+    } else if (strcmp(command, "ui_print") == 0) {
+        char* str = strtok(NULL, "");
+        ui_print("%s\n", str != NULL ? str : "");
+    } else {
+        LOGE("unknown command [%s] from %s job\n", command, job->name);
+    }
+}
+
+// Reads whatever the job has written and handles each complete line.
+// Returns 0 once the child has closed its end of the pipe.
+static int read_job_output(NandroidJob* job)
+{
+    char buf[512];
+    ssize_t len = read(job->fd, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+        return 1;
+    if (len <= 0)
+        return 0;
+
+    ssize_t i;
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\n' || job->line_len == sizeof(job->line) - 1) {
+            job->line[job->line_len] = '\0';
+            handle_job_command(job, job->line);
+            job->line_len = 0;
+        }
+        if (buf[i] != '\n')
+            job->line[job->line_len++] = buf[i];
+    }
+    return 1;
+}
+
+static void finish_job(NandroidJob* job)
+{
+    int status;
+    close(job->fd);
+    job->fd = -1;
+    if (waitpid(job->pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        job->status = -1;
+    } else {
+        job->status = WEXITSTATUS(status);
+    }
+    job->pid = -1;
+    if (job->status == 0)
+        job->progress = 1.0;
+}
+
+static float total_progress(NandroidJob* jobs, int count)
+{
+    float done = 0, total = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        done += jobs[i].progress * jobs[i].weight;
+        total += jobs[i].weight;
+    }
+    return total > 0 ? done / total : 0;
+}
+
+int nandroid_run_jobs(NandroidJob* jobs, int count, int max_jobs)
+{
+    int next = 0;
+    int running = 0;
+    int failed = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        jobs[i].pid = -1;
+        jobs[i].fd = -1;
+        jobs[i].progress = 0;
+        jobs[i].status = 0;
+        jobs[i].md5[0] = '\0';
+    }
+
+    ui_reset_progress();
+    ui_show_progress(1.0, 0);
+
+    for (;;) {
+        while (!failed && next < count && running < max_jobs) {
+            if (0 != start_job(&jobs[next])) {
+                jobs[next].status = -1;
+                failed = 1;
+                break;
+            }
+            next++;
+            running++;
+        }
+        if (running == 0)
+            break;
+
+        fd_set fds;
+        int max_fd = -1;
+        FD_ZERO(&fds);
+        for (i = 0; i < next; i++) {
+            if (jobs[i].fd >= 0) {
+                FD_SET(jobs[i].fd, &fds);
+                if (jobs[i].fd > max_fd)
+                    max_fd = jobs[i].fd;
+            }
+        }
+        if (select(max_fd + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("select failed: %s\n", strerror(errno));
+            failed = 1;
+            for (i = 0; i < next; i++) {
+                if (jobs[i].pid > 0) {
+                    kill(jobs[i].pid, SIGTERM);
+                    finish_job(&jobs[i]);
+                    running--;
+                }
+            }
+            break;
+        }
+
+        for (i = 0; i < next; i++) {
+            if (jobs[i].fd < 0 || !FD_ISSET(jobs[i].fd, &fds))
+                continue;
+            if (read_job_output(&jobs[i]))
+                continue;
+            finish_job(&jobs[i]);
+            running--;
+            if (jobs[i].status != 0 && !failed) {
+                failed = 1;
+                // No point finishing the others; the backup is unusable.
+                int j;
+                for (j = 0; j < next; j++) {
+                    if (jobs[j].pid > 0)
+                        kill(jobs[j].pid, SIGTERM);
+                }
+            }
+        }
+        ui_set_progress(total_progress(jobs, count));
+    }
+
+    return failed ? -1 : 0;
+}
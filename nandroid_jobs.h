@@ -0,0 +1,80 @@
+#ifndef NANDROID_JOBS_H
+#define NANDROID_JOBS_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dirstats.h"
+
+// mkyaffs2image, unyaffs and dump_image all keep their state in globals,
+// so independent partition backups can't share one process.  Each job
+// runs in a forked child instead, and talks to the parent over a pipe
+// using a line protocol similar to the one update-binary uses:
+//
+//    progress <frac>
+//        <frac> between 0.0 and 1.0; how far along this job is.
+//
+//    ui_print <string>
+//        display <string> on the screen.
+//
+//    md5 <hex>
+//        md5 sum of the image the job wrote.
+//
+// The parent merges the progress of all running jobs into a single
+// progress bar, weighted by each job's "weight".
+
+#define NANDROID_JOBS_FILE "/sdcard/clockworkmod/.nandroidjobs"
+#define NANDROID_DEFAULT_JOBS 2
+#define NANDROID_MAX_JOBS 8
+
+struct NandroidJob;
+typedef int (*nandroid_job_function)(struct NandroidJob* job);
+
+typedef struct NandroidJob {
+    const char* name;               // short name shown to the user
+    nandroid_job_function run;      // executed in the child process
+    const char* root;               // root path or raw partition name
+    char image[PATH_MAX];           // image file written by the job
+    int compression;                // NANDROID_COMPRESSION_* for the image
+    int incremental;                // writes a manifest and blobs
+    int umount_when_finished;
+    float weight;                   // relative share of the progress bar
+    uint64_t estimate;              // expected bytes, before compression
+    DirStats stats;                 // what is under root, if it's mounted
+
+    // Owned by the scheduler.
+    pid_t pid;
+    int fd;
+    float progress;
+    int status;
+    char md5[33];
+    char line[256];
+    int line_len;
+} NandroidJob;
+
+// Maximum number of jobs to run at once.  Defaults to
+// NANDROID_DEFAULT_JOBS, and can be overridden by writing a number
+// to NANDROID_JOBS_FILE.
+int nandroid_get_max_jobs();
+
+// Run all jobs, at most max_jobs at a time, in the order given.
+// Stops starting new jobs (and terminates running ones) after the
+// first failure.  Returns 0 if every job succeeded.
+int nandroid_run_jobs(NandroidJob* jobs, int count, int max_jobs);
+
+// Returns nonzero when called from inside a running job.
+int nandroid_job_active();
+
+// Report progress of the current job.  Outside of a job this drives
+// the progress bar directly.
+void nandroid_job_set_progress(float fraction);
+
+// Hand the md5 sum of the job's image back to the parent.
+void nandroid_job_set_md5(const char* md5_hex);
+
+// Print a message on behalf of the current job.  Outside of a job
+// this is the same as ui_print().
+void nandroid_job_print(const char* fmt, ...);
+
+#endif
@@ -0,0 +1,208 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "mtdutils/mtdutils.h"
+#include "nandroid_blobs.h"
+#include "nandroid_compress.h"
+#include "nandroid_index.h"
+#include "nandroid_io.h"
+#include "nandroid_plan.h"
+
+#define MB (1024 * 1024)
+
+// Used when the size of a raw partition can't be found out.
+#define RAW_DEFAULT_SIZE (8 * MB)
+// A manifest line is a little metadata and a path.
+#define MANIFEST_BYTES_PER_OBJECT 100
+
+// Until a backup has been measured; by codec.
+static const double default_throughput[NANDROID_CODECS] = { 4.0 * MB, 2.0 * MB, 4.0 * MB };
+static const double default_ratio[NANDROID_CODECS] = { 1.0, 0.6, 0.75 };
+
+static int codec_by_name(const char* name)
+{
+    int i;
+    for (i = 0; i < NANDROID_CODECS; i++) {
+        if (strcmp(name, nandroid_compression_name(i)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void nandroid_stats_load(NandroidStats* stats)
+{
+    memcpy(stats->throughput, default_throughput, sizeof(stats->throughput));
+    memcpy(stats->ratio, default_ratio, sizeof(stats->ratio));
+
+    FILE* f = fopen(NANDROID_STATS_FILE, "r");
+    if (f == NULL)
+        return;
+    char kind[32];
+    char name[32];
+    double value;
+    while (fscanf(f, "%31s %31s %lf", kind, name, &value) == 3) {
+        int codec = codec_by_name(name);
+        if (codec < 0 || value <= 0)
+            continue;
+        if (strcmp(kind, "throughput") == 0)
+            stats->throughput[codec] = value;
+        else if (strcmp(kind, "ratio") == 0)
+            stats->ratio[codec] = value;
+    }
+    fclose(f);
+}
+
+static void save_stats(const NandroidStats* stats)
+{
+    FILE* f = fopen(NANDROID_STATS_FILE, "w");
+    if (f == NULL)
+        return;
+    int i;
+    for (i = 0; i < NANDROID_CODECS; i++) {
+        fprintf(f, "throughput %s %.0f\n", nandroid_compression_name(i), stats->throughput[i]);
+        fprintf(f, "ratio %s %.3f\n", nandroid_compression_name(i), stats->ratio[i]);
+    }
+    fclose(f);
+}
+
+uint64_t nandroid_estimate_yaffs2(const DirStats* stats)
+{
+    // A header chunk per object, and each file's data in whole chunks;
+    // on average the last chunk of a file is half empty.
+    uint64_t chunks = dir_stats_objects(stats) + stats->bytes / NANDROID_YAFFS_CHUNK_SIZE + stats->files / 2;
+    return chunks * (NANDROID_YAFFS_CHUNK_SIZE + NANDROID_YAFFS_SPARE_SIZE);
+}
+
+uint64_t nandroid_estimate_raw(const char* partition)
+{
+    const MtdPartition* mtd;
+    size_t total_size;
+    if (mtd_scan_partitions() > 0 &&
+        (mtd = mtd_find_partition_by_name(partition)) != NULL &&
+        mtd_partition_info(mtd, &total_size, NULL, NULL) == 0)
+        return total_size;
+    return RAW_DEFAULT_SIZE;
+}
+
+// Sum of the file sizes in the last incremental backup of "name".
+static uint64_t previous_backup_bytes(const char* name)
+{
+    char last[PATH_MAX];
+    char manifest[PATH_MAX];
+    sprintf(last, "%s/%s.last", NANDROID_BLOBS_DIR, name);
+    FILE* f = fopen(last, "r");
+    if (f == NULL)
+        return 0;
+    char* record = fgets(manifest, sizeof(manifest), f);
+    fclose(f);
+    if (record == NULL)
+        return 0;
+    manifest[strcspn(manifest, "\n")] = '\0';
+
+    NandroidReader reader;
+    if (0 != nandroid_reader_open(&reader, manifest))
+        return 0;
+    uint64_t bytes = 0;
+    f = fopen(reader.path, "r");
+    if (f != NULL) {
+        char* line = NULL;
+        size_t len = 0;
+        while (nandroid_read_line(f, &line, &len) != NULL) {
+            char* fields[9];
+            if (line[0] == 'f' && nandroid_split_fields(line, fields, 9) == 0)
+                bytes += strtoull(fields[5], NULL, 10);
+        }
+        free(line);
+        fclose(f);
+    }
+    nandroid_reader_close(&reader);
+    return bytes;
+}
+
+uint64_t nandroid_estimate_incremental(const DirStats* stats, const char* name)
+{
+    // Only growth can be seen without reading the files; new chunks of
+    // files that changed in place are not counted.
+    uint64_t previous = previous_backup_bytes(name);
+    uint64_t grown = stats->bytes > previous ? stats->bytes - previous : 0;
+    return dir_stats_objects(stats) * MANIFEST_BYTES_PER_OBJECT + grown;
+}
+
+static uint64_t bytes_on_card(const NandroidJob* job, const NandroidStats* stats)
+{
+    // Blobs are stored as they are; only manifests get compressed.
+    if (job->incremental)
+        return job->estimate;
+    return (uint64_t)(job->estimate * stats->ratio[job->compression]);
+}
+
+static int compare_weights(const void* a, const void* b)
+{
+    float weight_a = ((const NandroidJob*)a)->weight;
+    float weight_b = ((const NandroidJob*)b)->weight;
+    return weight_a < weight_b ? 1 : weight_a > weight_b ? -1 : 0;
+}
+
+int nandroid_plan_backup(NandroidJob* jobs, int count, const NandroidStats* stats,
+                         uint64_t free_bytes)
+{
+    uint64_t needed = 0;
+    double seconds = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        needed += bytes_on_card(&jobs[i], stats);
+        seconds += jobs[i].estimate / stats->throughput[jobs[i].compression];
+        jobs[i].weight = (float)jobs[i].estimate / MB + 0.01;
+    }
+    qsort(jobs, count, sizeof(NandroidJob), compare_weights);
+
+    int minutes = (int)(seconds + 59) / 60;
+    ui_print("Backup needs about %lluMB and %d minute%s.\n",
+             needed / MB, minutes, minutes == 1 ? "" : "s");
+    if (needed > free_bytes) {
+        ui_print("Not enough free space on the SD card; only %lluMB free!\n", free_bytes / MB);
+        return -1;
+    }
+    if (needed > free_bytes / 10 * 9)
+        ui_print("There may not be enough free space to complete backup... continuing...\n");
+    return 0;
+}
+
+void nandroid_plan_record(NandroidStats* stats, NandroidJob* jobs, int count, double seconds)
+{
+    uint64_t estimated = 0;
+    uint64_t written = 0;
+    int i;
+    if (count == 0)
+        return;
+    for (i = 0; i < count; i++) {
+        struct stat st;
+        // What incremental jobs write can't be told apart from the blobs
+        // already there.
+        if (jobs[i].incremental)
+            return;
+        if (stat(jobs[i].image, &st) != 0)
+            return;
+        estimated += jobs[i].estimate;
+        written += st.st_size;
+    }
+    if (estimated == 0)
+        return;
+
+    // Average with what was known, so one odd backup doesn't throw the
+    // next estimate off.
+    int codec = jobs[0].compression;
+    double ratio = (double)written / estimated;
+    if (ratio > 0.05 && ratio < 2.0)
+        stats->ratio[codec] = (stats->ratio[codec] + ratio) / 2;
+    if (seconds >= 1)
+        stats->throughput[codec] = (stats->throughput[codec] + estimated / seconds) / 2;
+    save_stats(stats);
+}
@@ -0,0 +1,49 @@
+#ifndef NANDROID_PLAN_H
+#define NANDROID_PLAN_H
+
+#include <stdint.h>
+
+#include "dirstats.h"
+#include "nandroid_jobs.h"
+
+// Pre-flight planning for nandroid backups.
+//
+// Before anything is written, the size of every image is estimated,
+// the jobs are ordered largest first (so the long ones start early and
+// a backup that won't fit fails before most of it is written), and the
+// backup is refused if it clearly won't fit on the card.  How fast the
+// card is written and how well each codec compresses is measured on
+// every backup and kept in NANDROID_STATS_FILE:
+//
+//    throughput <codec> <bytes per second>
+//    ratio <codec> <image size / estimated size>
+//
+// Throughput is counted in uncompressed bytes.
+
+#define NANDROID_STATS_FILE "/sdcard/clockworkmod/.nandroidstats"
+#define NANDROID_CODECS 3
+
+typedef struct {
+    double throughput[NANDROID_CODECS];
+    double ratio[NANDROID_CODECS];
+} NandroidStats;
+
+// Loads the stats, falling back to conservative defaults.
+void nandroid_stats_load(NandroidStats* stats);
+
+// Uncompressed size of the images, to be stored in NandroidJob.estimate.
+uint64_t nandroid_estimate_yaffs2(const DirStats* stats);
+uint64_t nandroid_estimate_raw(const char* partition);
+// What an incremental backup of partition "name" will add to the card.
+uint64_t nandroid_estimate_incremental(const DirStats* stats, const char* name);
+
+// Orders the jobs largest first, weights their progress by size, and
+// prints the expected size and duration.  Returns 0 if the backup
+// should fit in "free_bytes".
+int nandroid_plan_backup(NandroidJob* jobs, int count, const NandroidStats* stats,
+                         uint64_t free_bytes);
+
+// Learns from a finished backup that took "seconds", and saves the stats.
+void nandroid_plan_record(NandroidStats* stats, NandroidJob* jobs, int count, double seconds);
+
+#endif
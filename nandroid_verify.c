@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nandroid_verify.h"
+
+#define VERIFY_BUFFER_SIZE (64 * 1024)
+
+// Hashes one image.  Gives up as soon as anything else has failed.
+static int check_image(NandroidVerifier* v, NandroidVerifyEntry* e, unsigned char* buf)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", v->backup_path, e->name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NANDROID_VERIFY_FAILED;
+
+    MD5_CTX md5;
+    MD5_init(&md5);
+    for (;;) {
+        if (v->failed || v->cancel) {
+            close(fd);
+            return NANDROID_VERIFY_FAILED;
+        }
+        ssize_t len = read(fd, buf, VERIFY_BUFFER_SIZE);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0) {
+            close(fd);
+            return NANDROID_VERIFY_FAILED;
+        }
+        if (len == 0)
+            break;
+        MD5_update(&md5, buf, len);
+    }
+    close(fd);
+
+    char actual[2 * MD5_DIGEST_SIZE + 1];
+    MD5_hex(MD5_final(&md5), actual);
+    return strcmp(actual, e->md5) == 0 ? NANDROID_VERIFY_OK : NANDROID_VERIFY_FAILED;
+}
+
+static void* verify_thread(void* cookie)
+{
+    NandroidVerifier* v = (NandroidVerifier*)cookie;
+    unsigned char* buf = malloc(VERIFY_BUFFER_SIZE);
+
+    for (;;) {
+        NandroidVerifyEntry* e = NULL;
+        int i;
+        pthread_mutex_lock(&v->lock);
+        for (i = 0; i < v->count && !v->failed && !v->cancel; i++) {
+            if (!v->entries[i].claimed) {
+                e = &v->entries[i];
+                e->claimed = 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (e == NULL)
+            break;
+
+        int status = buf != NULL ? check_image(v, e, buf) : NANDROID_VERIFY_FAILED;
+
+        pthread_mutex_lock(&v->lock);
+        e->status = status;
+        if (status != NANDROID_VERIFY_OK && !v->cancel)
+            v->failed = 1;
+        pthread_cond_broadcast(&v->done);
+        pthread_mutex_unlock(&v->lock);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+// Reads the entries of nandroid.md5 that are in "images", in that order.
+static int load_md5_file(NandroidVerifier* v, const char** images)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/nandroid.md5", v->backup_path);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    int max = 0;
+    while (images[max] != NULL)
+        max++;
+    v->entries = calloc(max > 0 ? max : 1, sizeof(NandroidVerifyEntry));
+    NandroidVerifyEntry* listed = calloc(max > 0 ? max : 1, sizeof(NandroidVerifyEntry));
+    if (v->entries == NULL || listed == NULL) {
+        free(listed);
+        fclose(f);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // "<md5>  <name>", as md5sum writes it.
+        NandroidVerifyEntry e;
+        memset(&e, 0, sizeof(e));
+        if (sscanf(line, "%32s %63s", e.md5, e.name) != 2)
+            continue;
+        int i;
+        for (i = 0; i < max; i++) {
+            if (strcmp(images[i], e.name) == 0)
+                listed[i] = e;
+        }
+    }
+    fclose(f);
+
+    int i;
+    for (i = 0; i < max; i++) {
+        if (listed[i].name[0] != '\0')
+            v->entries[v->count++] = listed[i];
+    }
+    free(listed);
+    return 0;
+}
+
+int nandroid_verify_start(NandroidVerifier* v, const char* backup_path, const char** images)
+{
+    memset(v, 0, sizeof(*v));
+    strlcpy(v->backup_path, backup_path, sizeof(v->backup_path));
+    if (0 != load_md5_file(v, images))
+        return -1;
+
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_cond_init(&v->done, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 1 ? cpus : 1;
+    if (threads > NANDROID_VERIFY_MAX_THREADS)
+        threads = NANDROID_VERIFY_MAX_THREADS;
+    if (threads > v->count)
+        threads = v->count;
+    for (v->thread_count = 0; v->thread_count < threads; v->thread_count++) {
+        if (pthread_create(&v->threads[v->thread_count], NULL, verify_thread, v) != 0)
+            break;
+    }
+    if (v->thread_count == 0 && v->count > 0) {
+        nandroid_verify_finish(v);
+        return -1;
+    }
+    return 0;
+}
+
+int nandroid_verify_wait(NandroidVerifier* v, const char* image)
+{
+    int i;
+    int ret = 0;
+    pthread_mutex_lock(&v->lock);
+    for (i = 0; i < v->count; i++) {
+        if (strcmp(v->entries[i].name, image) == 0) {
+            while (v->entries[i].status == NANDROID_VERIFY_PENDING && !v->failed)
+                pthread_cond_wait(&v->done, &v->lock);
+            if (v->entries[i].status != NANDROID_VERIFY_OK)
+                ret = -1;
+            break;
+        }
+    }
+    if (v->failed)
+        ret = -1;
+    pthread_mutex_unlock(&v->lock);
+    return ret;
+}
+
+void nandroid_verify_finish(NandroidVerifier* v)
+{
+    int i;
+    pthread_mutex_lock(&v->lock);
+    v->cancel = 1;
+    pthread_mutex_unlock(&v->lock);
+    for (i = 0; i < v->thread_count; i++)
+        pthread_join(v->threads[i], NULL);
+    pthread_cond_destroy(&v->done);
+    pthread_mutex_destroy(&v->lock);
+    free(v->entries);
+    v->entries = NULL;
+    v->count = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef NANDROID_VERIFY_H
+#define NANDROID_VERIFY_H
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "md5.h"
+
+// Checks the images of a backup against nandroid.md5 on several threads
+// while the restore runs.  The images are hashed in the order they will
+// be restored, so by the time a partition is formatted its image has
+// usually been checked already, and the next one is being checked while
+// it is written.
+
+#define NANDROID_VERIFY_PENDING 0
+#define NANDROID_VERIFY_OK 1
+#define NANDROID_VERIFY_FAILED 2
+
+#define NANDROID_VERIFY_MAX_THREADS 4
+
+typedef struct {
+    char name[64];                  // as listed in nandroid.md5
+    char md5[2 * MD5_DIGEST_SIZE + 1];
+    int claimed;
+    int status;
+} NandroidVerifyEntry;
+
+typedef struct {
+    char backup_path[PATH_MAX];
+    NandroidVerifyEntry* entries;
+    int count;
+    int failed;                     // set on the first mismatch
+    int cancel;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    pthread_t threads[NANDROID_VERIFY_MAX_THREADS];
+    int thread_count;
+} NandroidVerifier;
+
+// Reads nandroid.md5 from "backup_path" and starts hashing the images
+// named in "images" (a NULL terminated list, in restore order).  Images
+// that nandroid.md5 doesn't list are not checked.  Returns 0 on success.
+int nandroid_verify_start(NandroidVerifier* v, const char* backup_path, const char** images);
+
+// Waits for "image" to be checked.  Returns 0 if it matched, and -1 if
+// it, or any other image, didn't.
+int nandroid_verify_wait(NandroidVerifier* v, const char* image);
+
+// Stops hashing and frees everything.
+void nandroid_verify_finish(NandroidVerifier* v);
+
+#endif
@@ -0,0 +1,369 @@
+// SHA-1 message digest, as described in FIPS 180-4.
+
+#include <string.h>
+
+#include "sha1.h"
+
+#if defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#define SHA1_ARMV8_CE
+#elif (defined(__i386__) || defined(__x86_64__)) && (defined(__clang__) || __GNUC__ >= 5)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_X86_SHA
+#endif
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define K0 0x5a827999
+#define K1 0x6ed9eba1
+#define K2 0x8f1bbcdc
+#define K3 0xca62c1d6
+
+static void sha1_blocks_c(uint32_t state[5], const uint8_t* p, size_t blocks)
+{
+    while (blocks--) {
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t w[80];
+        int i;
+
+        for (i = 0; i < 16; i++, p += 4)
+            w[i] = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        for (; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        for (i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = d ^ (b & (c ^ d));
+                k = K0;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = K1;
+            } else if (i < 60) {
+                f = (b & c) | (d & (b | c));
+                k = K2;
+            } else {
+                f = b ^ c ^ d;
+                k = K3;
+            }
+            uint32_t t = ROL(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ROL(b, 30);
+            b = a;
+            a = t;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_ARMV8_CE
+// Four rounds with op (vsha1cq_u32, vsha1pq_u32 or vsha1mq_u32), taking
+// e from "e_in" and leaving the next one in "e_out".
+#define CE_ROUNDS(op, e_in, e_out, tmp) \
+    e_out = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+    abcd = op(abcd, e_in, tmp);
+
+static uint32x4_t ce_load(const uint8_t* p)
+{
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+static void sha1_blocks_armv8(uint32_t state[5], const uint8_t* p, size_t blocks)
+{
+    const uint32x4_t k0 = vdupq_n_u32(K0);
+    const uint32x4_t k1 = vdupq_n_u32(K1);
+    const uint32x4_t k2 = vdupq_n_u32(K2);
+    const uint32x4_t k3 = vdupq_n_u32(K3);
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+    uint32_t e1;
+
+    while (blocks--) {
+        uint32x4_t abcd_saved = abcd;
+        uint32_t e0_saved = e0;
+        uint32x4_t m0 = ce_load(p);
+        uint32x4_t m1 = ce_load(p + 16);
+        uint32x4_t m2 = ce_load(p + 32);
+        uint32x4_t m3 = ce_load(p + 48);
+        uint32x4_t t0 = vaddq_u32(m0, k0);
+        uint32x4_t t1 = vaddq_u32(m1, k0);
+        p += 64;
+
+        // Each group of four rounds uses the message words from the
+        // group before last, and works out those for four groups on.
+        CE_ROUNDS(vsha1cq_u32, e0, e1, t0);     // 0-3
+        t0 = vaddq_u32(m2, k0);
+        m0 = vsha1su0q_u32(m0, m1, m2);
+        CE_ROUNDS(vsha1cq_u32, e1, e0, t1);     // 4-7
+        t1 = vaddq_u32(m3, k0);
+        m0 = vsha1su1q_u32(m0, m3);
+        m1 = vsha1su0q_u32(m1, m2, m3);
+        CE_ROUNDS(vsha1cq_u32, e0, e1, t0);     // 8-11
+        t0 = vaddq_u32(m0, k0);
+        m1 = vsha1su1q_u32(m1, m0);
+        m2 = vsha1su0q_u32(m2, m3, m0);
+        CE_ROUNDS(vsha1cq_u32, e1, e0, t1);     // 12-15
+        t1 = vaddq_u32(m1, k1);
+        m2 = vsha1su1q_u32(m2, m1);
+        m3 = vsha1su0q_u32(m3, m0, m1);
+        CE_ROUNDS(vsha1cq_u32, e0, e1, t0);     // 16-19
+        t0 = vaddq_u32(m2, k1);
+        m3 = vsha1su1q_u32(m3, m2);
+        m0 = vsha1su0q_u32(m0, m1, m2);
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 20-23
+        t1 = vaddq_u32(m3, k1);
+        m0 = vsha1su1q_u32(m0, m3);
+        m1 = vsha1su0q_u32(m1, m2, m3);
+        CE_ROUNDS(vsha1pq_u32, e0, e1, t0);     // 24-27
+        t0 = vaddq_u32(m0, k1);
+        m1 = vsha1su1q_u32(m1, m0);
+        m2 = vsha1su0q_u32(m2, m3, m0);
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 28-31
+        t1 = vaddq_u32(m1, k1);
+        m2 = vsha1su1q_u32(m2, m1);
+        m3 = vsha1su0q_u32(m3, m0, m1);
+        CE_ROUNDS(vsha1pq_u32, e0, e1, t0);     // 32-35
+        t0 = vaddq_u32(m2, k2);
+        m3 = vsha1su1q_u32(m3, m2);
+        m0 = vsha1su0q_u32(m0, m1, m2);
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 36-39
+        t1 = vaddq_u32(m3, k2);
+        m0 = vsha1su1q_u32(m0, m3);
+        m1 = vsha1su0q_u32(m1, m2, m3);
+        CE_ROUNDS(vsha1mq_u32, e0, e1, t0);     // 40-43
+        t0 = vaddq_u32(m0, k2);
+        m1 = vsha1su1q_u32(m1, m0);
+        m2 = vsha1su0q_u32(m2, m3, m0);
+        CE_ROUNDS(vsha1mq_u32, e1, e0, t1);     // 44-47
+        t1 = vaddq_u32(m1, k2);
+        m2 = vsha1su1q_u32(m2, m1);
+        m3 = vsha1su0q_u32(m3, m0, m1);
+        CE_ROUNDS(vsha1mq_u32, e0, e1, t0);     // 48-51
+        t0 = vaddq_u32(m2, k2);
+        m3 = vsha1su1q_u32(m3, m2);
+        m0 = vsha1su0q_u32(m0, m1, m2);
+        CE_ROUNDS(vsha1mq_u32, e1, e0, t1);     // 52-55
+        t1 = vaddq_u32(m3, k3);
+        m0 = vsha1su1q_u32(m0, m3);
+        m1 = vsha1su0q_u32(m1, m2, m3);
+        CE_ROUNDS(vsha1mq_u32, e0, e1, t0);     // 56-59
+        t0 = vaddq_u32(m0, k3);
+        m1 = vsha1su1q_u32(m1, m0);
+        m2 = vsha1su0q_u32(m2, m3, m0);
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 60-63
+        t1 = vaddq_u32(m1, k3);
+        m2 = vsha1su1q_u32(m2, m1);
+        m3 = vsha1su0q_u32(m3, m0, m1);
+        CE_ROUNDS(vsha1pq_u32, e0, e1, t0);     // 64-67
+        t0 = vaddq_u32(m2, k3);
+        m3 = vsha1su1q_u32(m3, m2);
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 68-71
+        t1 = vaddq_u32(m3, k3);
+        CE_ROUNDS(vsha1pq_u32, e0, e1, t0);     // 72-75
+        CE_ROUNDS(vsha1pq_u32, e1, e0, t1);     // 76-79
+
+        e0 += e0_saved;
+        abcd = vaddq_u32(abcd, abcd_saved);
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+#endif
+
+#ifdef SHA1_X86_SHA
+// Four rounds with function "f" (0-3), after adding the message words
+// "m" to e; the state before them is kept in "e_save" for the next group.
+#define SHA_ROUNDS(f, e, e_save, m) \
+    e = _mm_sha1nexte_epu32(e, m); \
+    e_save = abcd; \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, f);
+
+// Work out the message words four groups on from those in "m".
+#define SHA_SCHEDULE(m, next, after, last) \
+    next = _mm_sha1msg2_epu32(next, m); \
+    last = _mm_sha1msg1_epu32(last, m); \
+    after = _mm_xor_si128(after, m);
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1_blocks_x86(uint32_t state[5], const uint8_t* p, size_t blocks)
+{
+    const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1b);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1;
+
+    while (blocks--) {
+        __m128i abcd_saved = abcd;
+        __m128i e0_saved = e0;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), swap);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), swap);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), swap);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), swap);
+        p += 64;
+
+        e0 = _mm_add_epi32(e0, m0);                     // 0-3
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        SHA_ROUNDS(0, e1, e0, m1);                      // 4-7
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+        SHA_ROUNDS(0, e0, e1, m2);                      // 8-11
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+        SHA_ROUNDS(0, e1, e0, m3);                      // 12-15
+        SHA_SCHEDULE(m3, m0, m1, m2);
+        SHA_ROUNDS(0, e0, e1, m0);                      // 16-19
+        SHA_SCHEDULE(m0, m1, m2, m3);
+        SHA_ROUNDS(1, e1, e0, m1);                      // 20-23
+        SHA_SCHEDULE(m1, m2, m3, m0);
+        SHA_ROUNDS(1, e0, e1, m2);                      // 24-27
+        SHA_SCHEDULE(m2, m3, m0, m1);
+        SHA_ROUNDS(1, e1, e0, m3);                      // 28-31
+        SHA_SCHEDULE(m3, m0, m1, m2);
+        SHA_ROUNDS(1, e0, e1, m0);                      // 32-35
+        SHA_SCHEDULE(m0, m1, m2, m3);
+        SHA_ROUNDS(1, e1, e0, m1);                      // 36-39
+        SHA_SCHEDULE(m1, m2, m3, m0);
+        SHA_ROUNDS(2, e0, e1, m2);                      // 40-43
+        SHA_SCHEDULE(m2, m3, m0, m1);
+        SHA_ROUNDS(2, e1, e0, m3);                      // 44-47
+        SHA_SCHEDULE(m3, m0, m1, m2);
+        SHA_ROUNDS(2, e0, e1, m0);                      // 48-51
+        SHA_SCHEDULE(m0, m1, m2, m3);
+        SHA_ROUNDS(2, e1, e0, m1);                      // 52-55
+        SHA_SCHEDULE(m1, m2, m3, m0);
+        SHA_ROUNDS(2, e0, e1, m2);                      // 56-59
+        SHA_SCHEDULE(m2, m3, m0, m1);
+        SHA_ROUNDS(3, e1, e0, m3);                      // 60-63
+        SHA_SCHEDULE(m3, m0, m1, m2);
+        SHA_ROUNDS(3, e0, e1, m0);                      // 64-67
+        SHA_SCHEDULE(m0, m1, m2, m3);
+        SHA_ROUNDS(3, e1, e0, m1);                      // 68-71
+        m2 = _mm_sha1msg2_epu32(m2, m1);
+        m3 = _mm_xor_si128(m3, m1);
+        SHA_ROUNDS(3, e0, e1, m2);                      // 72-75
+        m3 = _mm_sha1msg2_epu32(m3, m2);
+        SHA_ROUNDS(3, e1, e0, m3);                      // 76-79
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_saved);
+        abcd = _mm_add_epi32(abcd, abcd_saved);
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static int x86_has_sha(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;      // SHA
+}
+#endif
+
+static SHA1_blocks_fn best_blocks(void)
+{
+#if defined(SHA1_ARMV8_CE)
+    return sha1_blocks_armv8;
+#elif defined(SHA1_X86_SHA)
+    static SHA1_blocks_fn blocks;
+    if (blocks == NULL)
+        blocks = x86_has_sha() ? sha1_blocks_x86 : sha1_blocks_c;
+    return blocks;
+#else
+    return sha1_blocks_c;
+#endif
+}
+
+void SHA1_init_portable(SHA1_CTX* ctx)
+{
+    ctx->count = 0;
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xc3d2e1f0;
+    ctx->blocks = sha1_blocks_c;
+}
+
+void SHA1_init(SHA1_CTX* ctx)
+{
+    SHA1_init_portable(ctx);
+    ctx->blocks = best_blocks();
+}
+
+void SHA1_update(SHA1_CTX* ctx, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    size_t used = (size_t)(ctx->count & 63);
+
+    ctx->count += len;
+
+    if (used) {
+        size_t fill = 64 - used;
+        if (len < fill) {
+            memcpy(ctx->buf + used, p, len);
+            return;
+        }
+        memcpy(ctx->buf + used, p, fill);
+        ctx->blocks(ctx->state, ctx->buf, 1);
+        p += fill;
+        len -= fill;
+    }
+
+    // Whole blocks go straight from the caller's buffer.
+    ctx->blocks(ctx->state, p, len / 64);
+    p += len & ~(size_t)63;
+    memcpy(ctx->buf, p, len & 63);
+}
+
+const uint8_t* SHA1_final(SHA1_CTX* ctx)
+{
+    static const uint8_t pad[64] = { 0x80 };
+    uint64_t bits = ctx->count << 3;
+    uint8_t length[8];
+    int used = (int)(ctx->count & 63);
+    int i;
+
+    for (i = 0; i < 8; i++)
+        length[i] = (uint8_t)(bits >> (56 - 8 * i));
+
+    SHA1_update(ctx, pad, used < 56 ? 56 - used : 120 - used);
+    SHA1_update(ctx, length, 8);
+
+    for (i = 0; i < 5; i++) {
+        ctx->digest[4 * i + 0] = (uint8_t)(ctx->state[i] >> 24);
+        ctx->digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+        ctx->digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+        ctx->digest[4 * i + 3] = (uint8_t)(ctx->state[i]);
+    }
+    return ctx->digest;
+}
+
+const char* SHA1_kernel_name(const SHA1_CTX* ctx)
+{
+#ifdef SHA1_ARMV8_CE
+    if (ctx->blocks == sha1_blocks_armv8)
+        return "armv8-ce";
+#endif
+#ifdef SHA1_X86_SHA
+    if (ctx->blocks == sha1_blocks_x86)
+        return "x86-sha";
+#endif
+    return "c";
+}
@@ -0,0 +1,32 @@
+#ifndef RECOVERY_SHA1_H
+#define RECOVERY_SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_SIZE 20
+
+// Hashes "blocks" 64-byte blocks into "state".
+typedef void (*SHA1_blocks_fn)(uint32_t state[5], const uint8_t* p, size_t blocks);
+
+// SHA-1 for hashing whole packages.  Blocks are hashed with the ARMv8
+// crypto extensions (when built with BOARD_HAS_ARMV8_CRYPTO) or the x86
+// SHA instructions (when the CPU has them), and in C otherwise.
+typedef struct SHA1_CTX {
+    uint64_t count;
+    uint32_t state[5];
+    uint8_t buf[64];
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    SHA1_blocks_fn blocks;
+} SHA1_CTX;
+
+void SHA1_init(SHA1_CTX* ctx);
+// Like SHA1_init, but always hashes in C; to compare against.
+void SHA1_init_portable(SHA1_CTX* ctx);
+void SHA1_update(SHA1_CTX* ctx, const void* data, size_t len);
+const uint8_t* SHA1_final(SHA1_CTX* ctx);
+
+// What "ctx" hashes blocks with: "armv8-ce", "x86-sha" or "c".
+const char* SHA1_kernel_name(const SHA1_CTX* ctx);
+
+#endif
@@ -48,6 +48,10 @@ static int gShowBackButton = 0;
 #define PROGRESSBAR_INDETERMINATE_STATES 6
 #define PROGRESSBAR_INDETERMINATE_FPS 15
 
+// Log text and progress bar updates redraw the screen at most this often;
+// anything in between is drawn by progress_thread().
+#define UPDATE_MAX_FPS 15
+
 static pthread_mutex_t gUpdateMutex = PTHREAD_MUTEX_INITIALIZER;
 static gr_surface gBackgroundIcon[NUM_BACKGROUND_ICONS];
 static gr_surface gProgressBarIndeterminate[PROGRESSBAR_INDETERMINATE_STATES];
@@ -84,6 +88,14 @@ static time_t gProgressScopeTime, gProgressScopeDuration;
 // Set to 1 when both graphics pages are the same (except for the progress bar)
 static int gPagesIdentical = 0;
 
+// What a throttled update left undrawn, and when the screen was last flipped
+static enum UpdatePending {
+    UPDATE_PENDING_NONE,
+    UPDATE_PENDING_PROGRESS,
+    UPDATE_PENDING_SCREEN,
+} gUpdatePending = UPDATE_PENDING_NONE;
+static long long gLastUpdateTime = 0;
+
 // Log text overlay, displayed when a magic key is pressed
 static char text[MAX_ROWS][MAX_COLS];
 static int text_cols = 0, text_rows = 0;
@@ -224,11 +236,20 @@ static void draw_screen_locked(void)
     }
 }
 
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 // Redraw everything on the screen and flip the screen (make it visible).
 // Should only be called with gUpdateMutex locked.
 static void update_screen_locked(void)
 {
     if (!ui_has_initialized) return;
+    gUpdatePending = UPDATE_PENDING_NONE;
+    gLastUpdateTime = now_ms();
     draw_screen_locked();
     //As FB can't informed in Spica, we should fill it's buffer to flip
 	gr_flip();
@@ -240,6 +261,8 @@ static void update_screen_locked(void)
 static void update_progress_locked(void)
 {
     if (!ui_has_initialized) return;
+    if (gUpdatePending == UPDATE_PENDING_PROGRESS) gUpdatePending = UPDATE_PENDING_NONE;
+    gLastUpdateTime = now_ms();
     if (show_text || !gPagesIdentical) {
         draw_screen_locked();    // Must redraw the whole screen
         gPagesIdentical = 1;
@@ -251,6 +274,16 @@ static void update_progress_locked(void)
 	gr_flip();
 }
 
+// Returns 1 if the screen was flipped too recently to do it again now, in
+// which case "pending" is left for progress_thread() to draw.
+// Should only be called with gUpdateMutex locked.
+static int throttle_update_locked(enum UpdatePending pending)
+{
+    if (now_ms() - gLastUpdateTime >= 1000 / UPDATE_MAX_FPS) return 0;
+    if (pending > gUpdatePending) gUpdatePending = pending;
+    return 1;
+}
+
 // Keeps the progress bar updated, even when the process is otherwise busy.
 static void *progress_thread(void *cookie)
 {
@@ -276,6 +309,13 @@ static void *progress_thread(void *cookie)
             }
         }
 
+        // draw whatever was held back by throttle_update_locked()
+        if (gUpdatePending == UPDATE_PENDING_SCREEN) {
+            update_screen_locked();
+        } else if (gUpdatePending == UPDATE_PENDING_PROGRESS) {
+            update_progress_locked();
+        }
+
         pthread_mutex_unlock(&gUpdateMutex);
     }
     return NULL;
@@ -440,7 +480,7 @@ void ui_set_progress(float fraction)
         float scale = width * gProgressScopeSize;
         if ((int) (gProgress * scale) != (int) (fraction * scale)) {
             gProgress = fraction;
-            update_progress_locked();
+            if (!throttle_update_locked(UPDATE_PENDING_PROGRESS)) update_progress_locked();
         }
     }
     pthread_mutex_unlock(&gUpdateMutex);
@@ -481,7 +521,7 @@ void ui_print(const char *fmt, ...)
             if (*ptr != '\n') text[text_row][text_col++] = *ptr;
         }
         text[text_row][text_col] = '\0';
-        update_screen_locked();
+        if (!throttle_update_locked(UPDATE_PENDING_SCREEN)) update_screen_locked();
     }
     pthread_mutex_unlock(&gUpdateMutex);
 }
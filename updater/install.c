@@ -17,6 +17,8 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -373,14 +375,16 @@ Value* PackageExtractFileFn(const char* name, State* state,
             goto done2;
         }
 
-        FILE* f = fopen(dest_path, "wb");
-        if (f == NULL) {
+        // O_LARGEFILE, so that entries over 2GB can be extracted.
+        int fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
+                      0666);
+        if (fd < 0) {
             fprintf(stderr, "%s: can't open %s for write: %s\n",
                     name, dest_path, strerror(errno));
             goto done2;
         }
-        success = mzExtractZipEntryToFile(za, entry, fileno(f));
-        fclose(f);
+        success = mzExtractZipEntryToFile(za, entry, fd);
+        close(fd);
 
       done2:
         free(zip_path);
@@ -405,6 +409,11 @@ Value* PackageExtractFileFn(const char* name, State* state,
             goto done1;
         }
 
+        if (mzGetZipEntryUncompLen(entry) > SSIZE_MAX) {
+            fprintf(stderr, "%s: %s is too big to read into memory\n",
+                    name, zip_path);
+            goto done1;
+        }
         v->size = mzGetZipEntryUncompLen(entry);
         v->data = malloc(v->size);
         if (v->data == NULL) {
@@ -78,12 +78,12 @@ int main(int argc, char** argv) {
         return 4;
     }
 
-    char* script = malloc(script_entry->uncompLen+1);
-    if (!mzReadZipEntry(&za, script_entry, script, script_entry->uncompLen)) {
+    char* script = malloc(mzGetZipEntryUncompLen(script_entry)+1);
+    if (!mzReadZipEntry(&za, script_entry, script, mzGetZipEntryUncompLen(script_entry))) {
         fprintf(stderr, "failed to read script from package\n");
         return 5;
     }
-    script[script_entry->uncompLen] = '\0';
+    script[mzGetZipEntryUncompLen(script_entry)] = '\0';
 
     // Configure edify's functions.
 
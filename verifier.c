@@ -15,14 +15,102 @@
  */
 
 #include "common.h"
+#include "keystore.h"
+#include "sha1.h"
 #include "verifier.h"
 
 #include "mincrypt/rsa.h"
-#include "mincrypt/sha.h"
 
-#include <string.h>
-#include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FOOTER_SIZE 6
+#define EOCD_HEADER_SIZE 22
+
+// The signed data is hashed straight from mappings of this size, or if
+// the file can't be mapped (or is past what an off_t reaches), through
+// a buffer of HASH_CHUNK_SIZE.  Progress is updated once per chunk.
+#define HASH_WINDOW_SIZE (64 * 1024 * 1024)
+#define HASH_CHUNK_SIZE (1024 * 1024)
+
+static int read_fully(int fd, void* buf, size_t len, off64_t offset) {
+    return pread64(fd, buf, len, offset) == (ssize_t)len ? 0 : -1;
+}
+
+// Index of the key that the archive comment names with "key=<id>", or 0
+// if it names none of them.
+static unsigned int hinted_key(const unsigned char* comment, int len,
+                               const RSAPublicKey *pKeys, unsigned int numKeys) {
+    int i;
+    for (i = 0; i + 20 <= len; ++i) {
+        if (memcmp(comment + i, "key=", 4) != 0) continue;
+        char hex[17];
+        char* end;
+        memcpy(hex, comment + i + 4, 16);
+        hex[16] = '\0';
+        uint64_t id = strtoull(hex, &end, 16);
+        if (end != hex + 16) continue;
+        unsigned int k;
+        for (k = 0; k < numKeys; ++k) {
+            if (keystore_key_id(pKeys + k) == id) return k;
+        }
+    }
+    return 0;
+}
+
+// Hash the first "len" bytes of "fd".
+static int hash_file(int fd, off64_t len, SHA1_CTX* ctx) {
+    unsigned char* buffer = NULL;
+    off64_t pos = 0;
+
+    while (pos < len) {
+        size_t window = len - pos < HASH_WINDOW_SIZE ? len - pos : HASH_WINDOW_SIZE;
+        unsigned char* map = NULL;
+        if (buffer == NULL && (off_t)(pos + window) == pos + window) {
+            map = mmap(NULL, window, PROT_READ, MAP_PRIVATE, fd, pos);
+            if (map == MAP_FAILED) {
+                map = NULL;
+            } else {
+                madvise(map, window, MADV_SEQUENTIAL);
+            }
+        }
+        if (map == NULL && buffer == NULL) {
+            buffer = malloc(HASH_CHUNK_SIZE);
+            if (buffer == NULL) {
+                LOGE("failed to alloc memory for sha1 buffer\n");
+                return -1;
+            }
+        }
+
+        size_t done = 0;
+        while (done < window) {
+            size_t size = window - done < HASH_CHUNK_SIZE ? window - done : HASH_CHUNK_SIZE;
+            if (map != NULL) {
+                SHA1_update(ctx, map + done, size);
+            } else if (read_fully(fd, buffer, size, pos + done) == 0) {
+                SHA1_update(ctx, buffer, size);
+            } else {
+                LOGE("failed to read data (%s)\n", strerror(errno));
+                free(buffer);
+                return -1;
+            }
+            done += size;
+            ui_set_progress((pos + done) / (double)len);
+        }
+        if (map != NULL) {
+            munmap(map, window);
+        }
+        pos += window;
+    }
+    free(buffer);
+    return 0;
+}
 
 // Look for an RSA signature embedded in the .ZIP file comment given
 // the path to the zip.  Verify it matches one of the given public
@@ -32,13 +120,20 @@
 // or no key matches the signature).
 
 int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys) {
+    int key;
+    return verify_file_key(path, pKeys, numKeys, &key);
+}
+
+int verify_file_key(const char* path, const RSAPublicKey *pKeys,
+                    unsigned int numKeys, int* key) {
     ui_set_progress(0.0);
 
-    FILE* f = fopen(path, "rb");
-    if (f == NULL) {
+    int fd = open(path, O_RDONLY | O_LARGEFILE);
+    if (fd < 0) {
         LOGE("failed to open %s (%s)\n", path, strerror(errno));
         return VERIFY_FAILURE;
     }
+    off64_t file_size = lseek64(fd, 0, SEEK_END);
 
     // An archive with a whole-file signature will end in six bytes:
     //
@@ -49,23 +144,16 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     // us how far back from the end we have to start reading to find
     // the whole comment.
 
-#define FOOTER_SIZE 6
-
-    if (fseek(f, -FOOTER_SIZE, SEEK_END) != 0) {
-        LOGE("failed to seek in %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
-
     unsigned char footer[FOOTER_SIZE];
-    if (fread(footer, 1, FOOTER_SIZE, f) != FOOTER_SIZE) {
+    if (file_size < FOOTER_SIZE ||
+        read_fully(fd, footer, FOOTER_SIZE, file_size - FOOTER_SIZE) != 0) {
         LOGE("failed to read footer from %s (%s)\n", path, strerror(errno));
-        fclose(f);
+        close(fd);
         return VERIFY_FAILURE;
     }
 
     if (footer[2] != 0xff || footer[3] != 0xff) {
-        fclose(f);
+        close(fd);
         return VERIFY_FAILURE;
     }
 
@@ -77,19 +165,16 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     if (signature_start - FOOTER_SIZE < RSANUMBYTES) {
         // "signature" block isn't big enough to contain an RSA block.
         LOGE("signature is too short\n");
-        fclose(f);
+        close(fd);
         return VERIFY_FAILURE;
     }
 
-#define EOCD_HEADER_SIZE 22
-
     // The end-of-central-directory record is 22 bytes plus any
     // comment length.
     size_t eocd_size = comment_size + EOCD_HEADER_SIZE;
-
-    if (fseek(f, -eocd_size, SEEK_END) != 0) {
-        LOGE("failed to seek in %s (%s)\n", path, strerror(errno));
-        fclose(f);
+    if (file_size < (off64_t)eocd_size) {
+        LOGE("%s is too short to have a signature\n", path);
+        close(fd);
         return VERIFY_FAILURE;
     }
 
@@ -97,18 +182,17 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     // This is everything except the signature data and length, which
     // includes all of the EOCD except for the comment length field (2
     // bytes) and the comment data.
-    size_t signed_len = ftell(f) + EOCD_HEADER_SIZE - 2;
+    off64_t signed_len = file_size - eocd_size + EOCD_HEADER_SIZE - 2;
 
     unsigned char* eocd = malloc(eocd_size);
     if (eocd == NULL) {
         LOGE("malloc for EOCD record failed\n");
-        fclose(f);
+        close(fd);
         return VERIFY_FAILURE;
     }
-    if (fread(eocd, 1, eocd_size, f) != eocd_size) {
+    if (read_fully(fd, eocd, eocd_size, file_size - eocd_size) != 0) {
         LOGE("failed to read eocd from %s (%s)\n", path, strerror(errno));
-        fclose(f);
-        return VERIFY_FAILURE;
+        goto fail;
     }
 
     // If this is really is the EOCD record, it will begin with the
@@ -116,11 +200,10 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     if (eocd[0] != 0x50 || eocd[1] != 0x4b ||
         eocd[2] != 0x05 || eocd[3] != 0x06) {
         LOGE("signature length doesn't match EOCD marker\n");
-        fclose(f);
-        return VERIFY_FAILURE;
+        goto fail;
     }
 
-    int i;
+    size_t i;
     for (i = 4; i < eocd_size-3; ++i) {
         if (eocd[i  ] == 0x50 && eocd[i+1] == 0x4b &&
             eocd[i+2] == 0x05 && eocd[i+3] == 0x06) {
@@ -129,56 +212,70 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
             // which could be exploitable.  Fail verification if
             // this sequence occurs anywhere after the real one.
             LOGE("EOCD marker occurs after start of EOCD\n");
-            fclose(f);
-            return VERIFY_FAILURE;
+            goto fail;
         }
     }
 
-#define BUFFER_SIZE 4096
-
-    SHA_CTX ctx;
-    SHA_init(&ctx);
-    unsigned char* buffer = malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        LOGE("failed to alloc memory for sha1 buffer\n");
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
-
-    double frac = -1.0;
-    size_t so_far = 0;
-    fseek(f, 0, SEEK_SET);
-    while (so_far < signed_len) {
-        int size = BUFFER_SIZE;
-        if (signed_len - so_far < size) size = signed_len - so_far;
-        if (fread(buffer, 1, size, f) != size) {
-            LOGE("failed to read data from %s (%s)\n", path, strerror(errno));
-            fclose(f);
-            return VERIFY_FAILURE;
-        }
-        SHA_update(&ctx, buffer, size);
-        so_far += size;
-        double f = so_far / (double)signed_len;
-        if (f > frac + 0.02 || size == so_far) {
-            ui_set_progress(f);
-            frac = f;
-        }
+    SHA1_CTX ctx;
+    SHA1_init(&ctx);
+    if (hash_file(fd, signed_len, &ctx) != 0) {
+        LOGE("failed to hash %s\n", path);
+        goto fail;
     }
-    fclose(f);
-    free(buffer);
+    close(fd);
+    fd = -1;
 
-    const uint8_t* sha1 = SHA_final(&ctx);
+    const uint8_t* sha1 = SHA1_final(&ctx);
+    // Start with the key the package names, if it names one.
+    unsigned int first = hinted_key(eocd + EOCD_HEADER_SIZE,
+                                    comment_size - signature_start,
+                                    pKeys, numKeys);
     for (i = 0; i < numKeys; ++i) {
+        size_t k = (first + i) % numKeys;
         // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
         // the signing tool appends after the signature itself.
-        if (RSA_verify(pKeys+i, eocd + eocd_size - 6 - RSANUMBYTES,
+        if (RSA_verify(pKeys+k, eocd + eocd_size - 6 - RSANUMBYTES,
                        RSANUMBYTES, sha1)) {
             LOGI("whole-file signature verified\n");
+            *key = k;
             free(eocd);
             return VERIFY_SUCCESS;
         }
     }
-    free(eocd);
     LOGE("failed to verify whole-file signature\n");
+
+fail:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(eocd);
     return VERIFY_FAILURE;
 }
+
+static void* verify_thread(void* cookie) {
+    VerifyJob* job = (VerifyJob*)cookie;
+    job->result = verify_file_key(job->path, job->pKeys, job->numKeys, &job->key);
+    return NULL;
+}
+
+void verify_file_start(VerifyJob* job, const char* path,
+                       const RSAPublicKey *pKeys, unsigned int numKeys) {
+    job->path = path;
+    job->pKeys = pKeys;
+    job->numKeys = numKeys;
+    job->result = VERIFY_FAILURE;
+    job->key = -1;
+    job->threaded = pthread_create(&job->thread, NULL, verify_thread, job) == 0;
+    if (!job->threaded) {
+        LOGW("can't start verifier thread; verifying now\n");
+        verify_thread(job);
+    }
+}
+
+int verify_file_finish(VerifyJob* job) {
+    if (job->threaded) {
+        pthread_join(job->thread, NULL);
+        job->threaded = 0;
+    }
+    return job->result;
+}
@@ -17,6 +17,8 @@
 #ifndef _RECOVERY_VERIFIER_H
 #define _RECOVERY_VERIFIER_H
 
+#include <pthread.h>
+
 #include "mincrypt/rsa.h"
 
 /* Look in the file for a signature footer, and verify that it
@@ -24,6 +26,36 @@
  */
 int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys);
 
+/* Like verify_file(), but on success also set "*key" to the index of
+ * the key that the signature matched.
+ */
+int verify_file_key(const char* path, const RSAPublicKey *pKeys,
+                    unsigned int numKeys, int* key);
+
+/* verify_file() run on a thread of its own, so that the package can
+ * be opened while its signature is checked.
+ */
+typedef struct {
+    const char* path;
+    const RSAPublicKey* pKeys;
+    unsigned int numKeys;
+    int result;
+    int key;            // index of the matching key, once verified
+    int threaded;
+    pthread_t thread;
+} VerifyJob;
+
+/* Start checking the file.  "path" and "pKeys" must stay valid until
+ * verify_file_finish().  If no thread can be started, the file is
+ * checked before this returns.
+ */
+void verify_file_start(VerifyJob* job, const char* path,
+                       const RSAPublicKey *pKeys, unsigned int numKeys);
+
+/* Wait for the check; return one of the constants below.
+ */
+int verify_file_finish(VerifyJob* job);
+
 #define VERIFY_SUCCESS        0
 #define VERIFY_FAILURE        1
 
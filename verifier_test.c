@@ -14,10 +14,19 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
+#include "keystore.h"
+#include "mincrypt/sha.h"
+#include "sha1.h"
 #include "verifier.h"
 
 // This is build/target/product/security/testkey.x509.pem after being
@@ -71,9 +80,265 @@ void ui_print(const char* fmt, ...) {
 void ui_set_progress(float fraction) {
 }
 
+static double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void report(const char* what, size_t len, double seconds) {
+    printf("%-10s %8.1f MB/s\n", what,
+           seconds > 0 ? len / seconds / (1024 * 1024) : 0.0);
+}
+
+enum { SHA_BEST, SHA_PORTABLE, SHA_MINCRYPT, SHA_IMPLEMENTATIONS };
+
+static const char* sha_name(int impl) {
+    SHA1_CTX ctx;
+    switch (impl) {
+        case SHA_BEST: SHA1_init(&ctx); return SHA1_kernel_name(&ctx);
+        case SHA_PORTABLE: SHA1_init_portable(&ctx); return SHA1_kernel_name(&ctx);
+        default: return "mincrypt";
+    }
+}
+
+// Hash "data" with one of the SHA-1s, "chunk" bytes per update.
+static void sha1_with(int impl, const unsigned char* data, size_t len,
+                      size_t chunk, uint8_t* digest) {
+    SHA1_CTX ctx;
+    SHA_CTX mincrypt;
+    size_t done = 0;
+    if (impl == SHA_MINCRYPT) {
+        SHA_init(&mincrypt);
+    } else if (impl == SHA_BEST) {
+        SHA1_init(&ctx);
+    } else {
+        SHA1_init_portable(&ctx);
+    }
+    do {
+        size_t n = len - done < chunk ? len - done : chunk;
+        if (impl == SHA_MINCRYPT) {
+            SHA_update(&mincrypt, data + done, n);
+        } else {
+            SHA1_update(&ctx, data + done, n);
+        }
+        done += n;
+    } while (done < len);
+    memcpy(digest, impl == SHA_MINCRYPT ? SHA_final(&mincrypt) : SHA1_final(&ctx),
+           SHA1_DIGEST_SIZE);
+}
+
+static void to_hex(const uint8_t* digest, char* hex) {
+    int i;
+    for (i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+}
+
+// Known answers; "data" is repeated "repeat" times.
+static const struct {
+    const char* data;
+    int repeat;
+    const char* digest;
+} sha_vectors[] = {
+    { "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+    { "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+    { "a", 64, "0098ba824b5c16427bd7a1122a5a442a25ec644d" },
+    { "a", 65, "11655326c708d70319be2610e8a57d9a5b959d3b" },
+    { "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+};
+
+// Check every SHA-1 against the known answers, and against each other
+// when fed in chunks of awkward sizes.  Returns the number of failures.
+static int self_test() {
+    static const size_t chunks[] = { 1, 63, 64, 65, 4097, 1024 * 1024 };
+    int failures = 0;
+    unsigned int v;
+    int impl;
+    size_t i, c;
+
+    for (v = 0; v < sizeof(sha_vectors) / sizeof(sha_vectors[0]); ++v) {
+        size_t unit = strlen(sha_vectors[v].data);
+        size_t len = unit * sha_vectors[v].repeat;
+        unsigned char* data = malloc(len + 1);
+        for (i = 0; i < (size_t)sha_vectors[v].repeat; ++i) {
+            memcpy(data + i * unit, sha_vectors[v].data, unit);
+        }
+        for (impl = 0; impl < SHA_IMPLEMENTATIONS; ++impl) {
+            uint8_t digest[SHA1_DIGEST_SIZE];
+            char hex[SHA1_DIGEST_SIZE * 2 + 1];
+            sha1_with(impl, data, len, len ? len : 1, digest);
+            to_hex(digest, hex);
+            if (strcmp(hex, sha_vectors[v].digest) != 0) {
+                printf("%s: %zu bytes: got %s, expected %s\n",
+                       sha_name(impl), len, hex, sha_vectors[v].digest);
+                ++failures;
+            }
+        }
+        free(data);
+    }
+
+    size_t len = 3 * 1024 * 1024 + 17;
+    unsigned char* data = malloc(len);
+    for (i = 0; i < len; ++i) {
+        data[i] = i * 7 + i / 256;
+    }
+    uint8_t expected[SHA1_DIGEST_SIZE];
+    sha1_with(SHA_MINCRYPT, data, len, len, expected);
+    for (impl = 0; impl < SHA_IMPLEMENTATIONS; ++impl) {
+        for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+            uint8_t digest[SHA1_DIGEST_SIZE];
+            sha1_with(impl, data, len, chunks[c], digest);
+            if (memcmp(digest, expected, SHA1_DIGEST_SIZE) != 0) {
+                printf("%s: %zu bytes in %zu-byte updates doesn't match mincrypt\n",
+                       sha_name(impl), len, chunks[c]);
+                ++failures;
+            }
+        }
+    }
+    free(data);
+
+    printf("%s: %d failure%s\n", sha_name(SHA_BEST), failures, failures == 1 ? "" : "s");
+    return failures;
+}
+
+// Hash the whole file (from the page cache) with each SHA-1, checking
+// that they agree, and time verify_file() on it.
+static int benchmark(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return 2;
+    }
+    size_t len = st.st_size;
+    unsigned char* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return 2;
+    }
+
+    uint8_t digests[SHA_IMPLEMENTATIONS][SHA1_DIGEST_SIZE];
+    sha1_with(SHA_BEST, data, len, len, digests[0]);    // pulls the file into the cache
+
+    int impl;
+    for (impl = 0; impl < SHA_IMPLEMENTATIONS; ++impl) {
+        double start = now_seconds();
+        sha1_with(impl, data, len, 1024 * 1024, digests[impl]);
+        report(sha_name(impl), len, now_seconds() - start);
+    }
+    munmap(data, len);
+    int mismatch = 0;
+    for (impl = 1; impl < SHA_IMPLEMENTATIONS; ++impl) {
+        if (memcmp(digests[impl], digests[0], SHA1_DIGEST_SIZE) != 0) {
+            printf("%s and %s disagree!\n", sha_name(0), sha_name(impl));
+            mismatch = 1;
+        }
+    }
+
+    double start = now_seconds();
+    int result = verify_file(path, &test_key, 1);
+    report(result == VERIFY_SUCCESS ? "verify" : "verify(*)", len,
+           now_seconds() - start);
+    return mismatch;
+}
+
+#define KEYS_TEXT "/tmp/verifier_test.keys"
+#define KEYS_STORE "/tmp/verifier_test.keys.bin"
+#define LOAD_ROUNDS 100
+
+// Writes "keys" the way DumpPublicKey does.
+static int write_text_keys(const char* filename, const RSAPublicKey* keys, int numKeys) {
+    FILE* f = fopen(filename, "w");
+    if (f == NULL) return -1;
+    int k, i;
+    for (k = 0; k < numKeys; ++k) {
+        fprintf(f, "%s{%d,0x%x,{", k ? "," : "", keys[k].len, keys[k].n0inv);
+        for (i = 0; i < keys[k].len; ++i) {
+            fprintf(f, "%s%u", i ? "," : "", keys[k].n[i]);
+        }
+        fprintf(f, "},{");
+        for (i = 0; i < keys[k].len; ++i) {
+            fprintf(f, "%s%u", i ? "," : "", keys[k].rr[i]);
+        }
+        fprintf(f, "}}");
+    }
+    return fclose(f);
+}
+
+// Loading a key store includes checking it against the text keys.
+static RSAPublicKey* load_store(const char* filename, int* numKeys) {
+    return keystore_load(filename, KEYS_TEXT, numKeys);
+}
+
+static double time_load(RSAPublicKey* (*load)(const char*, int*), const char* filename) {
+    double start = now_seconds();
+    int i, numKeys;
+    for (i = 0; i < LOAD_ROUNDS; ++i) {
+        free(load(filename, &numKeys));
+    }
+    return (now_seconds() - start) / LOAD_ROUNDS;
+}
+
+static double time_verify(const char* path, const RSAPublicKey* keys, int numKeys) {
+    double start = now_seconds();
+    if (verify_file(path, keys, numKeys) != VERIFY_SUCCESS) {
+        fprintf(stderr, "%s didn't verify\n", path);
+    }
+    return now_seconds() - start;
+}
+
+// Time loading 1, 10 and 100 keys, from text and from a key store, and
+// verifying "path" with the test key first and last among them.
+static int benchmark_keys(const char* path) {
+    static const int counts[] = { 1, 10, 100 };
+    RSAPublicKey keys[100];
+    unsigned int c;
+    int i;
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        int n = counts[c];
+        for (i = 0; i < n; ++i) {
+            keys[i] = test_key;
+            keys[i].n[0] ^= i + 1;
+        }
+        keys[n-1] = test_key;
+        if (write_text_keys(KEYS_TEXT, keys, n) != 0 ||
+            keystore_write(KEYS_STORE, keys, n, KEYS_TEXT) != 0) {
+            fprintf(stderr, "can't write keys to /tmp\n");
+            return 2;
+        }
+        double text = time_load(keystore_load_text, KEYS_TEXT);
+        double binary = time_load(load_store, KEYS_STORE);
+        time_verify(path, keys, n);     // pulls the file into the cache
+        double last = time_verify(path, keys, n);
+        keys[n-1] = keys[0];
+        keys[0] = test_key;
+        double first = time_verify(path, keys, n);
+        printf("%3d keys: load %8.1f us (text) %8.1f us (binary); "
+               "verify %8.1f ms (key last) %8.1f ms (key first)\n",
+               n, text * 1e6, binary * 1e6, last * 1e3, first * 1e3);
+    }
+    unlink(KEYS_TEXT);
+    unlink(KEYS_STORE);
+    return 0;
+}
+
 int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-b") == 0) {
+        return benchmark(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[1], "-k") == 0) {
+        return benchmark_keys(argv[2]);
+    }
+    if (argc == 2 && strcmp(argv[1], "-s") == 0) {
+        return self_test() == 0 ? 0 : 1;
+    }
     if (argc != 2) {
-        fprintf(stderr, "Usage: %s <package>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-b|-k] <package>\n"
+                        "       %s -s\n", argv[0], argv[0]);
         return 2;
     }
 
@@ -0,0 +1,198 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "sha1.h"
+#include "verify_cache.h"
+
+// Read from the start and the end of the package, where the signature
+// is, and from a few places between.
+#define EDGE_SAMPLE_SIZE (64 * 1024)
+#define SAMPLE_SIZE 4096
+#define SAMPLES 16
+
+// A package rewritten within the same second still gets a new ctime.
+#ifdef __BIONIC__
+#define CTIME_NSEC(st) ((st).st_ctime_nsec)
+#else
+#define CTIME_NSEC(st) ((st).st_ctim.tv_nsec)
+#endif
+
+#define HEX_SIZE (SHA1_DIGEST_SIZE * 2 + 1)
+#define LINE_SIZE (PATH_MAX + 256)
+
+static void to_hex(const uint8_t* digest, char* hex)
+{
+    int i;
+    for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+        sprintf(hex + i * 2, "%02x", digest[i]);
+}
+
+static int hash_range(int fd, off64_t start, size_t len, SHA1_CTX* ctx)
+{
+    unsigned char buf[SAMPLE_SIZE];
+    while (len > 0) {
+        size_t want = len < sizeof(buf) ? len : sizeof(buf);
+        ssize_t got = pread64(fd, buf, want, start);
+        if (got <= 0)
+            return -1;
+        SHA1_update(ctx, buf, got);
+        start += got;
+        len -= got;
+    }
+    return 0;
+}
+
+// SHA-1 of samples of the package; "st" is what fstat() said about it.
+static int sample_file(int fd, const struct stat* st, char* hex)
+{
+    off64_t size = st->st_size;
+    SHA1_CTX ctx;
+    SHA1_init(&ctx);
+    SHA1_update(&ctx, &size, sizeof(size));
+    if (size <= 2 * EDGE_SAMPLE_SIZE) {
+        if (hash_range(fd, 0, size, &ctx) != 0)
+            return -1;
+    } else {
+        if (hash_range(fd, 0, EDGE_SAMPLE_SIZE, &ctx) != 0)
+            return -1;
+        off64_t between = size - 2 * EDGE_SAMPLE_SIZE - SAMPLE_SIZE;
+        int i;
+        for (i = 0; between > 0 && i < SAMPLES; i++) {
+            if (hash_range(fd, EDGE_SAMPLE_SIZE + between * i / (SAMPLES - 1),
+                           SAMPLE_SIZE, &ctx) != 0)
+                return -1;
+        }
+        if (hash_range(fd, size - EDGE_SAMPLE_SIZE, EDGE_SAMPLE_SIZE, &ctx) != 0)
+            return -1;
+    }
+    to_hex(SHA1_final(&ctx), hex);
+    return 0;
+}
+
+static void key_hex(const RSAPublicKey* key, char* hex)
+{
+    SHA1_CTX ctx;
+    SHA1_init(&ctx);
+    SHA1_update(&ctx, key, sizeof(*key));
+    to_hex(SHA1_final(&ctx), hex);
+}
+
+// Fills "line" with the record for "path" as it is now.
+static int describe(const char* path, const char* key, char* line)
+{
+    int fd = open(path, O_RDONLY | O_LARGEFILE);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    char sample[HEX_SIZE];
+    int ret = -1;
+    if (fstat(fd, &st) == 0 && sample_file(fd, &st, sample) == 0) {
+        snprintf(line, LINE_SIZE, "%llu %llu %lld %ld %ld.%09ld %s %s %s\n",
+                 (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+                 (long long)st.st_size, (long)st.st_mtime, (long)st.st_ctime, (long)CTIME_NSEC(st),
+                 sample, key, path);
+        ret = 0;
+    }
+    close(fd);
+    return ret;
+}
+
+// Splits a record into the part that identifies the package and its key.
+static int parse(char* line, char** key, char** path)
+{
+    char* fields[7];
+    int i;
+    char* p = line;
+    for (i = 0; i < 7; i++) {
+        fields[i] = p;
+        p = strchr(p, ' ');
+        if (p == NULL)
+            return -1;
+        if (i == 5 || i == 6)
+            *p = '\0';
+        p++;
+    }
+    p[strcspn(p, "\n")] = '\0';
+    *key = fields[6];
+    *path = p;
+    return 0;
+}
+
+int verify_cache_lookup(const char* path, const RSAPublicKey* pKeys, unsigned int numKeys)
+{
+    FILE* f = fopen(VERIFY_CACHE_FILE, "r");
+    if (f == NULL)
+        return -1;
+    char line[LINE_SIZE];
+    char* key = NULL;
+    char* cached_path;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (parse(line, &key, &cached_path) == 0 && strcmp(cached_path, path) == 0)
+            break;
+        key = NULL;
+    }
+    fclose(f);
+    if (key == NULL)
+        return -1;
+
+    // Everything before the key (now ended by a '\0') has to match the
+    // package as it is now.
+    char current[LINE_SIZE];
+    if (describe(path, key, current) != 0 ||
+        strncmp(current, line, strlen(line)) != 0 ||
+        current[strlen(line)] != ' ')
+        return -1;
+
+    unsigned int i;
+    for (i = 0; i < numKeys; i++) {
+        char hex[HEX_SIZE];
+        key_hex(pKeys + i, hex);
+        if (strcmp(hex, key) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void verify_cache_store(const char* path, const RSAPublicKey* key)
+{
+    char hex[HEX_SIZE];
+    char line[LINE_SIZE];
+    key_hex(key, hex);
+    if (describe(path, hex, line) != 0)
+        return;
+
+    char tmp[PATH_MAX];
+    sprintf(tmp, "%s.tmp", VERIFY_CACHE_FILE);
+    FILE* out = fopen(tmp, "w");
+    if (out == NULL)
+        return;
+    fputs(line, out);
+
+    // Keep the other packages, most recent first.
+    FILE* in = fopen(VERIFY_CACHE_FILE, "r");
+    if (in != NULL) {
+        int kept = 1;
+        while (kept < VERIFY_CACHE_ENTRIES && fgets(line, sizeof(line), in) != NULL) {
+            char copy[LINE_SIZE];
+            char* cached_key;
+            char* cached_path;
+            strcpy(copy, line);
+            if (parse(copy, &cached_key, &cached_path) != 0 || strcmp(cached_path, path) == 0)
+                continue;
+            fputs(line, out);
+            kept++;
+        }
+        fclose(in);
+    }
+    if (fclose(out) != 0 || rename(tmp, VERIFY_CACHE_FILE) != 0) {
+        LOGW("can't save %s\n", VERIFY_CACHE_FILE);
+        unlink(tmp);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef RECOVERY_VERIFY_CACHE_H
+#define RECOVERY_VERIFY_CACHE_H
+
+#include "mincrypt/rsa.h"
+
+// Packages whose signature has checked out, so that flashing the same
+// package again doesn't hash all of it.  A package is known by its path,
+// device, inode, size, mtime and ctime, and by a SHA-1 of a few samples
+// of its contents, including the tail that holds the signature.  The key
+// that verified it is recorded by a SHA-1 of the key, so that a package
+// is only trusted while that key is still one of "pKeys".
+//
+// The records live in /tmp, so only recovery can write them and they
+// last for one recovery session.  Anything on /cache could be rewritten
+// from Android together with the package it vouches for.
+//
+// One line per package, most recent first:
+//
+//    <dev> <ino> <size> <mtime> <ctime> <sample sha1> <key sha1> <path>
+
+#define VERIFY_CACHE_FILE "/tmp/verified_packages"
+#define VERIFY_CACHE_ENTRIES 16
+
+// Index in "pKeys" of the key that "path" verified with, or -1 if the
+// package isn't in the cache as it is now.
+int verify_cache_lookup(const char* path, const RSAPublicKey* pKeys, unsigned int numKeys);
+
+// Record that "path" verified with "key".
+void verify_cache_store(const char* path, const RSAPublicKey* key);
+
+#endif